@@ -13,8 +13,12 @@ void DebugDraw3DConfig::_bind_methods() {
 	REG_PROP_BOOL(use_frustum_culling);
 	REG_PROP(frustum_culling_mode, Variant::INT);
 	REG_PROP(frustum_length_scale, Variant::FLOAT);
+	REG_PROP(culling_min_screen_size, Variant::FLOAT);
+	REG_PROP(lod_hd_sphere_distance, Variant::FLOAT);
+	REG_PROP(lod_volumetric_distance, Variant::FLOAT);
 	REG_PROP_BOOL(force_use_camera_from_scene);
 	REG_PROP(geometry_render_layers, Variant::INT);
+	REG_PROP(geometry_release_delay, Variant::FLOAT);
 	REG_PROP(line_hit_color, Variant::COLOR);
 	REG_PROP(line_after_hit_color, Variant::COLOR);
 
@@ -66,6 +70,30 @@ real_t DebugDraw3DConfig::get_frustum_length_scale() const {
 	return frustum_length_scale;
 }
 
+void DebugDraw3DConfig::set_culling_min_screen_size(const real_t &_size) {
+	culling_min_screen_size = Math::max(_size, (real_t)0.0);
+}
+
+real_t DebugDraw3DConfig::get_culling_min_screen_size() const {
+	return culling_min_screen_size;
+}
+
+void DebugDraw3DConfig::set_lod_hd_sphere_distance(const real_t &_distance) {
+	lod_hd_sphere_distance = Math::max(_distance, (real_t)0.0);
+}
+
+real_t DebugDraw3DConfig::get_lod_hd_sphere_distance() const {
+	return lod_hd_sphere_distance;
+}
+
+void DebugDraw3DConfig::set_lod_volumetric_distance(const real_t &_distance) {
+	lod_volumetric_distance = Math::max(_distance, (real_t)0.0);
+}
+
+real_t DebugDraw3DConfig::get_lod_volumetric_distance() const {
+	return lod_volumetric_distance;
+}
+
 void DebugDraw3DConfig::set_force_use_camera_from_scene(const bool &_state) {
 	force_use_camera_from_scene = _state;
 }
@@ -82,6 +110,14 @@ int32_t DebugDraw3DConfig::get_geometry_render_layers() const {
 	return geometry_render_layers;
 }
 
+void DebugDraw3DConfig::set_geometry_release_delay(const real_t &_delay) {
+	geometry_release_delay = Math::max(_delay, (real_t)0.0);
+}
+
+real_t DebugDraw3DConfig::get_geometry_release_delay() const {
+	return geometry_release_delay;
+}
+
 void DebugDraw3DConfig::set_line_hit_color(const Color &_new_color) {
 	line_hit_color = _new_color;
 }
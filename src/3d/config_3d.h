@@ -30,11 +30,15 @@ public:
 
 private:
 	int32_t geometry_render_layers = 1;
+	real_t geometry_release_delay = 10;
 	bool freeze_3d_render = false;
 	bool visible_instance_bounds = false;
 	CullingMode frustum_culling_mode = CullingMode::FRUSTUM_PRECISE;
 	real_t frustum_length_scale = 1;
 	bool force_use_camera_from_scene = false;
+	real_t culling_min_screen_size = 0;
+	real_t lod_hd_sphere_distance = 0;
+	real_t lod_volumetric_distance = 0;
 	Color line_hit_color = Colors::red;
 	Color line_after_hit_color = Colors::green;
 
@@ -81,6 +85,32 @@ public:
 	NAPI void set_frustum_length_scale(const real_t &_distance);
 	NAPI real_t get_frustum_length_scale() const;
 
+	/**
+	 * Set the minimum size of instances on the screen in pixels.
+	 * Smaller instances are not drawn. The size is calculated from the instance boundaries.
+	 *
+	 * Set 0 to disable.
+	 */
+	NAPI void set_culling_min_screen_size(const real_t &_size);
+	NAPI real_t get_culling_min_screen_size() const;
+
+	/**
+	 * Set the distance from the camera after which the HD spheres are drawn as regular spheres.
+	 *
+	 * Set 0 to disable.
+	 */
+	NAPI void set_lod_hd_sphere_distance(const real_t &_distance);
+	NAPI real_t get_lod_hd_sphere_distance() const;
+
+	/**
+	 * Set the distance from the camera after which the volumetric shapes are drawn as wireframes.
+	 * Volumetric lines are not affected.
+	 *
+	 * Set 0 to disable.
+	 */
+	NAPI void set_lod_volumetric_distance(const real_t &_distance);
+	NAPI real_t get_lod_volumetric_distance() const;
+
 	/**
 	 * Set the forced use of the scene camera instead of the editor camera.
 	 */
@@ -94,6 +124,15 @@ public:
 	NAPI void set_geometry_render_layers(const int32_t &_layers);
 	NAPI int32_t get_geometry_render_layers() const;
 
+	/**
+	 * Set the time in seconds after which the rendering instances of the unused geometry types are freed.
+	 * They are created again when the geometry of their type is drawn.
+	 *
+	 * Set 0 to never free them.
+	 */
+	NAPI void set_geometry_release_delay(const real_t &_delay);
+	NAPI real_t get_geometry_release_delay() const;
+
 	/**
 	 * Set the default color for the collision point of DebugDraw3D.draw_line_hit.
 	 */
@@ -2,6 +2,8 @@
 
 #include "utils/utils.h"
 
+#include <atomic>
+
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/templates/hashfuncs.hpp>
 GODOT_WARNING_RESTORE()
@@ -49,6 +51,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_thickness(const real_t &
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_thickness_selfreturn(const real_t &_value) const {
+	data->version = Data::get_next_version();
 	data->thickness = Math::clamp(_value, (real_t)0, (real_t)100);
 }
 
@@ -62,6 +65,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_center_brightness(const
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_center_brightness_selfreturn(const real_t &_value) const {
+	data->version = Data::get_next_version();
 	data->center_brightness = Math::clamp(_value, (real_t)0, (real_t)1);
 }
 
@@ -75,6 +79,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_hd_sphere(const bool &_v
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_hd_sphere_selfreturn(const bool &_value) const {
+	data->version = Data::get_next_version();
 	data->hd_sphere = _value;
 }
 
@@ -88,6 +93,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_plane_size(const real_t
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_plane_size_selfreturn(const real_t &_value) const {
+	data->version = Data::get_next_version();
 	data->plane_size = _value;
 }
 
@@ -101,6 +107,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_transform(const Transfor
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_transform_selfreturn(const Transform3D &_value) const {
+	data->version = Data::get_next_version();
 	const static Transform3D identity = Transform3D();
 
 	data->transform = _value;
@@ -117,6 +124,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_text_outline_color(const
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_text_outline_color_selfreturn(const Color &_value) const {
+	data->version = Data::get_next_version();
 	data->text_outline_color = _value;
 	uint32_t hash = hash_murmur3_one_float(_value.r);
 	hash = hash_murmur3_one_float(_value.g, hash);
@@ -134,6 +142,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_text_outline_size(const
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_text_outline_size_selfreturn(const int32_t &_value) const {
+	data->version = Data::get_next_version();
 	data->text_outline_size = _value;
 }
 
@@ -147,6 +156,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_text_fixed_size(const bo
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_text_fixed_size_selfreturn(const bool &_value) const {
+	data->version = Data::get_next_version();
 	data->text_fixed_size = _value;
 }
 
@@ -160,6 +170,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_text_font(const Ref<Font
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_text_font_selfreturn(const Ref<Font> &_value) const {
+	data->version = Data::get_next_version();
 	data->text_font = _value;
 }
 
@@ -173,6 +184,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_viewport(Viewport *_valu
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_viewport_selfreturn(godot::Viewport *_value) const {
+	data->version = Data::get_next_version();
 	data->dcd.viewport = _value;
 	data->dcd.viewport_id = _value ? _value->get_instance_id() : 0;
 }
@@ -187,6 +199,7 @@ Ref<DebugDraw3DScopeConfig> DebugDraw3DScopeConfig::set_no_depth_test(const bool
 }
 
 NSELF_RETURN DebugDraw3DScopeConfig::set_no_depth_test_selfreturn(const bool &_value) const {
+	data->version = Data::get_next_version();
 	data->dcd.no_depth_test = _value;
 }
 
@@ -229,7 +242,8 @@ DebugDraw3DScopeConfig::Data::Data() :
 		text_font(nullptr),
 		dcd({}),
 		hd_sphere(false),
-		custom_xform(false) {
+		custom_xform(false),
+		version(get_next_version()) {
 	uint32_t hash = hash_murmur3_one_float(text_outline_color.r);
 	hash = hash_murmur3_one_float(text_outline_color.g, hash);
 	hash = hash_murmur3_one_float(text_outline_color.b, hash);
@@ -248,5 +262,11 @@ DebugDraw3DScopeConfig::Data::Data(const Data *p_parent) :
 		text_font(p_parent->text_font),
 		dcd(p_parent->dcd),
 		hd_sphere(p_parent->hd_sphere),
-		custom_xform(p_parent->custom_xform) {
+		custom_xform(p_parent->custom_xform),
+		version(get_next_version()) {
+}
+
+uint64_t DebugDraw3DScopeConfig::Data::get_next_version() {
+	static std::atomic<uint64_t> last_version = 0;
+	return ++last_version;
 }
@@ -94,9 +94,12 @@ public:
 		DebugContainerDependent dcd;
 		bool hd_sphere;
 		bool custom_xform;
+		// Unique for each state of each instance, so a copy of the data stays valid while the version is the same
+		uint64_t version;
 
 		Data();
 		Data(const Data *parent);
+		static uint64_t get_next_version();
 	};
 	/// @private
 	std::shared_ptr<Data> data = nullptr;
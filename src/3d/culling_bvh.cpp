@@ -0,0 +1,174 @@
+#include "culling_bvh.h"
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "utils/utils.h"
+
+#include <algorithm>
+
+static _FORCE_INLINE_ culling_real_t get_sphere_axis(const CullingSphere &p_sphere, int p_axis) {
+	return p_axis == 0 ? p_sphere.x : (p_axis == 1 ? p_sphere.y : p_sphere.z);
+}
+
+bool CullingBVH::is_rebuild_required(size_t p_count) const {
+	if (!is_built() || p_count < get_indexed_count()) {
+		return true;
+	}
+
+	// Not indexed slots are culled one by one, and reused slots make the nodes looser
+	return (p_count - get_indexed_count()) + updates_since_build > get_indexed_count() / 4;
+}
+
+void CullingBVH::build(const CullingSphere *p_spheres, size_t p_count) {
+	ZoneScoped;
+	ZoneValue(p_count);
+	clear();
+
+	if (p_count == 0) {
+		return;
+	}
+
+	items.resize(p_count);
+	for (size_t i = 0; i < p_count; i++) {
+		items[i] = (uint32_t)i;
+	}
+	item_leaves.resize(p_count);
+
+	nodes.reserve(p_count / MAX_LEAF_SIZE * 2 + 1);
+	nodes.emplace_back();
+	_build_node(p_spheres, 0, 0, (uint32_t)p_count);
+}
+
+void CullingBVH::_build_node(const CullingSphere *p_spheres, uint32_t p_node, uint32_t p_first, uint32_t p_count) {
+	CullingBox box;
+	for (uint32_t i = p_first; i < p_first + p_count; i++) {
+		box.merge_with(p_spheres[items[i]], i == p_first);
+	}
+
+	{
+		// `nodes` can be reallocated by the children
+		Node &node = nodes[p_node];
+		node.box = box;
+		node.first_item = p_first;
+		node.item_count = p_count;
+	}
+
+	if (p_count <= MAX_LEAF_SIZE) {
+		for (uint32_t i = p_first; i < p_first + p_count; i++) {
+			item_leaves[items[i]] = p_node;
+		}
+		return;
+	}
+
+	// Split by the median of the centers along the longest axis
+	const culling_real_t size_x = box.max_x - box.min_x;
+	const culling_real_t size_y = box.max_y - box.min_y;
+	const culling_real_t size_z = box.max_z - box.min_z;
+	const int axis = size_x >= size_y && size_x >= size_z ? 0 : (size_y >= size_z ? 1 : 2);
+
+	const uint32_t mid = p_first + p_count / 2;
+	std::nth_element(items.begin() + p_first, items.begin() + mid, items.begin() + p_first + p_count, [p_spheres, axis](uint32_t a, uint32_t b) {
+		return get_sphere_axis(p_spheres[a], axis) < get_sphere_axis(p_spheres[b], axis);
+	});
+
+	const uint32_t left = (uint32_t)nodes.size();
+	nodes.emplace_back();
+	nodes.emplace_back();
+	nodes[p_node].left = left;
+	nodes[left].parent = p_node;
+	nodes[left + 1].parent = p_node;
+
+	_build_node(p_spheres, left, p_first, mid - p_first);
+	_build_node(p_spheres, left + 1, mid, p_first + p_count - mid);
+}
+
+void CullingBVH::update(size_t p_idx, const CullingSphere &p_sphere) {
+	if (p_idx >= get_indexed_count()) {
+		return;
+	}
+	updates_since_build++;
+
+	uint32_t n = item_leaves[p_idx];
+	while (n != INVALID_NODE) {
+		CullingBox &box = nodes[n].box;
+		// the parents already contain this node
+		if (box.contains(p_sphere)) {
+			break;
+		}
+		box.merge_with(p_sphere, false);
+		n = nodes[n].parent;
+	}
+}
+
+void CullingBVH::clear() {
+	nodes.clear();
+	items.clear();
+	item_leaves.clear();
+	updates_since_build = 0;
+}
+
+CullingBVH::Containment CullingBVH::_classify(const CullingBox &p_box, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count) {
+	// Same rules as in `CullingKernels::is_sphere_visible`
+	if (p_boxes_count == 0) {
+		return INSIDE;
+	}
+
+	bool is_in_box = false;
+	bool is_inside_box = false;
+	for (size_t b = 0; b < p_boxes_count; b++) {
+		if (p_boxes[b].intersects(p_box)) {
+			is_in_box = true;
+			if (p_boxes[b].contains(p_box)) {
+				is_inside_box = true;
+				break;
+			}
+		}
+	}
+
+	if (!is_in_box) {
+		return OUTSIDE;
+	}
+
+	if (p_frustums_count == 0) {
+		return is_inside_box ? INSIDE : INTERSECTS;
+	}
+
+	bool is_in_frustum = false;
+	bool is_inside_frustum = false;
+	for (size_t f = 0; f < p_frustums_count; f++) {
+		bool is_outside = false;
+		bool is_inside = true;
+		for (const auto &plane : p_frustums[f]) {
+			// The nearest and the farthest corners of the box relative to the plane
+			const culling_real_t min_dist = plane.normal_x * (plane.normal_x > 0 ? p_box.min_x : p_box.max_x) +
+					plane.normal_y * (plane.normal_y > 0 ? p_box.min_y : p_box.max_y) +
+					plane.normal_z * (plane.normal_z > 0 ? p_box.min_z : p_box.max_z) - plane.d;
+			if (min_dist > 0) {
+				is_outside = true;
+				break;
+			}
+
+			const culling_real_t max_dist = plane.normal_x * (plane.normal_x > 0 ? p_box.max_x : p_box.min_x) +
+					plane.normal_y * (plane.normal_y > 0 ? p_box.max_y : p_box.min_y) +
+					plane.normal_z * (plane.normal_z > 0 ? p_box.max_z : p_box.min_z) - plane.d;
+			if (max_dist > 0) {
+				is_inside = false;
+			}
+		}
+
+		if (!is_outside) {
+			is_in_frustum = true;
+			if (is_inside) {
+				is_inside_frustum = true;
+				break;
+			}
+		}
+	}
+
+	if (!is_in_frustum) {
+		return OUTSIDE;
+	}
+	return is_inside_box && is_inside_frustum ? INSIDE : INTERSECTS;
+}
+
+#endif
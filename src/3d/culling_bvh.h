@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "culling_kernels.h"
+
+#include <cstdint>
+#include <vector>
+
+// A bounding volume hierarchy over the slots of a storage of long-lived objects,
+// so the culling cost depends on the number of visible objects and not on the size of the storage.
+// The tree does not know which slots are in use, so the found slots must be checked by the caller.
+// Reused slots only enlarge the nodes of their leaves, and the slots added after the build are not indexed,
+// so the tree must be rebuilt when `is_rebuild_required` returns true.
+class CullingBVH {
+	static constexpr uint32_t MAX_LEAF_SIZE = 8;
+	static constexpr uint32_t INVALID_NODE = UINT32_MAX;
+
+	enum Containment : char {
+		OUTSIDE,
+		INTERSECTS,
+		INSIDE,
+	};
+
+	struct Node {
+		CullingBox box;
+		uint32_t parent = INVALID_NODE;
+		// The right child always follows the left one. Leaves have no children.
+		uint32_t left = 0;
+		// The range of `items` covered by the node
+		uint32_t first_item = 0;
+		uint32_t item_count = 0;
+	};
+
+	std::vector<Node> nodes;
+	// Indexes of the slots sorted so that each node covers a continuous range
+	std::vector<uint32_t> items;
+	// The leaf of each indexed slot
+	std::vector<uint32_t> item_leaves;
+	size_t updates_since_build = 0;
+
+	void _build_node(const CullingSphere *p_spheres, uint32_t p_node, uint32_t p_first, uint32_t p_count);
+	static Containment _classify(const CullingBox &p_box, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count);
+
+public:
+	// The number of slots from which the tree is faster than the linear culling
+	static constexpr size_t MIN_SLOTS_COUNT = 2048;
+
+	_FORCE_INLINE_ bool is_built() const {
+		return nodes.size();
+	}
+
+	_FORCE_INLINE_ size_t get_indexed_count() const {
+		return item_leaves.size();
+	}
+
+	// Returns true if the storage of `p_count` slots is not covered well enough by the tree
+	bool is_rebuild_required(size_t p_count) const;
+	void build(const CullingSphere *p_spheres, size_t p_count);
+	// Must be called when a slot gets new bounds. Slots that are not indexed are ignored.
+	void update(size_t p_idx, const CullingSphere &p_sphere);
+	void clear();
+
+	// Calls `p_func(size_t idx, bool is_inside)` for each of `p_count` slots that can be visible.
+	// `is_inside` is true if the slot is visible without additional checks.
+	// The slots that are not indexed are always passed.
+	template <class TFunc>
+	void query(size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, TFunc p_func) const;
+};
+
+template <class TFunc>
+void CullingBVH::query(size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, TFunc p_func) const {
+	if (nodes.size()) {
+		// The depth of the tree is limited by the median split
+		uint32_t stack[64];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+
+		while (stack_size) {
+			const Node &node = nodes[stack[--stack_size]];
+			Containment c = _classify(node.box, p_boxes, p_boxes_count, p_frustums, p_frustums_count);
+			if (c == OUTSIDE) {
+				continue;
+			}
+
+			if (c == INSIDE || node.left == 0) {
+				const bool is_inside = c == INSIDE;
+				for (uint32_t i = node.first_item; i < node.first_item + node.item_count; i++) {
+					p_func((size_t)items[i], is_inside);
+				}
+				continue;
+			}
+
+			stack[stack_size++] = node.left + 1;
+			stack[stack_size++] = node.left;
+		}
+	}
+
+	for (size_t i = get_indexed_count(); i < p_count; i++) {
+		p_func(i, false);
+	}
+}
+
+#endif
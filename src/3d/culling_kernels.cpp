@@ -0,0 +1,315 @@
+#include "culling_kernels.h"
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "utils/utils.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CULLING_KERNELS_X86
+
+#if _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#define TARGET_SSE
+#define TARGET_AVX
+#else
+#include <immintrin.h>
+#define TARGET_SSE __attribute__((target("sse")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+static void cull_spheres_scalar(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask) {
+	memset(r_mask, 0, CullingKernels::get_mask_size(p_count) * sizeof(uint64_t));
+
+	for (size_t i = 0; i < p_count; i++) {
+		if (CullingKernels::is_sphere_visible(p_spheres[i], p_boxes, p_boxes_count, p_frustums, p_frustums_count)) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+	}
+}
+
+#ifdef CULLING_KERNELS_X86
+#ifndef REAL_T_IS_DOUBLE
+TARGET_SSE static void cull_spheres_sse(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask) {
+	memset(r_mask, 0, CullingKernels::get_mask_size(p_count) * sizeof(uint64_t));
+
+	if (p_boxes_count == 0) {
+		for (size_t i = 0; i < p_count; i++) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+		return;
+	}
+
+	size_t i = 0;
+	for (; i + 4 <= p_count; i += 4) {
+		// x, y, z, radius of 4 spheres
+		__m128 x = _mm_loadu_ps(&p_spheres[i].x);
+		__m128 y = _mm_loadu_ps(&p_spheres[i + 1].x);
+		__m128 z = _mm_loadu_ps(&p_spheres[i + 2].x);
+		__m128 r = _mm_loadu_ps(&p_spheres[i + 3].x);
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+
+		const __m128 min_x = _mm_sub_ps(x, r);
+		const __m128 min_y = _mm_sub_ps(y, r);
+		const __m128 min_z = _mm_sub_ps(z, r);
+		const __m128 max_x = _mm_add_ps(x, r);
+		const __m128 max_y = _mm_add_ps(y, r);
+		const __m128 max_z = _mm_add_ps(z, r);
+
+		__m128 visible = _mm_setzero_ps();
+		for (size_t b = 0; b < p_boxes_count; b++) {
+			const CullingBox &box = p_boxes[b];
+			__m128 m = _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(box.min_x), max_x), _mm_cmpgt_ps(_mm_set1_ps(box.max_x), min_x));
+			m = _mm_and_ps(m, _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(box.min_y), max_y), _mm_cmpgt_ps(_mm_set1_ps(box.max_y), min_y)));
+			m = _mm_and_ps(m, _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(box.min_z), max_z), _mm_cmpgt_ps(_mm_set1_ps(box.max_z), min_z)));
+			visible = _mm_or_ps(visible, m);
+		}
+
+		if (p_frustums_count && _mm_movemask_ps(visible)) {
+			__m128 in_frustum = _mm_setzero_ps();
+			for (size_t f = 0; f < p_frustums_count; f++) {
+				__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+				for (const auto &plane : p_frustums[f]) {
+					__m128 dist = _mm_sub_ps(
+							_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.normal_x), x), _mm_mul_ps(_mm_set1_ps(plane.normal_y), y)), _mm_mul_ps(_mm_set1_ps(plane.normal_z), z)),
+							_mm_set1_ps(plane.d));
+					// !(radius < dist)
+					inside = _mm_and_ps(inside, _mm_cmpnlt_ps(r, dist));
+				}
+				in_frustum = _mm_or_ps(in_frustum, inside);
+			}
+			visible = _mm_and_ps(visible, in_frustum);
+		}
+
+		r_mask[i / 64] |= (uint64_t)_mm_movemask_ps(visible) << (i % 64);
+	}
+
+	for (; i < p_count; i++) {
+		if (CullingKernels::is_sphere_visible(p_spheres[i], p_boxes, p_boxes_count, p_frustums, p_frustums_count)) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+	}
+}
+
+TARGET_AVX static void cull_spheres_avx(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask) {
+	memset(r_mask, 0, CullingKernels::get_mask_size(p_count) * sizeof(uint64_t));
+
+	if (p_boxes_count == 0) {
+		for (size_t i = 0; i < p_count; i++) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+		return;
+	}
+
+	size_t i = 0;
+	for (; i + 8 <= p_count; i += 8) {
+		// x, y, z, radius of 8 spheres
+		__m128 x0 = _mm_loadu_ps(&p_spheres[i].x);
+		__m128 y0 = _mm_loadu_ps(&p_spheres[i + 1].x);
+		__m128 z0 = _mm_loadu_ps(&p_spheres[i + 2].x);
+		__m128 r0 = _mm_loadu_ps(&p_spheres[i + 3].x);
+		_MM_TRANSPOSE4_PS(x0, y0, z0, r0);
+		__m128 x1 = _mm_loadu_ps(&p_spheres[i + 4].x);
+		__m128 y1 = _mm_loadu_ps(&p_spheres[i + 5].x);
+		__m128 z1 = _mm_loadu_ps(&p_spheres[i + 6].x);
+		__m128 r1 = _mm_loadu_ps(&p_spheres[i + 7].x);
+		_MM_TRANSPOSE4_PS(x1, y1, z1, r1);
+
+		const __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+		const __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+		const __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+		const __m256 r = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r1, 1);
+
+		const __m256 min_x = _mm256_sub_ps(x, r);
+		const __m256 min_y = _mm256_sub_ps(y, r);
+		const __m256 min_z = _mm256_sub_ps(z, r);
+		const __m256 max_x = _mm256_add_ps(x, r);
+		const __m256 max_y = _mm256_add_ps(y, r);
+		const __m256 max_z = _mm256_add_ps(z, r);
+
+		__m256 visible = _mm256_setzero_ps();
+		for (size_t b = 0; b < p_boxes_count; b++) {
+			const CullingBox &box = p_boxes[b];
+			__m256 m = _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(box.min_x), max_x, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_set1_ps(box.max_x), min_x, _CMP_GT_OQ));
+			m = _mm256_and_ps(m, _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(box.min_y), max_y, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_set1_ps(box.max_y), min_y, _CMP_GT_OQ)));
+			m = _mm256_and_ps(m, _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(box.min_z), max_z, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_set1_ps(box.max_z), min_z, _CMP_GT_OQ)));
+			visible = _mm256_or_ps(visible, m);
+		}
+
+		if (p_frustums_count && _mm256_movemask_ps(visible)) {
+			__m256 in_frustum = _mm256_setzero_ps();
+			for (size_t f = 0; f < p_frustums_count; f++) {
+				__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (const auto &plane : p_frustums[f]) {
+					__m256 dist = _mm256_sub_ps(
+							_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.normal_x), x), _mm256_mul_ps(_mm256_set1_ps(plane.normal_y), y)), _mm256_mul_ps(_mm256_set1_ps(plane.normal_z), z)),
+							_mm256_set1_ps(plane.d));
+					// !(radius < dist)
+					inside = _mm256_and_ps(inside, _mm256_cmp_ps(r, dist, _CMP_NLT_UQ));
+				}
+				in_frustum = _mm256_or_ps(in_frustum, inside);
+			}
+			visible = _mm256_and_ps(visible, in_frustum);
+		}
+
+		r_mask[i / 64] |= (uint64_t)_mm256_movemask_ps(visible) << (i % 64);
+	}
+
+	for (; i < p_count; i++) {
+		if (CullingKernels::is_sphere_visible(p_spheres[i], p_boxes, p_boxes_count, p_frustums, p_frustums_count)) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+	}
+}
+#else
+// Double precision bounds, 4 spheres per iteration
+TARGET_AVX static void cull_spheres_avx(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask) {
+	memset(r_mask, 0, CullingKernels::get_mask_size(p_count) * sizeof(uint64_t));
+
+	if (p_boxes_count == 0) {
+		for (size_t i = 0; i < p_count; i++) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+		return;
+	}
+
+	size_t i = 0;
+	for (; i + 4 <= p_count; i += 4) {
+		// x, y, z, radius of 4 spheres
+		const __m256d s0 = _mm256_loadu_pd(&p_spheres[i].x);
+		const __m256d s1 = _mm256_loadu_pd(&p_spheres[i + 1].x);
+		const __m256d s2 = _mm256_loadu_pd(&p_spheres[i + 2].x);
+		const __m256d s3 = _mm256_loadu_pd(&p_spheres[i + 3].x);
+		// x0 x1 z0 z1, y0 y1 r0 r1, x2 x3 z2 z3, y2 y3 r2 r3
+		const __m256d t0 = _mm256_unpacklo_pd(s0, s1);
+		const __m256d t1 = _mm256_unpackhi_pd(s0, s1);
+		const __m256d t2 = _mm256_unpacklo_pd(s2, s3);
+		const __m256d t3 = _mm256_unpackhi_pd(s2, s3);
+
+		const __m256d x = _mm256_permute2f128_pd(t0, t2, 0x20);
+		const __m256d y = _mm256_permute2f128_pd(t1, t3, 0x20);
+		const __m256d z = _mm256_permute2f128_pd(t0, t2, 0x31);
+		const __m256d r = _mm256_permute2f128_pd(t1, t3, 0x31);
+
+		const __m256d min_x = _mm256_sub_pd(x, r);
+		const __m256d min_y = _mm256_sub_pd(y, r);
+		const __m256d min_z = _mm256_sub_pd(z, r);
+		const __m256d max_x = _mm256_add_pd(x, r);
+		const __m256d max_y = _mm256_add_pd(y, r);
+		const __m256d max_z = _mm256_add_pd(z, r);
+
+		__m256d visible = _mm256_setzero_pd();
+		for (size_t b = 0; b < p_boxes_count; b++) {
+			const CullingBox &box = p_boxes[b];
+			__m256d m = _mm256_and_pd(_mm256_cmp_pd(_mm256_set1_pd(box.min_x), max_x, _CMP_LT_OQ), _mm256_cmp_pd(_mm256_set1_pd(box.max_x), min_x, _CMP_GT_OQ));
+			m = _mm256_and_pd(m, _mm256_and_pd(_mm256_cmp_pd(_mm256_set1_pd(box.min_y), max_y, _CMP_LT_OQ), _mm256_cmp_pd(_mm256_set1_pd(box.max_y), min_y, _CMP_GT_OQ)));
+			m = _mm256_and_pd(m, _mm256_and_pd(_mm256_cmp_pd(_mm256_set1_pd(box.min_z), max_z, _CMP_LT_OQ), _mm256_cmp_pd(_mm256_set1_pd(box.max_z), min_z, _CMP_GT_OQ)));
+			visible = _mm256_or_pd(visible, m);
+		}
+
+		if (p_frustums_count && _mm256_movemask_pd(visible)) {
+			__m256d in_frustum = _mm256_setzero_pd();
+			for (size_t f = 0; f < p_frustums_count; f++) {
+				__m256d inside = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+				for (const auto &plane : p_frustums[f]) {
+					__m256d dist = _mm256_sub_pd(
+							_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(plane.normal_x), x), _mm256_mul_pd(_mm256_set1_pd(plane.normal_y), y)), _mm256_mul_pd(_mm256_set1_pd(plane.normal_z), z)),
+							_mm256_set1_pd(plane.d));
+					// !(radius < dist)
+					inside = _mm256_and_pd(inside, _mm256_cmp_pd(r, dist, _CMP_NLT_UQ));
+				}
+				in_frustum = _mm256_or_pd(in_frustum, inside);
+			}
+			visible = _mm256_and_pd(visible, in_frustum);
+		}
+
+		r_mask[i / 64] |= (uint64_t)_mm256_movemask_pd(visible) << (i % 64);
+	}
+
+	for (; i < p_count; i++) {
+		if (CullingKernels::is_sphere_visible(p_spheres[i], p_boxes, p_boxes_count, p_frustums, p_frustums_count)) {
+			r_mask[i / 64] |= 1ull << (i % 64);
+		}
+	}
+}
+#endif
+
+static bool is_avx_supported() {
+#if _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	const bool has_avx = (info[2] & (1 << 28)) != 0;
+	if (!has_osxsave || !has_avx) {
+		return false;
+	}
+	// The OS must save the YMM registers
+	return (_xgetbv(0) & 6) == 6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx");
+#endif
+}
+
+#ifndef REAL_T_IS_DOUBLE
+static bool is_sse_supported() {
+#if defined(__x86_64__) || defined(_M_X64)
+	return true;
+#elif _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 25)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse");
+#endif
+}
+#endif
+#endif
+
+struct CullingKernelsImplementation {
+	CullingKernels::CullSpheresFunc func;
+	const char *name;
+
+	CullingKernelsImplementation() {
+		func = &cull_spheres_scalar;
+		name = "Scalar";
+
+#ifdef CULLING_KERNELS_X86
+		if (is_avx_supported()) {
+			func = &cull_spheres_avx;
+			name = "AVX";
+		}
+#ifndef REAL_T_IS_DOUBLE
+		else if (is_sse_supported()) {
+			func = &cull_spheres_sse;
+			name = "SSE";
+		}
+#endif
+#endif
+		DEV_PRINT_STD("Culling kernels implementation: %s\n", name);
+	}
+};
+
+static const CullingKernelsImplementation &get_implementation() {
+	static CullingKernelsImplementation impl;
+	return impl;
+}
+
+void CullingKernels::cull_spheres(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask) {
+	ZoneScoped;
+	get_implementation().func(p_spheres, p_count, p_boxes, p_boxes_count, p_frustums, p_frustums_count, r_mask);
+}
+
+const char *CullingKernels::get_implementation_name() {
+	return get_implementation().name;
+}
+
+#undef TARGET_SSE
+#undef TARGET_AVX
+#undef CULLING_KERNELS_X86
+
+#endif
@@ -0,0 +1,218 @@
+#pragma once
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "utils/compiler.h"
+#include "utils/math_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/variant/builtin_types.hpp>
+GODOT_WARNING_RESTORE()
+using namespace godot;
+
+#ifdef REAL_T_IS_DOUBLE
+// Floats are not precise enough for the bounds and planes far from the origin of a large world
+typedef double culling_real_t;
+#else
+typedef float culling_real_t;
+#endif
+
+// Compact bounds of an instance. Instances are always bounded by a sphere,
+// so the AABB used for rough culling is derived as `center -/+ radius`.
+struct CullingSphere {
+	culling_real_t x, y, z;
+	culling_real_t radius;
+
+	CullingSphere() :
+			x(0),
+			y(0),
+			z(0),
+			radius(0) {}
+
+	CullingSphere(const SphereBounds &p_bounds) :
+			x((culling_real_t)p_bounds.position.x),
+			y((culling_real_t)p_bounds.position.y),
+			z((culling_real_t)p_bounds.position.z),
+			radius((culling_real_t)p_bounds.radius) {}
+
+	_FORCE_INLINE_ Vector3 get_center() const {
+		return Vector3(x, y, z);
+	}
+};
+// The kernels load the spheres as vectors of 4 elements
+static_assert(sizeof(CullingSphere) == sizeof(culling_real_t) * 4, "CullingSphere must be tightly packed.");
+
+struct CullingBox {
+	culling_real_t min_x, min_y, min_z;
+	culling_real_t max_x, max_y, max_z;
+
+	CullingBox() :
+			min_x(0),
+			min_y(0),
+			min_z(0),
+			max_x(0),
+			max_y(0),
+			max_z(0) {}
+
+	CullingBox(const AABBMinMax &p_box) :
+			min_x((culling_real_t)p_box.min.x),
+			min_y((culling_real_t)p_box.min.y),
+			min_z((culling_real_t)p_box.min.z),
+			max_x((culling_real_t)p_box.max.x),
+			max_y((culling_real_t)p_box.max.y),
+			max_z((culling_real_t)p_box.max.z) {}
+
+	_FORCE_INLINE_ bool intersects(const CullingSphere &p_sphere) const {
+		return min_x < p_sphere.x + p_sphere.radius &&
+				max_x > p_sphere.x - p_sphere.radius &&
+				min_y < p_sphere.y + p_sphere.radius &&
+				max_y > p_sphere.y - p_sphere.radius &&
+				min_z < p_sphere.z + p_sphere.radius &&
+				max_z > p_sphere.z - p_sphere.radius;
+	}
+
+	_FORCE_INLINE_ bool intersects(const CullingBox &p_box) const {
+		return min_x < p_box.max_x &&
+				max_x > p_box.min_x &&
+				min_y < p_box.max_y &&
+				max_y > p_box.min_y &&
+				min_z < p_box.max_z &&
+				max_z > p_box.min_z;
+	}
+
+	_FORCE_INLINE_ bool contains(const CullingBox &p_box) const {
+		return min_x <= p_box.min_x &&
+				max_x >= p_box.max_x &&
+				min_y <= p_box.min_y &&
+				max_y >= p_box.max_y &&
+				min_z <= p_box.min_z &&
+				max_z >= p_box.max_z;
+	}
+
+	_FORCE_INLINE_ bool contains(const CullingSphere &p_sphere) const {
+		return min_x <= p_sphere.x - p_sphere.radius &&
+				max_x >= p_sphere.x + p_sphere.radius &&
+				min_y <= p_sphere.y - p_sphere.radius &&
+				max_y >= p_sphere.y + p_sphere.radius &&
+				min_z <= p_sphere.z - p_sphere.radius &&
+				max_z >= p_sphere.z + p_sphere.radius;
+	}
+
+	_FORCE_INLINE_ void merge_with(const CullingSphere &p_sphere, bool p_is_empty) {
+		if (p_is_empty) {
+			min_x = p_sphere.x - p_sphere.radius;
+			min_y = p_sphere.y - p_sphere.radius;
+			min_z = p_sphere.z - p_sphere.radius;
+			max_x = p_sphere.x + p_sphere.radius;
+			max_y = p_sphere.y + p_sphere.radius;
+			max_z = p_sphere.z + p_sphere.radius;
+		} else {
+			min_x = std::min(min_x, p_sphere.x - p_sphere.radius);
+			min_y = std::min(min_y, p_sphere.y - p_sphere.radius);
+			min_z = std::min(min_z, p_sphere.z - p_sphere.radius);
+			max_x = std::max(max_x, p_sphere.x + p_sphere.radius);
+			max_y = std::max(max_y, p_sphere.y + p_sphere.radius);
+			max_z = std::max(max_z, p_sphere.z + p_sphere.radius);
+		}
+	}
+
+	_FORCE_INLINE_ operator AABB() const {
+		return AABB(Vector3(min_x, min_y, min_z), Vector3(max_x - min_x, max_y - min_y, max_z - min_z));
+	}
+};
+
+struct CullingPlane {
+	culling_real_t normal_x, normal_y, normal_z;
+	culling_real_t d;
+
+	CullingPlane() :
+			normal_x(0),
+			normal_y(0),
+			normal_z(0),
+			d(0) {}
+
+	CullingPlane(const Plane &p_plane) :
+			normal_x((culling_real_t)p_plane.normal.x),
+			normal_y((culling_real_t)p_plane.normal.y),
+			normal_z((culling_real_t)p_plane.normal.z),
+			d((culling_real_t)p_plane.d) {}
+
+	_FORCE_INLINE_ culling_real_t distance_to(const CullingSphere &p_sphere) const {
+		return normal_x * p_sphere.x + normal_y * p_sphere.y + normal_z * p_sphere.z - d;
+	}
+};
+
+typedef std::array<CullingPlane, 6> CullingFrustum;
+
+// Batch culling of sphere bounds against the frustum boxes and frustum planes.
+// The implementation is selected once at runtime depending on the available CPU instructions.
+class CullingKernels {
+public:
+	// Writes one bit per sphere into `r_mask`. `r_mask` must contain at least `get_mask_size(p_count)` elements.
+	// A sphere is visible if it intersects any of `p_boxes` and is inside any of `p_frustums`.
+	// Empty `p_boxes` means that everything is visible, empty `p_frustums` means that the boxes test is enough.
+	typedef void (*CullSpheresFunc)(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask);
+
+	static _FORCE_INLINE_ size_t get_mask_size(size_t p_count) {
+		return (p_count + 63) / 64;
+	}
+
+	static _FORCE_INLINE_ bool is_visible(const uint64_t *p_mask, size_t p_idx) {
+		return (p_mask[p_idx / 64] >> (p_idx % 64)) & 1;
+	}
+
+	static _FORCE_INLINE_ void set_visible(uint64_t *p_mask, size_t p_idx) {
+		p_mask[p_idx / 64] |= 1ull << (p_idx % 64);
+	}
+
+	static _FORCE_INLINE_ void set_invisible(uint64_t *p_mask, size_t p_idx) {
+		p_mask[p_idx / 64] &= ~(1ull << (p_idx % 64));
+	}
+
+	static _FORCE_INLINE_ bool is_sphere_visible(const CullingSphere &p_sphere, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count);
+
+	static void cull_spheres(const CullingSphere *p_spheres, size_t p_count, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count, uint64_t *r_mask);
+	static const char *get_implementation_name();
+};
+
+_FORCE_INLINE_ bool CullingKernels::is_sphere_visible(const CullingSphere &p_sphere, const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count) {
+	if (p_boxes_count == 0) {
+		return true;
+	}
+
+	bool is_in_box = false;
+	for (size_t b = 0; b < p_boxes_count; b++) {
+		if (p_boxes[b].intersects(p_sphere)) {
+			is_in_box = true;
+			break;
+		}
+	}
+
+	if (!is_in_box) {
+		return false;
+	}
+
+	if (p_frustums_count == 0) {
+		return true;
+	}
+
+	for (size_t f = 0; f < p_frustums_count; f++) {
+		bool is_inside = true;
+		for (const auto &plane : p_frustums[f]) {
+			if (p_sphere.radius < plane.distance_to(p_sphere)) {
+				is_inside = false;
+				break;
+			}
+		}
+		if (is_inside) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
@@ -5,9 +5,12 @@
 #include "debug_geometry_container.h"
 #include "gen/shared_resources.gen.h"
 #include "nodes_container.h"
+#include "shared_meshes_cache.h"
 #include "stats_3d.h"
 #include "utils/utils.h"
 
+#include <atomic>
+
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/classes/camera3d.hpp>
 #include <godot_cpp/classes/os.hpp>
@@ -15,6 +18,7 @@ GODOT_WARNING_DISABLE()
 
 #ifndef DISABLE_DEBUG_RENDERING
 #include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
 
 // save meshes
 #if !defined(DISABLE_DEBUG_RENDERING) && defined(DEV_ENABLED)
@@ -109,6 +113,7 @@ void DebugDraw3D::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_sphere), "position", "radius", "color", "duration"), &DebugDraw3D::draw_sphere, 0.5f, Colors::empty_color, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_sphere_xf), "transform", "color", "duration"), &DebugDraw3D::draw_sphere_xf, Colors::empty_color, 0);
+	ClassDB::bind_method(D_METHOD(NAMEOF(draw_spheres), "positions", "radii", "colors", "duration"), &DebugDraw3D::draw_spheres, PackedFloat32Array(), PackedColorArray(), 0);
 
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_cylinder), "transform", "color", "duration"), &DebugDraw3D::draw_cylinder, Colors::empty_color, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_cylinder_ab), "a", "b", "radius", "color", "duration"), &DebugDraw3D::draw_cylinder_ab, 0.5f, Colors::empty_color, 0);
@@ -119,6 +124,7 @@ void DebugDraw3D::_bind_methods() {
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_box), "position", "rotation", "size", "color", "is_box_centered", "duration"), &DebugDraw3D::draw_box, Colors::empty_color, false, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_box_ab), "a", "b", "up", "color", "is_ab_diagonal", "duration"), &DebugDraw3D::draw_box_ab, Vector3(0, 1, 0), Colors::empty_color, true, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_box_xf), "transform", "color", "is_box_centered", "duration"), &DebugDraw3D::draw_box_xf, Colors::empty_color, true, 0);
+	ClassDB::bind_method(D_METHOD(NAMEOF(draw_boxes), "transforms", "colors", "is_box_centered", "duration"), &DebugDraw3D::draw_boxes, PackedColorArray(), true, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_aabb), "aabb", "color", "duration"), &DebugDraw3D::draw_aabb, Colors::empty_color, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_aabb_ab), "a", "b", "color", "duration"), &DebugDraw3D::draw_aabb_ab, Colors::empty_color, 0);
 
@@ -134,6 +140,7 @@ void DebugDraw3D::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_arrow), "a", "b", "color", "arrow_size", "is_absolute_size", "duration"), &DebugDraw3D::draw_arrow, Colors::empty_color, 0.5f, false, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_arrow_ray), "origin", "direction", "length", "color", "arrow_size", "is_absolute_size", "duration"), &DebugDraw3D::draw_arrow_ray, Colors::empty_color, 0.5f, false, 0);
+	ClassDB::bind_method(D_METHOD(NAMEOF(draw_arrows), "lines", "colors", "arrow_size", "is_absolute_size", "duration"), &DebugDraw3D::draw_arrows, PackedColorArray(), 0.5f, false, 0);
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_arrow_path), "path", "color", "arrow_size", "is_absolute_size", "duration"), &DebugDraw3D::draw_arrow_path, Colors::empty_color, 0.75f, true, 0);
 
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_point_path), "path", "type", "size", "points_color", "lines_color", "duration"), &DebugDraw3D::draw_point_path, PointType::POINT_TYPE_SQUARE, 0.25f, Colors::empty_color, Colors::empty_color, 0);
@@ -155,6 +162,14 @@ void DebugDraw3D::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD(NAMEOF(draw_text), "position", "text", "size", "color", "duration"), &DebugDraw3D::draw_text, 32, Colors::empty_color, 0);
 
+	ClassDB::bind_method(D_METHOD(NAMEOF(create_sphere), "position", "radius", "color"), &DebugDraw3D::create_sphere, 0.5f, Colors::empty_color);
+	ClassDB::bind_method(D_METHOD(NAMEOF(create_box), "transform", "color", "is_box_centered"), &DebugDraw3D::create_box, Colors::empty_color, true);
+	ClassDB::bind_method(D_METHOD(NAMEOF(create_line_batch), "lines", "color"), &DebugDraw3D::create_line_batch, Colors::empty_color);
+	ClassDB::bind_method(D_METHOD(NAMEOF(update_transform), "handle", "transform"), &DebugDraw3D::update_transform);
+	ClassDB::bind_method(D_METHOD(NAMEOF(set_color), "handle", "color"), &DebugDraw3D::set_color);
+	ClassDB::bind_method(D_METHOD(NAMEOF(set_visible), "handle", "visible"), &DebugDraw3D::set_visible);
+	ClassDB::bind_method(D_METHOD(NAMEOF(destroy), "handle"), &DebugDraw3D::destroy);
+
 #pragma endregion // Draw Functions
 
 	REG_METHOD(get_render_stats);
@@ -170,6 +185,11 @@ void DebugDraw3D::_bind_methods() {
 
 DebugDraw3D::DebugDraw3D() {
 	ASSIGN_SINGLETON(DebugDraw3D);
+
+#ifndef DISABLE_DEBUG_RENDERING
+	static std::atomic<uint64_t> last_thread_data_owner_id = 0;
+	thread_data_owner_id = ++last_thread_data_owner_id;
+#endif
 }
 
 void DebugDraw3D::init(DebugDrawManager *p_root) {
@@ -202,12 +222,31 @@ void DebugDraw3D::init(DebugDrawManager *p_root) {
 	default_scoped_config->set_plane_size(def_plane_size == 0 ? INFINITY : def_plane_size);
 
 	_load_materials();
+
+#ifndef DISABLE_DEBUG_RENDERING
+	PS()->connect("settings_changed", callable_mp(this, &DebugDraw3D::_on_project_settings_changed));
+#endif
 }
 
 DebugDraw3D::~DebugDraw3D() {
 	ZoneScoped;
 	UNASSIGN_SINGLETON(DebugDraw3D);
 
+#ifndef DISABLE_DEBUG_RENDERING
+	if (PS()->is_connected("settings_changed", callable_mp(this, &DebugDraw3D::_on_project_settings_changed))) {
+		PS()->disconnect("settings_changed", callable_mp(this, &DebugDraw3D::_on_project_settings_changed));
+	}
+
+	// The threads keep their buffers after this, so the copies of the configs and their fonts are released here
+	{
+		std::lock_guard<std::mutex> lock(command_buffers_lock);
+		for (const auto &buffer : command_buffers) {
+			buffer->close();
+		}
+		command_buffers.clear();
+	}
+#endif
+
 	root_node = nullptr;
 }
 
@@ -216,6 +255,11 @@ void DebugDraw3D::process_start(double delta) {
 #ifndef DISABLE_DEBUG_RENDERING
 	LOCK_GUARD(datalock);
 
+	// The default viewport can be changed at any time and is used by all threads
+	const auto &dcd = default_scoped_config->data->dcd;
+	if (dcd.viewport && !world3ds_found_for_threads_cache.count(dcd.viewport_id) && ObjectDB::get_instance(dcd.viewport_id)) {
+		_cache_world_for_threads(dcd.viewport);
+	}
 #endif
 }
 
@@ -224,6 +268,7 @@ void DebugDraw3D::process_end(double p_delta) {
 #ifndef DISABLE_DEBUG_RENDERING
 	FrameMarkStart("3D Update");
 	LOCK_GUARD(datalock);
+	_merge_command_buffers();
 
 	// Update 3D debug
 	for (const auto &p : debug_containers) {
@@ -232,8 +277,16 @@ void DebugDraw3D::process_end(double p_delta) {
 				dgc->update_geometry(p_delta);
 			}
 		}
-		for (const auto &nc : p.second.ncs) {
+		for (int i = 0; i < (int)MeshMaterialVariant::MAX; i++) {
+			const auto &nc = p.second.ncs[i];
 			if (nc) {
+				// The text uses the view found by the geometry container of the same World3D
+				if (const auto &dgc = p.second.dgcs[i]) {
+					nc->set_cameras(dgc->get_world_cameras());
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+					nc->set_center_position(dgc->get_center_position());
+#endif
+				}
 				nc->update_geometry(p_delta);
 			}
 		}
@@ -271,6 +324,7 @@ void DebugDraw3D::physics_process_end(double p_delta) {
 	ZoneScoped;
 #ifndef DISABLE_DEBUG_RENDERING
 	LOCK_GUARD(datalock);
+	_merge_command_buffers();
 
 	for (const auto &p : debug_containers) {
 		for (const auto &dgc : p.second.dgcs) {
@@ -290,74 +344,189 @@ void DebugDraw3D::physics_process_end(double p_delta) {
 }
 
 #ifndef DISABLE_DEBUG_RENDERING
-const DebugDraw3DScopeConfig::Data *DebugDraw3D::scoped_config_for_current_thread() {
+DrawCommandBuffer *DebugDraw3D::_get_command_buffer() {
+	thread_local std::shared_ptr<DrawCommandBuffer> buffer;
+	thread_local uint64_t buffer_owner_id = 0;
+
+	if (buffer_owner_id != thread_data_owner_id) {
+		buffer = std::make_shared<DrawCommandBuffer>();
+		buffer_owner_id = thread_data_owner_id;
+
+		std::lock_guard<std::mutex> lock(command_buffers_lock);
+		command_buffers.push_back(buffer);
+	}
+	return buffer.get();
+}
+
+void DebugDraw3D::_merge_command_buffers() {
 	ZoneScoped;
 	LOCK_GUARD(datalock);
-	uint64_t thread = OS::get_singleton()->get_thread_caller_id();
+	std::lock_guard<std::mutex> lock(command_buffers_lock);
+
+	for (size_t b = 0; b < command_buffers.size();) {
+		const auto &buffer = command_buffers[b];
+		buffer->take_commands(merging_commands);
+
+		if (!merging_commands.is_empty()) {
+			ZoneScopedN("Merge commands");
+			const auto &cmds = merging_commands;
+
+			// Containers are found once for each copy of the configs
+			merging_containers.resize(cmds.configs.size());
+			for (size_t i = 0; i < cmds.configs.size(); i++) {
+				const DebugDraw3DScopeConfig::Data *cfg = cmds.configs[i].get();
+				DebugGeometryContainer *dgc = nullptr;
+				// The viewport can be freed after the draw call
+				if (cfg->dcd.viewport && ObjectDB::get_instance(cfg->dcd.viewport_id)) {
+					if (auto *vdc = get_debug_container(cfg->dcd, true); vdc) {
+						dgc = vdc->dgcs[!!cfg->dcd.no_depth_test].get();
+					}
+				}
+				merging_containers[i] = dgc;
+			}
 
-	if (const auto &it = cached_scoped_configs.find(thread); it != cached_scoped_configs.cend()) {
-		return it->second.get();
+			for (const auto &cmd : cmds.commands) {
+				DebugGeometryContainer *dgc = merging_containers[cmd.config];
+				if (!dgc)
+					continue;
+
+				const DebugDraw3DScopeConfig::Data *cfg = cmds.configs[cmd.config].get();
+				const Color *custom_col = cmd.has_custom_col ? &cmd.custom_col : nullptr;
+				switch (cmd.type) {
+					case DrawCommandBuffer::CommandType::INSTANCES:
+						dgc->geometry_pool.add_or_update_instances(cfg, (InstanceType)cmd.instance_type, cmd.exp_time, cmd.count, cmds.transforms.data() + cmd.first, cmds.bounds.data() + cmd.first, cmds.colors.data() + cmd.first_color, cmd.colors_count, custom_col, cmd.proc);
+						break;
+					case DrawCommandBuffer::CommandType::CONVERTABLE_INSTANCES:
+						dgc->geometry_pool.add_or_update_instances(cfg, (ConvertableInstanceType)cmd.instance_type, cmd.exp_time, cmd.count, cmds.transforms.data() + cmd.first, cmds.bounds.data() + cmd.first, cmds.colors.data() + cmd.first_color, cmd.colors_count, custom_col, cmd.proc);
+						break;
+					case DrawCommandBuffer::CommandType::LINES:
+						dgc->geometry_pool.add_or_update_line(cfg, cmd.exp_time, cmds.vertices.data() + cmd.first, cmd.count, cmds.colors[cmd.first_color], cmd.aabb, cmd.proc);
+						break;
+				}
+			}
+
+			merging_commands.clear();
+		}
+
+		// Only this list owns the buffer when its thread has finished
+		if (buffer.use_count() == 1 && buffer->is_empty()) {
+			command_buffers[b] = command_buffers.back();
+			command_buffers.pop_back();
+		} else {
+			b++;
+		}
 	}
+}
 
-	if (const auto &it = scoped_configs.find(thread); it != scoped_configs.cend()) {
-		const auto &cfgs = it->second;
-		if (!cfgs.empty()) {
-			DebugDraw3DScopeConfig *tmp = cfgs.back().scfg;
-			cached_scoped_configs[thread] = tmp->data;
-			return tmp->data.get();
+DebugDraw3D::ScopedConfigsStack &DebugDraw3D::_get_scoped_configs_stack() {
+	thread_local ScopedConfigsStack stack;
+
+	const uint64_t generation = scoped_configs_generation.load(std::memory_order_acquire);
+	if (stack.generation != generation || stack.owner_id != thread_data_owner_id) {
+		if (stack.owner_id != thread_data_owner_id) {
+			stack.thread_id = OS::get_singleton()->get_thread_caller_id();
+			stack.owner_id = thread_data_owner_id;
+			stack.removals = std::make_shared<ScopedConfigsRemovals>();
+
+			std::lock_guard<std::mutex> lock(scoped_configs_removals_lock);
+			scoped_configs_removals[stack.thread_id] = stack.removals;
+		} else if (stack.removals->count.load(std::memory_order_acquire)) {
+			// the removed configs were in the cleared stack
+			std::lock_guard<std::mutex> lock(stack.removals->lock);
+			stack.removals->guard_ids.clear();
+			stack.removals->count.store(0, std::memory_order_relaxed);
+		}
+
+		stack.items.clear();
+		stack.current = default_scoped_config.ptr()->data.get();
+		stack.generation = generation;
+	} else if (stack.removals->count.load(std::memory_order_acquire)) {
+		ZoneScopedN("Remove configs of other threads");
+		std::lock_guard<std::mutex> lock(stack.removals->lock);
+		for (const uint64_t &guard_id : stack.removals->guard_ids) {
+			_remove_scoped_config(stack, guard_id);
 		}
+		stack.removals->guard_ids.clear();
+		stack.removals->count.store(0, std::memory_order_relaxed);
+	}
+	return stack;
+}
+
+void DebugDraw3D::_remove_scoped_config(ScopedConfigsStack &r_stack, const uint64_t &p_guard_id) {
+	auto &cfgs = r_stack.items;
+	auto res = std::find_if(cfgs.rbegin(), cfgs.rend(), [&p_guard_id](const ScopedConfigsStack::Item &i) { return i.guard_id == p_guard_id; });
+
+	if (res != cfgs.rend()) {
+		cfgs.erase(--res.base());
+		registered_scoped_configs--;
+
+		r_stack.current = cfgs.empty() ? default_scoped_config.ptr()->data.get() : cfgs.back().data;
 	}
+}
 
-	cached_scoped_configs[thread] = default_scoped_config.ptr()->data;
-	return default_scoped_config.ptr()->data.get();
+const DebugDraw3DScopeConfig::Data *DebugDraw3D::scoped_config_for_current_thread() {
+	ZoneScoped;
+	return _get_scoped_configs_stack().current;
 }
 
 void DebugDraw3D::_register_scoped_config(uint64_t p_thread_id, uint64_t p_guard_id, DebugDraw3DScopeConfig *p_cfg) {
 	ZoneScoped;
-	LOCK_GUARD(datalock);
-
-	scoped_configs[p_thread_id].push_back(ScopedPairIdConfig(p_guard_id, p_cfg));
+	auto &stack = _get_scoped_configs_stack();
 
-	// Update cached value
-	cached_scoped_configs[p_thread_id] = p_cfg->data;
+	stack.items.push_back({ p_guard_id, p_cfg->data.get() });
+	stack.current = p_cfg->data.get();
+	registered_scoped_configs++;
 }
 
 void DebugDraw3D::_unregister_scoped_config(uint64_t thread_id, uint64_t guard_id) {
 	ZoneScoped;
-	LOCK_GUARD(datalock);
-
-	auto &cfgs = scoped_configs[thread_id];
-	auto res = std::find_if(cfgs.rbegin(), cfgs.rend(), [&guard_id](const ScopedPairIdConfig &i) { return i.id == guard_id; });
-
-	if (res != cfgs.rend()) {
-		cfgs.erase(--res.base());
+	auto &stack = _get_scoped_configs_stack();
+
+	// The stack of another thread cannot be changed here, so the config is removed by that thread on its next access
+	if (stack.thread_id != thread_id) {
+		std::shared_ptr<ScopedConfigsRemovals> removals;
+		{
+			std::lock_guard<std::mutex> lock(scoped_configs_removals_lock);
+			if (auto it = scoped_configs_removals.find(thread_id); it != scoped_configs_removals.end()) {
+				removals = it->second.lock();
+			}
+		}
 
-		// Update cached value
-		if (!cfgs.empty()) {
-			cached_scoped_configs[thread_id] = cfgs.back().scfg->data;
-		} else {
-			cached_scoped_configs[thread_id] = default_scoped_config.ptr()->data;
+		if (removals) {
+			std::lock_guard<std::mutex> lock(removals->lock);
+			removals->guard_ids.push_back(guard_id);
+			removals->count.fetch_add(1, std::memory_order_release);
 		}
+		return;
 	}
+
+	_remove_scoped_config(stack, guard_id);
 }
 
 void DebugDraw3D::_clear_scoped_configs() {
 	ZoneScoped;
-	LOCK_GUARD(datalock);
 
-	uint64_t orphans = 0;
-	for (auto &p : scoped_configs) {
-		orphans += p.second.size();
+	// The stacks of all threads will be cleared on their next access
+	scoped_configs_generation++;
+
+	{
+		// the stacks of the finished threads are deleted
+		std::lock_guard<std::mutex> lock(scoped_configs_removals_lock);
+		for (auto it = scoped_configs_removals.begin(); it != scoped_configs_removals.end();) {
+			if (it->second.expired()) {
+				it = scoped_configs_removals.erase(it);
+			} else {
+				++it;
+			}
+		}
 	}
+	int64_t orphans = registered_scoped_configs.exchange(0);
+	if (orphans < 0)
+		orphans = 0;
 
-	scoped_stats_3d.created = created_scoped_configs;
+	scoped_stats_3d.created = created_scoped_configs.exchange(0);
 	scoped_stats_3d.orphans = orphans;
 
-	created_scoped_configs = 0;
-
-	cached_scoped_configs.clear();
-	scoped_configs.clear();
-
 	if (orphans)
 		PRINT_ERROR("{0} scoped configs weren't freed. Do not save scoped configurations anywhere other than function bodies.", orphans);
 }
@@ -379,63 +548,227 @@ Node *DebugDraw3D::get_root_node() {
 	return root_node;
 }
 
-std::array<GeometryGenerator::GeneratedMeshData, 2> *DebugDraw3D::get_shared_meshes() {
+static MeshMaterialType get_shared_mesh_material_type(InstanceType p_type) {
+	switch (p_type) {
+		case InstanceType::LINE_VOLUMETRIC:
+			return MeshMaterialType::ExtendableLine;
+		case InstanceType::BILLBOARD_SQUARE:
+			return MeshMaterialType::Billboard;
+		case InstanceType::PLANE:
+			return MeshMaterialType::Plane;
+		default:
+			return is_instance_custom_data_used(p_type) ? MeshMaterialType::Extendable : MeshMaterialType::Wireframe;
+	}
+}
+
+DebugDraw3D::SharedMeshesSettings DebugDraw3D::_get_shared_meshes_settings() {
+	SharedMeshesSettings settings;
+	settings.add_bevel = PS()->get_setting(root_settings_section + s_add_bevel_to_volumetric);
+	settings.use_icosphere = PS()->get_setting(root_settings_section + s_use_icosphere);
+	settings.use_icosphere_hd = PS()->get_setting(root_settings_section + s_use_icosphere_hd);
+	return settings;
+}
+
+// Only reads `shared_meshes_settings`, so it can be called from the worker threads
+GeometryGenerator::GeneratedMeshData DebugDraw3D::_generate_shared_mesh(InstanceType p_type) const {
+	ZoneScoped;
+	ZoneValue((int)p_type);
+	const SharedMeshesSettings &s = shared_meshes_settings;
+
+	switch (p_type) {
+		// WIREFRAME
+
+		case InstanceType::CUBE:
+			return GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::CubeVertexes, GeometryGenerator::CubeIndexes);
+		case InstanceType::CUBE_CENTERED:
+			return GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::CenteredCubeVertexes, GeometryGenerator::CubeIndexes);
+		case InstanceType::ARROWHEAD:
+			return GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::ArrowheadVertexes, GeometryGenerator::ArrowheadIndexes);
+		case InstanceType::POSITION:
+			return GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::PositionVertexes, GeometryGenerator::PositionIndexes);
+		case InstanceType::SPHERE:
+			return s.use_icosphere ? GeometryGenerator::CreateIcosphereLines(0.5f, 1) : GeometryGenerator::CreateSphereLines(8, 8, 0.5f, 4);
+		case InstanceType::SPHERE_HD:
+			return s.use_icosphere_hd ? GeometryGenerator::CreateIcosphereLines(0.5f, 2) : GeometryGenerator::CreateSphereLines(16, 16, 0.5f, 2);
+		case InstanceType::CYLINDER:
+			return GeometryGenerator::CreateCylinderLines(32, 1, 1, 4);
+		case InstanceType::CAPSULE_CAP:
+			return GeometryGenerator::CreateCapsuleCapLines(32, 1);
+		case InstanceType::CAPSULE_EDGES:
+			return GeometryGenerator::CreateCapsuleEdgeLines(1, 1);
+
+		// VOLUMETRIC
+		// The wireframes are generated again instead of being taken from the cache, because the conversion needs their lines planes and bevels
+
+		case InstanceType::LINE_VOLUMETRIC:
+			return GeometryGenerator::ConvertWireframeToVolumetric(GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::LineVertexes), s.add_bevel, false, false);
+		case InstanceType::ARROWHEAD_VOLUMETRIC:
+			return GeometryGenerator::CreateVolumetricArrowHead(.25f, 1.f, 1.f, s.add_bevel);
+		case InstanceType::CUBE_VOLUMETRIC:
+		case InstanceType::CUBE_CENTERED_VOLUMETRIC:
+		case InstanceType::POSITION_VOLUMETRIC:
+			return GeometryGenerator::ConvertWireframeToVolumetric(_generate_shared_mesh(get_instance_wireframe_type(p_type)), s.add_bevel, false, false);
+		case InstanceType::SPHERE_VOLUMETRIC:
+		case InstanceType::SPHERE_HD_VOLUMETRIC:
+		case InstanceType::CYLINDER_VOLUMETRIC:
+		case InstanceType::CAPSULE_CAP_VOLUMETRIC:
+		case InstanceType::CAPSULE_EDGES_VOLUMETRIC:
+			return GeometryGenerator::ConvertWireframeToVolumetric(_generate_shared_mesh(get_instance_wireframe_type(p_type)), false, false, true);
+
+		// SOLID
+
+		case InstanceType::BILLBOARD_SQUARE:
+			return GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_TRIANGLES, GeometryGenerator::CenteredSquareVertexes, GeometryGenerator::SquareBackwardsIndexes);
+		case InstanceType::PLANE:
+			return GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_TRIANGLES, GeometryGenerator::CenteredSquareVertexes, GeometryGenerator::SquareIndexes);
+
+		case InstanceType::MAX:
+			break;
+	}
+	return GeometryGenerator::GeneratedMeshData();
+}
+
+void DebugDraw3D::_generate_shared_mesh_task(void *p_userdata, uint32_t p_idx) {
+	DebugDraw3D *dd = static_cast<DebugDraw3D *>(p_userdata);
+	const InstanceType type = dd->shared_meshes_generating_types[p_idx];
+	dd->shared_generated_meshes[(int)type][0] = dd->_generate_shared_mesh(type);
+}
+
+void DebugDraw3D::_generate_shared_meshes(const std::vector<InstanceType> &p_types, bool p_ignore_cache) {
+	ZoneScoped;
 	LOCK_GUARD(datalock);
-	if (!shared_generated_meshes.size()) {
-		bool p_add_bevel = PS()->get_setting(root_settings_section + s_add_bevel_to_volumetric);
-		bool p_use_icosphere = PS()->get_setting(root_settings_section + s_use_icosphere);
-		bool p_use_icosphere_hd = PS()->get_setting(root_settings_section + s_use_icosphere_hd);
 
+	if (!shared_generated_meshes.size()) {
+		shared_meshes_settings = _get_shared_meshes_settings();
+		shared_meshes_cache_key = SharedMeshesCache::get_key(shared_meshes_settings.get_flags());
+		if (p_ignore_cache) {
+			// all the cached types are dropped, the generated ones are saved below
+			shared_meshes_cache.clear();
+			shared_meshes_cache.resize((int)InstanceType::MAX);
+		} else {
+			shared_meshes_cache = SharedMeshesCache::load(shared_meshes_cache_key);
+		}
 		shared_generated_meshes.resize((int)InstanceType::MAX);
+	}
+
+	std::vector<InstanceType> new_types;
+	bool is_cache_changed = false;
+	shared_meshes_generating_types.clear();
+	for (const InstanceType &type : p_types) {
+		auto &meshes = shared_generated_meshes[(int)type];
+		if (meshes[0].mesh.is_valid() || std::find(new_types.begin(), new_types.end(), type) != new_types.end()) {
+			continue;
+		}
+
+		new_types.push_back(type);
+		if (shared_meshes_cache[(int)type].get_type() == Variant::ARRAY) {
+			meshes[0].mesh = SharedMeshesCache::create_mesh(shared_meshes_cache[(int)type]);
+			if (meshes[0].mesh->get_surface_count()) {
+				continue;
+			}
+
+			// A cached surface that Godot refused to load is dropped, so the mesh is generated and cached again
+			DEV_PRINT_STD("Failed to create the mesh of the instance type %d from the cache\n", (int)type);
+			shared_meshes_cache[(int)type] = Variant();
+			meshes[0] = GeometryGenerator::GeneratedMeshData();
+			is_cache_changed = true;
+		}
+		shared_meshes_generating_types.push_back(type);
+	}
+
+	// The meshes are generated only for the first variant, the other variants differ only in the materials.
+	// Different types do not depend on each other, so the volumetric conversions can be made in parallel.
+	if (shared_meshes_generating_types.size() > 1) {
+		ZoneScopedN("Parallel generation");
+		WorkerThreadPool *wtp = WorkerThreadPool::get_singleton();
+		int64_t group_id = wtp->add_native_group_task(&DebugDraw3D::_generate_shared_mesh_task, this, (int)shared_meshes_generating_types.size(), -1, true, "DD3D: Generation of meshes");
+		wtp->wait_for_group_task_completion(group_id);
+	} else {
+		for (const InstanceType &type : shared_meshes_generating_types) {
+			shared_generated_meshes[(int)type][0] = _generate_shared_mesh(type);
+		}
+	}
+
+	for (const InstanceType &type : shared_meshes_generating_types) {
+		const Ref<ArrayMesh> &mesh = shared_generated_meshes[(int)type][0].mesh;
+		if (mesh.is_valid() && mesh->get_surface_count()) {
+			shared_meshes_cache[(int)type] = SharedMeshesCache::get_surface(mesh);
+			is_cache_changed = true;
+		}
+	}
+	shared_meshes_generating_types.clear();
+
+	if (is_cache_changed) {
+		SharedMeshesCache::save(shared_meshes_cache_key, shared_meshes_cache);
+	}
+
+	for (const InstanceType &type : new_types) {
+		auto &meshes = shared_generated_meshes[(int)type];
+		if (meshes[0].mesh.is_null() || !meshes[0].mesh->get_surface_count()) {
+			PRINT_ERROR("Failed to generate the mesh of the instance type: {0}", (int)type);
+			meshes[0] = GeometryGenerator::GeneratedMeshData();
+			continue;
+		}
+
+		const MeshMaterialType mat_type = get_shared_mesh_material_type(type);
 		for (int i = 0; i < (int)MeshMaterialVariant::MAX; i++) {
-			MeshMaterialType mat_type = MeshMaterialType::Wireframe;
-
-#define GEN_MESH(_type, _gen)                      \
-	shared_generated_meshes[(int)_type][i] = _gen; \
-	shared_generated_meshes[(int)_type][i].mesh->surface_set_material(0, get_material_variant(mat_type, (MeshMaterialVariant)i));
-
-			// WIREFRAME
-
-			mat_type = MeshMaterialType::Wireframe;
-			GEN_MESH(InstanceType::CUBE, GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::CubeVertexes, GeometryGenerator::CubeIndexes));
-			GEN_MESH(InstanceType::CUBE_CENTERED, GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::CenteredCubeVertexes, GeometryGenerator::CubeIndexes));
-			GEN_MESH(InstanceType::ARROWHEAD, GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::ArrowheadVertexes, GeometryGenerator::ArrowheadIndexes));
-			GEN_MESH(InstanceType::POSITION, GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::PositionVertexes, GeometryGenerator::PositionIndexes));
-			GEN_MESH(InstanceType::SPHERE, p_use_icosphere ? GeometryGenerator::CreateIcosphereLines(0.5f, 1) : GeometryGenerator::CreateSphereLines(8, 8, 0.5f, 4));
-			GEN_MESH(InstanceType::SPHERE_HD, p_use_icosphere_hd ? GeometryGenerator::CreateIcosphereLines(0.5f, 2) : GeometryGenerator::CreateSphereLines(16, 16, 0.5f, 2));
-			GEN_MESH(InstanceType::CYLINDER, GeometryGenerator::CreateCylinderLines(32, 1, 1, 4));
-			GEN_MESH(InstanceType::CAPSULE_CAP, GeometryGenerator::CreateCapsuleCapLines(32, 1));
-			GEN_MESH(InstanceType::CAPSULE_EDGES, GeometryGenerator::CreateCapsuleEdgeLines(1, 1));
-
-			// VOLUMETRIC
-
-			mat_type = MeshMaterialType::Extendable;
-			GEN_MESH(InstanceType::LINE_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_LINES, GeometryGenerator::LineVertexes), p_add_bevel, false, false));
-			GEN_MESH(InstanceType::CUBE_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::CUBE][i], p_add_bevel, false, false));
-			GEN_MESH(InstanceType::CUBE_CENTERED_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::CUBE_CENTERED][i], p_add_bevel, false, false));
-			GEN_MESH(InstanceType::ARROWHEAD_VOLUMETRIC, GeometryGenerator::CreateVolumetricArrowHead(.25f, 1.f, 1.f, p_add_bevel));
-			GEN_MESH(InstanceType::POSITION_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::POSITION][i], p_add_bevel, false, false));
-			GEN_MESH(InstanceType::SPHERE_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::SPHERE][i], false, false, true));
-			GEN_MESH(InstanceType::SPHERE_HD_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::SPHERE_HD][i], false, false, true));
-			GEN_MESH(InstanceType::CYLINDER_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::CYLINDER][i], false, false, true));
-			GEN_MESH(InstanceType::CAPSULE_CAP_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::CAPSULE_CAP][i], false, false, true));
-			GEN_MESH(InstanceType::CAPSULE_EDGES_VOLUMETRIC, GeometryGenerator::ConvertWireframeToVolumetric(shared_generated_meshes[(int)InstanceType::CAPSULE_EDGES][i], false, false, true));
-
-			// SOLID
-
-			mat_type = MeshMaterialType::Billboard;
-			GEN_MESH(InstanceType::BILLBOARD_SQUARE, GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_TRIANGLES, GeometryGenerator::CenteredSquareVertexes, GeometryGenerator::SquareBackwardsIndexes));
-
-			mat_type = MeshMaterialType::Plane;
-			GEN_MESH(InstanceType::PLANE, GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_TRIANGLES, GeometryGenerator::CenteredSquareVertexes, GeometryGenerator::SquareIndexes));
-#undef GEN_MESH
+			if (i) {
+				meshes[i].mesh = SharedMeshesCache::create_mesh(shared_meshes_cache[(int)type]);
+			}
+			meshes[i].mesh->surface_set_material(0, get_material_variant(mat_type, (MeshMaterialVariant)i));
+		}
+	}
+}
+
+void DebugDraw3D::_regenerate_shared_meshes(bool p_ignore_cache) {
+	ZoneScoped;
+	LOCK_GUARD(datalock);
+
+	// Only the types that were in use are generated again
+	std::vector<InstanceType> used_types;
+	for (int type = 0; type < (int)shared_generated_meshes.size(); type++) {
+		if (shared_generated_meshes[type][0].mesh.is_valid()) {
+			used_types.push_back((InstanceType)type);
+		}
+	}
+
+	shared_generated_meshes.clear();
+	shared_meshes_cache.clear();
+
+	// Without the used types, the dropped cache must still not be loaded by the next generation
+	if (used_types.size() || p_ignore_cache) {
+		_generate_shared_meshes(used_types, p_ignore_cache);
+	}
+}
+
+void DebugDraw3D::_on_project_settings_changed() {
+	ZoneScoped;
+	LOCK_GUARD(datalock);
+	if (!shared_generated_meshes.size() || _get_shared_meshes_settings().get_flags() == shared_meshes_settings.get_flags()) {
+		return;
+	}
+
+	// The new settings have their own cache key, so the cached meshes are still valid
+	_regenerate_shared_meshes(false);
+
+	for (auto &p : debug_containers) {
+		for (auto &dgc : p.second.dgcs) {
+			if (dgc) {
+				dgc->reset_meshes();
+			}
 		}
 	}
+}
 
-	return shared_generated_meshes.data();
+Ref<ArrayMesh> DebugDraw3D::get_shared_mesh(InstanceType p_type, MeshMaterialVariant p_variant) {
+	LOCK_GUARD(datalock);
+	if (!shared_generated_meshes.size() || shared_generated_meshes[(int)p_type][0].mesh.is_null()) {
+		_generate_shared_meshes({ p_type });
+	}
+	return shared_generated_meshes[(int)p_type][(int)p_variant].mesh;
 }
 
-DebugDraw3D::ViewportToDebugContainerItem *DebugDraw3D::get_debug_container(const DebugDraw3DScopeConfig::DebugContainerDependent &p_dgcd, const bool p_generate_new_container) {
+DebugDraw3D::ViewportToDebugContainerItem *DebugDraw3D::get_debug_container(const DebugDraw3DScopeConfig::DebugContainerDependent &p_dgcd, const bool p_generate_new_container, bool *r_is_world_pending) {
 	ZoneScoped;
 	LOCK_GUARD(datalock);
 
@@ -459,9 +792,17 @@ DebugDraw3D::ViewportToDebugContainerItem *DebugDraw3D::get_debug_container(cons
 			// PRINT_WARNING("DebugDraw3D cannot search for World3D outside of the main thread.\nAn attempt will be made to search for World3D using deferred call.");
 			world3ds_found_for_threads_cache[p_dgcd.viewport_id] = Ref<World3D>();
 			callable_mp(this, &DebugDraw3D::_deferred_find_world_in_viewport).call_deferred(p_dgcd.viewport->get_instance_id());
+			// The list of pending texts also marks the viewports whose World3D is being searched
+			pending_texts[p_dgcd.viewport_id];
+			if (r_is_world_pending) {
+				*r_is_world_pending = true;
+			}
 			return nullptr;
 		} else {
 			if (p->second.is_null()) {
+				if (r_is_world_pending) {
+					*r_is_world_pending = pending_texts.count(p_dgcd.viewport_id);
+				}
 				return nullptr;
 			} else {
 				vp_world = p->second;
@@ -469,6 +810,8 @@ DebugDraw3D::ViewportToDebugContainerItem *DebugDraw3D::get_debug_container(cons
 		}
 	} else {
 		vp_world = p_dgcd.viewport->find_world_3d();
+		// Other threads will use this world without the deferred search
+		world3ds_found_for_threads_cache[p_dgcd.viewport_id] = vp_world;
 	}
 
 	if (vp_world.is_null()) {
@@ -507,7 +850,7 @@ DebugDraw3D::ViewportToDebugContainerItem *DebugDraw3D::get_debug_container(cons
 	c.dgcs[dgc_depth] = std::make_unique<DebugGeometryContainer>(this, p_dgcd.no_depth_test);
 	c.dgcs[dgc_depth]->set_world(vp_world);
 
-	c.ncs[dgc_depth] = std::make_unique<NodesContainer>(this, c.world_watcher->get_nodes_root(), p_dgcd.no_depth_test);
+	c.ncs[dgc_depth] = std::make_unique<NodesContainer>(this, vp_world, p_dgcd.no_depth_test);
 
 	viewport_to_world_cache[p_dgcd.viewport] = &c;
 
@@ -515,10 +858,53 @@ DebugDraw3D::ViewportToDebugContainerItem *DebugDraw3D::get_debug_container(cons
 }
 
 void DebugDraw3D::_deferred_find_world_in_viewport(uint64_t p_viewport_id) {
+	ZoneScoped;
+	LOCK_GUARD(datalock);
+
 	const Viewport *vp = Object::cast_to<Viewport>(ObjectDB::get_instance(p_viewport_id));
 	if (vp) {
 		world3ds_found_for_threads_cache[p_viewport_id] = vp->find_world_3d();
 	}
+
+	const auto &it = pending_texts.find(p_viewport_id);
+	if (it == pending_texts.end()) {
+		return;
+	}
+
+	std::vector<PendingText> texts = std::move(it->second);
+	pending_texts.erase(it);
+
+	if (!vp) {
+		return;
+	}
+
+	for (const auto &t : texts) {
+		auto vdc = get_debug_container(t.cfg->dcd, true);
+		if (!vdc)
+			continue;
+
+		auto nc = vdc->ncs[!!t.cfg->dcd.no_depth_test].get();
+		if (nc) {
+			nc->add_or_update_text(t.cfg.get(), t.position, t.text, t.size, t.color, t.duration);
+		}
+	}
+}
+
+void DebugDraw3D::_add_pending_text(const DebugDraw3DScopeConfig::Data *p_cfg, const Vector3 &p_position, const String &p_text, const int &p_size, const Color &p_color, const real_t &p_duration) {
+	auto &texts = pending_texts[p_cfg->dcd.viewport_id];
+	if (texts.size() >= MAX_PENDING_TEXTS_PER_VIEWPORT) {
+		return;
+	}
+
+	texts.push_back({ std::make_shared<DebugDraw3DScopeConfig::Data>(p_cfg), p_position, p_text, p_size, p_color, p_duration });
+}
+
+void DebugDraw3D::_cache_world_for_threads(Viewport *p_viewport) {
+	LOCK_GUARD(datalock);
+	Ref<World3D> world = p_viewport->find_world_3d();
+	if (world.is_valid()) {
+		world3ds_found_for_threads_cache[p_viewport->get_instance_id()] = world;
+	}
 }
 
 void DebugDraw3D::_register_viewport_world_deferred(uint64_t /*Viewport * */ p_viewport_id, const uint64_t p_world_id, _DD3D_WorldWatcher *watcher) {
@@ -541,6 +927,8 @@ void DebugDraw3D::_register_viewport_world_deferred(uint64_t /*Viewport * */ p_v
 	DEV_PRINT_STD_F(NAMEOF(_DD3D_WorldWatcher) " (register): Registered WorldWatcher for World3D (%" PRIu64 ").\n", p_world_id);
 	parent_node->add_child(watcher);
 	parent_node->move_child(watcher, 0);
+
+	_cache_world_for_threads(viewport);
 }
 
 Node *DebugDraw3D::_get_root_world_node(Node *p_scene_root, Viewport *p_vp) {
@@ -602,8 +990,14 @@ void DebugDraw3D::_remove_debug_container(const uint64_t &p_world_id) {
 
 		// remove cached references to avoid crashes in case of invalidation of `debug_containers`
 		viewport_to_world_cache.clear();
-		// also clear the world3d cache for threads
-		world3ds_found_for_threads_cache.clear();
+		// the other viewports keep their worlds found for threads
+		for (auto it = world3ds_found_for_threads_cache.begin(); it != world3ds_found_for_threads_cache.end();) {
+			if (it->second.is_valid() && it->second->get_instance_id() == p_world_id) {
+				it = world3ds_found_for_threads_cache.erase(it);
+			} else {
+				++it;
+			}
+		}
 	}
 }
 
@@ -612,22 +1006,21 @@ void DebugDraw3D::_remove_debug_container(const uint64_t &p_world_id) {
 Ref<DebugDraw3DScopeConfig> DebugDraw3D::new_scoped_config() {
 	ZoneScoped;
 #ifndef DISABLE_DEBUG_RENDERING
-	LOCK_GUARD(datalock);
-	static uint64_t create_counter = 0;
-	create_counter++;
+	static std::atomic<uint64_t> create_counter = 0;
+	const uint64_t guard_id = ++create_counter;
 
-	uint64_t thread = OS::get_singleton()->get_thread_caller_id();
+	const auto &stack = _get_scoped_configs_stack();
 	auto unreg_func = [this](const uint64_t &p_thread_id, const uint64_t &p_guard_id) {
 		_unregister_scoped_config(p_thread_id, p_guard_id);
 	};
 	Ref<DebugDraw3DScopeConfig> res(memnew(
 			DebugDraw3DScopeConfig(
-					thread,
-					create_counter,
-					scoped_config_for_current_thread(),
+					stack.thread_id,
+					guard_id,
+					stack.current,
 					unreg_func)));
 
-	_register_scoped_config(thread, create_counter, res.ptr());
+	_register_scoped_config(stack.thread_id, guard_id, res.ptr());
 	created_scoped_configs++;
 	return res;
 #else
@@ -685,6 +1078,8 @@ void DebugDraw3D::_load_materials() {
 		LOAD_SHADER(mesh_shaders[(int)MeshMaterialType::Billboard][variant], prefix + DD3DResources::src_resources_billboard_unshaded_gdshader);
 		LOAD_SHADER(mesh_shaders[(int)MeshMaterialType::Plane][variant], prefix + DD3DResources::src_resources_plane_unshaded_gdshader);
 		LOAD_SHADER(mesh_shaders[(int)MeshMaterialType::Extendable][variant], prefix + DD3DResources::src_resources_extendable_meshes_gdshader);
+		LOAD_SHADER(mesh_shaders[(int)MeshMaterialType::ExtendableLine][variant], prefix + "#define LINE_FROM_ENDPOINTS\n" + DD3DResources::src_resources_extendable_meshes_gdshader);
+		LOAD_SHADER(mesh_shaders[(int)MeshMaterialType::Text][variant], prefix + DD3DResources::src_resources_text_glyphs_gdshader);
 	}
 #undef LOAD_SHADER
 #endif
@@ -696,6 +1091,12 @@ bool DebugDraw3D::_is_enabled_override() const {
 
 void DebugDraw3D::set_custom_editor_viewport(std::vector<SubViewport *> viewports) {
 	custom_editor_viewports = viewports;
+
+#ifndef DISABLE_DEBUG_RENDERING
+	for (auto *vp : custom_editor_viewports) {
+		_cache_world_for_threads(vp);
+	}
+#endif
 }
 
 std::vector<SubViewport *> DebugDraw3D::get_custom_editor_viewports() {
@@ -808,18 +1209,14 @@ void DebugDraw3D::regenerate_geometry_meshes() {
 	// Reload materials
 	_load_materials();
 
-	// Force regenerate meshes
-	shared_generated_meshes.clear();
+	// Force regenerate meshes, the cached ones are replaced too
+	_regenerate_shared_meshes(true);
 
+	// The containers are kept, so the retained shapes stay in their pools
 	for (auto &p : debug_containers) {
-		for (int i = 0; i < 2; i++) {
-			auto &dgc = p.second.dgcs[i];
+		for (auto &dgc : p.second.dgcs) {
 			if (dgc) {
-				Ref<World3D> old_world = dgc->get_world();
-				bool is_no_depth = dgc->is_no_depth_test();
-
-				dgc = std::make_unique<DebugGeometryContainer>(this, is_no_depth);
-				dgc->set_world(old_world);
+				dgc->reset_meshes();
 			}
 		}
 	}
@@ -841,9 +1238,18 @@ void DebugDraw3D::clear_all() {
 		}
 	}
 
+	{
+		std::lock_guard<std::mutex> lock(command_buffers_lock);
+		for (const auto &buffer : command_buffers) {
+			buffer->clear();
+		}
+	}
+
 	debug_containers.clear();
 	viewport_to_world_cache.clear();
 	world3ds_found_for_threads_cache.clear();
+	pending_texts.clear();
+	_clear_retained_shapes();
 #else
 	return;
 #endif
@@ -851,28 +1257,37 @@ void DebugDraw3D::clear_all() {
 
 #ifndef DISABLE_DEBUG_RENDERING
 #define IS_DEFAULT_COLOR(name) (name == Colors::empty_color)
-#define CHECK_BEFORE_CALL()                          \
-	if (NEED_LEAVE || config->is_freeze_3d_render()) \
-		return;
 
-#define GET_SCOPED_CFG_AND_VDC()                     \
-	auto scfg = scoped_config_for_current_thread();  \
-	auto vdc = get_debug_container(scfg->dcd, true); \
-	if (!vdc)                                        \
-		return;
+// Returns `p_colors` with the default colors replaced by `p_default`.
+// The array is copied only if it has default colors, the copy is valid until the next call on this thread.
+static const Color *_replace_default_colors(const Color *p_colors, const uint64_t &p_size, const Color &p_default) {
+	uint64_t first_default = 0;
+	while (first_default < p_size && !IS_DEFAULT_COLOR(p_colors[first_default]))
+		first_default++;
 
-#define GET_SCOPED_CFG_AND_DGC()                           \
-	GET_SCOPED_CFG_AND_VDC();                              \
-	auto dgc = vdc->dgcs[!!scfg->dcd.no_depth_test].get(); \
-	if (!dgc)                                              \
-		return;
+	if (first_default == p_size)
+		return p_colors;
 
-#define GET_SCOPED_CFG_AND_NC()                          \
-	GET_SCOPED_CFG_AND_VDC();                            \
-	auto nc = vdc->ncs[!!scfg->dcd.no_depth_test].get(); \
-	if (!nc)                                             \
+	ZoneScoped;
+	ADD_THREAD_LOCAL_BUFFER(colors, Color, p_size, 1024);
+	Color *res = colors.get();
+	memcpy(res, p_colors, first_default * sizeof(Color));
+	for (uint64_t i = first_default; i < p_size; i++) {
+		res[i] = IS_DEFAULT_COLOR(p_colors[i]) ? p_default : p_colors[i];
+	}
+	return res;
+}
+#define CHECK_BEFORE_CALL()                          \
+	if (NEED_LEAVE || config->is_freeze_3d_render()) \
 		return;
 
+// The containers are found when the commands are merged
+#define GET_SCOPED_CFG_AND_CMD()                    \
+	auto scfg = scoped_config_for_current_thread(); \
+	if (!scfg->dcd.viewport)                        \
+		return;                                     \
+	auto cmd = _get_command_buffer();
+
 #ifdef DEV_ENABLED
 void DebugDraw3D::_save_generated_meshes() {
 	if (!shared_generated_meshes.size())
@@ -881,6 +1296,9 @@ void DebugDraw3D::_save_generated_meshes() {
 	for (int i = 0; i < 2; i++) {
 		for (int type = 0; type < (int)InstanceType::MAX; type++) {
 			Ref<ArrayMesh> mesh = shared_generated_meshes[type][i].mesh;
+			if (mesh.is_null())
+				continue;
+
 			String dir_path = FMT_STR("res://debug_meshes/{0}", i == 0 ? "normal" : "no_depth");
 			DirAccess::make_dir_recursive_absolute(dir_path);
 			ResourceSaver::get_singleton()->save(mesh, FMT_STR("{0}/{1}.mesh", dir_path, type), ResourceSaver::SaverFlags::FLAG_BUNDLE_RESOURCES | ResourceSaver::SaverFlags::FLAG_REPLACE_SUBRESOURCE_PATHS);
@@ -900,12 +1318,11 @@ Vector3 DebugDraw3D::get_up_vector(const Vector3 &p_dir) {
 void DebugDraw3D::add_or_update_line_with_thickness(real_t p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const std::function<void(DelayedRendererLine *)> p_custom_upd) {
 	ZoneScoped;
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
 	if (!scfg->thickness) {
 		AABB aabb = MathUtils::calculate_vertex_bounds(p_lines, p_line_count);
-		dgc->geometry_pool.add_or_update_line(
+		cmd->add_or_update_line(
 				scfg,
 				p_exp_time,
 				p_lines,
@@ -922,11 +1339,18 @@ void DebugDraw3D::add_or_update_line_with_thickness(real_t p_exp_time, const Vec
 			if (Math::is_zero_approx(len))
 				continue;
 
-			dgc->geometry_pool.add_or_update_instance(
+#ifndef DISABLE_SHADER_WORLD_COORDS
+			// The shader builds the other axes of the segment from its direction
+			Transform3D xf(Basis(Vector3(), Vector3(), -diff), a);
+#else
+			Transform3D xf(Basis().looking_at(diff, get_up_vector(diff)).scaled(VEC3_ONE(len)), a);
+#endif
+
+			cmd->add_or_update_instance(
 					scfg,
 					InstanceType::LINE_VOLUMETRIC,
 					p_exp_time,
-					Transform3D(Basis().looking_at(diff, get_up_vector(diff)).scaled(VEC3_ONE(len)), a), // slow
+					xf,
 					p_col,
 					SphereBounds(a + diff * .5f, len * .5f));
 		}
@@ -939,10 +1363,9 @@ void DebugDraw3D::draw_sphere_base(const Transform3D &transform, const Color &co
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			ConvertableInstanceType::SPHERE,
 			duration,
@@ -964,20 +1387,61 @@ void DebugDraw3D::draw_sphere_xf(const Transform3D &transform, const Color &colo
 	draw_sphere_base(transform, color, duration);
 }
 
+void DebugDraw3D::draw_spheres(const PackedVector3Array &positions, const PackedFloat32Array &radii, const PackedColorArray &colors, const real_t &duration) {
+	ZoneScoped;
+	draw_spheres_c(positions.ptr(), positions.size(), radii.ptr(), radii.size(), colors.ptr(), colors.size(), duration);
+}
+
+void DebugDraw3D::draw_spheres_c(const godot::Vector3 *positions_data, const uint64_t &positions_size, const float *radii_data, const uint64_t &radii_size, const godot::Color *colors_data, const uint64_t &colors_size, const real_t &duration) {
+	ZoneScoped;
+	CHECK_BEFORE_CALL();
+
+	if (!positions_data || positions_size == 0)
+		return;
+
+	ERR_FAIL_COND_MSG(radii_size > 1 && radii_size != positions_size, "The size of the radii array must be 0, 1 or equal to the size of the positions array. " + String::num_int64(radii_size) + " != " + String::num_int64(positions_size));
+	ERR_FAIL_COND_MSG(colors_size > 1 && colors_size != positions_size, "The size of the colors array must be 0, 1 or equal to the size of the positions array. " + String::num_int64(colors_size) + " != " + String::num_int64(positions_size));
+
+	ADD_THREAD_LOCAL_BUFFER(transforms, Transform3D, positions_size, 1024);
+	ADD_THREAD_LOCAL_BUFFER(bounds, SphereBounds, positions_size, 1024);
+
+	{
+		ZoneScopedN("Convert to xf");
+		Transform3D *xf = transforms.get();
+		SphereBounds *sb = bounds.get();
+		for (uint64_t i = 0; i < positions_size; i++) {
+			real_t radius = radii_size == 0 ? 0.5f : radii_data[radii_size == 1 ? 0 : i];
+			xf[i] = Transform3D(Basis().scaled(VEC3_ONE(radius * 2)), positions_data[i]);
+			sb[i] = SphereBounds(positions_data[i], Math::abs(radius));
+		}
+	}
+
+	GET_SCOPED_CFG_AND_CMD();
+
+	cmd->add_or_update_instances(
+			scfg,
+			ConvertableInstanceType::SPHERE,
+			duration,
+			positions_size,
+			transforms.get(),
+			bounds.get(),
+			colors_size ? _replace_default_colors(colors_data, colors_size, Colors::chartreuse) : &Colors::chartreuse,
+			colors_size ? colors_size : 1);
+}
+
 #pragma endregion // Spheres
 #pragma region Cylinders
 
 void DebugDraw3D::create_capsule(const Transform3D &p_xf, const Vector3 &p_center, const Vector3 &p_top_cap, const Vector3 &p_bottom_cap, const real_t &p_radius, const real_t &p_height, const Color &p_color, const real_t &p_duration) {
 	ZoneScoped;
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
 	if (p_height > 0 && !Math::is_zero_approx(p_height)) {
 		ZoneScopedN("Edges");
 		Transform3D t = p_xf;
 		t.basis.scale_local(Vector3(p_radius, p_height, p_radius));
 		t.origin = p_center;
-		dgc->geometry_pool.add_or_update_instance(
+		cmd->add_or_update_instance(
 				scfg,
 				ConvertableInstanceType::CAPSULE_EDGES,
 				p_duration,
@@ -991,7 +1455,7 @@ void DebugDraw3D::create_capsule(const Transform3D &p_xf, const Vector3 &p_cente
 		Transform3D xf_c = p_xf;
 		xf_c.basis.scale_local(VEC3_ONE(p_radius));
 		xf_c.origin = p_top_cap;
-		dgc->geometry_pool.add_or_update_instance(
+		cmd->add_or_update_instance(
 				scfg,
 				ConvertableInstanceType::CAPSULE_CAP,
 				p_duration,
@@ -1001,7 +1465,7 @@ void DebugDraw3D::create_capsule(const Transform3D &p_xf, const Vector3 &p_cente
 
 		xf_c.basis.set_column(1, -xf_c.basis.get_column(1));
 		xf_c.origin = p_bottom_cap;
-		dgc->geometry_pool.add_or_update_instance(
+		cmd->add_or_update_instance(
 				scfg,
 				ConvertableInstanceType::CAPSULE_CAP,
 				p_duration,
@@ -1054,10 +1518,9 @@ void DebugDraw3D::draw_cylinder(const Transform3D &transform, const Color &color
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			ConvertableInstanceType::CYLINDER,
 			duration,
@@ -1081,10 +1544,9 @@ void DebugDraw3D::draw_cylinder_ab(const Vector3 &a, const Vector3 &b, const rea
 	t.basis.rotate(diff.cross(up).normalized(), Math::deg_to_rad(90.f));
 	t.basis.scale_local(Vector3(radius, len, radius));
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			ConvertableInstanceType::CYLINDER,
 			duration,
@@ -1125,10 +1587,9 @@ void DebugDraw3D::draw_box_ab(const Vector3 &a, const Vector3 &b, const Vector3
 		// copied from draw_box_xf
 		SphereBounds sb(t.origin + center_orig, MathUtils::get_max_basis_length(t.basis) * MathUtils::CubeRadiusForSphere);
 
-		LOCK_GUARD(datalock);
-		GET_SCOPED_CFG_AND_DGC();
+		GET_SCOPED_CFG_AND_CMD();
 
-		dgc->geometry_pool.add_or_update_instance(
+		cmd->add_or_update_instance(
 				scfg,
 				ConvertableInstanceType::CUBE,
 				duration,
@@ -1156,10 +1617,9 @@ void DebugDraw3D::draw_box_xf(const Transform3D &transform, const Color &color,
 		sb.position = transform.origin + (transform.basis[0] + transform.basis[1] + transform.basis[2]) * 0.5f;
 	}
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			is_box_centered ? ConvertableInstanceType::CUBE_CENTERED : ConvertableInstanceType::CUBE,
 			duration,
@@ -1168,6 +1628,55 @@ void DebugDraw3D::draw_box_xf(const Transform3D &transform, const Color &color,
 			sb);
 }
 
+void DebugDraw3D::draw_boxes(const Array &transforms, const PackedColorArray &colors, const bool &is_box_centered, const real_t &duration) {
+	ZoneScoped;
+	CHECK_BEFORE_CALL();
+
+	ADD_THREAD_LOCAL_BUFFER(xfs, Transform3D, transforms.size(), 1024);
+	for (int64_t i = 0; i < transforms.size(); i++) {
+		xfs.get()[i] = transforms[i];
+	}
+
+	draw_boxes_c(xfs.get(), transforms.size(), colors.ptr(), colors.size(), is_box_centered, duration);
+}
+
+void DebugDraw3D::draw_boxes_c(const godot::Transform3D *transforms_data, const uint64_t &transforms_size, const godot::Color *colors_data, const uint64_t &colors_size, const bool &is_box_centered, const real_t &duration) {
+	ZoneScoped;
+	CHECK_BEFORE_CALL();
+
+	if (!transforms_data || transforms_size == 0)
+		return;
+
+	ERR_FAIL_COND_MSG(colors_size > 1 && colors_size != transforms_size, "The size of the colors array must be 0, 1 or equal to the size of the transforms array. " + String::num_int64(colors_size) + " != " + String::num_int64(transforms_size));
+
+	ADD_THREAD_LOCAL_BUFFER(bounds, SphereBounds, transforms_size, 1024);
+
+	{
+		ZoneScopedN("Calculate bounds");
+		SphereBounds *sb = bounds.get();
+		for (uint64_t i = 0; i < transforms_size; i++) {
+			// copied from draw_box_xf
+			const Transform3D &xf = transforms_data[i];
+			sb[i] = SphereBounds(xf.origin, MathUtils::get_max_basis_length(xf.basis) * MathUtils::CubeRadiusForSphere);
+			if (!is_box_centered) {
+				sb[i].position = xf.origin + (xf.basis[0] + xf.basis[1] + xf.basis[2]) * 0.5f;
+			}
+		}
+	}
+
+	GET_SCOPED_CFG_AND_CMD();
+
+	cmd->add_or_update_instances(
+			scfg,
+			is_box_centered ? ConvertableInstanceType::CUBE_CENTERED : ConvertableInstanceType::CUBE,
+			duration,
+			transforms_size,
+			transforms_data,
+			bounds.get(),
+			colors_size ? _replace_default_colors(colors_data, colors_size, Colors::forest_green) : &Colors::forest_green,
+			colors_size ? colors_size : 1);
+}
+
 void DebugDraw3D::draw_aabb(const AABB &aabb, const Color &color, const real_t &duration) {
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
@@ -1192,7 +1701,6 @@ void DebugDraw3D::draw_line_hit(const Vector3 &start, const Vector3 &end, const
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
 	if (is_hit) {
 		if (!start.is_equal_approx(hit)) {
 			Vector3 first[2] = { start, hit };
@@ -1204,9 +1712,9 @@ void DebugDraw3D::draw_line_hit(const Vector3 &start, const Vector3 &end, const
 			add_or_update_line_with_thickness(duration, second, 2, IS_DEFAULT_COLOR(after_hit_color) ? config->get_line_after_hit_color() : after_hit_color);
 		}
 
-		GET_SCOPED_CFG_AND_DGC();
+		GET_SCOPED_CFG_AND_CMD();
 
-		dgc->geometry_pool.add_or_update_instance(
+		cmd->add_or_update_instance(
 				scfg,
 				InstanceType::BILLBOARD_SQUARE,
 				duration,
@@ -1308,10 +1816,9 @@ void DebugDraw3D::create_arrow(const Vector3 &p_a, const Vector3 &p_b, const Col
 	real_t size = (p_is_absolute_size ? p_arrow_size : len * p_arrow_size) * 2;
 	Transform3D t = Transform3D(Basis().looking_at(diff, get_up_vector(diff)).scaled(VEC3_ONE(size)), p_b);
 
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	LOCK_GUARD(datalock);
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			ConvertableInstanceType::ARROWHEAD,
 			p_duration,
@@ -1324,10 +1831,9 @@ void DebugDraw3D::draw_arrowhead(const Transform3D &transform, const Color &colo
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			ConvertableInstanceType::ARROWHEAD,
 			duration,
@@ -1340,8 +1846,6 @@ void DebugDraw3D::draw_arrow(const Vector3 &a, const Vector3 &b, const Color &co
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
-
 	Vector3 line[2] = { a, b };
 	add_or_update_line_with_thickness(duration, line, 2, IS_DEFAULT_COLOR(color) ? Colors::light_green : color);
 	create_arrow(a, b, color, arrow_size, is_absolute_size, duration);
@@ -1353,6 +1857,79 @@ void DebugDraw3D::draw_arrow_ray(const Vector3 &origin, const Vector3 &direction
 	draw_arrow(origin, origin + direction * length, color, arrow_size, is_absolute_size, duration);
 }
 
+void DebugDraw3D::draw_arrows(const PackedVector3Array &lines, const PackedColorArray &colors, const real_t &arrow_size, const bool &is_absolute_size, const real_t &duration) {
+	ZoneScoped;
+	draw_arrows_c(lines.ptr(), lines.size(), colors.ptr(), colors.size(), arrow_size, is_absolute_size, duration);
+}
+
+void DebugDraw3D::draw_arrows_c(const godot::Vector3 *lines_data, const uint64_t &lines_size, const godot::Color *colors_data, const uint64_t &colors_size, const real_t &arrow_size, const bool &is_absolute_size, const real_t &duration) {
+	ZoneScoped;
+	CHECK_BEFORE_CALL();
+
+	if (!lines_data || lines_size == 0)
+		return;
+
+	ERR_FAIL_COND_MSG(lines_size % 2 != 0, "The size of the lines array must be even. " + String::num_int64(lines_size) + " is not even.");
+
+	const uint64_t arrows_size = lines_size / 2;
+	ERR_FAIL_COND_MSG(colors_size > 1 && colors_size != arrows_size, "The size of the colors array must be 0, 1 or equal to the number of arrows. " + String::num_int64(colors_size) + " != " + String::num_int64(arrows_size));
+
+	ADD_THREAD_LOCAL_BUFFER(transforms, Transform3D, arrows_size, 1024);
+	ADD_THREAD_LOCAL_BUFFER(bounds, SphereBounds, arrows_size, 1024);
+	ADD_THREAD_LOCAL_BUFFER(arrow_colors, Color, arrows_size, 1024);
+
+	// Arrows with zero length are skipped, as in `create_arrow`
+	uint64_t heads_size = 0;
+	{
+		ZoneScopedN("Convert AB to xf");
+		for (uint64_t i = 0; i < arrows_size; i++) {
+			const Vector3 &a = lines_data[i * 2];
+			const Vector3 &b = lines_data[i * 2 + 1];
+			Vector3 diff = b - a;
+			real_t len = diff.length();
+
+			if (Math::is_zero_approx(len))
+				continue;
+
+			real_t size = (is_absolute_size ? arrow_size : len * arrow_size) * 2;
+			Transform3D &t = transforms.get()[heads_size];
+			t = Transform3D(Basis().looking_at(diff, get_up_vector(diff)).scaled(VEC3_ONE(size)), b);
+			bounds.get()[heads_size] = SphereBounds(t.origin + t.basis.get_column(2) * 0.5f, MathUtils::ArrowRadiusForSphere * size);
+			const Color &col = colors_size == 0 ? Colors::light_green : colors_data[colors_size == 1 ? 0 : i];
+			arrow_colors.get()[heads_size] = IS_DEFAULT_COLOR(col) ? Colors::light_green : col;
+			heads_size++;
+		}
+	}
+
+	// Lines have only one color, so consecutive arrows with the same color share one line
+	{
+		ZoneScopedN("Lines");
+		uint64_t run_start = 0;
+		for (uint64_t i = 1; i <= arrows_size; i++) {
+			if (i == arrows_size || (colors_size > 1 && colors_data[i] != colors_data[run_start])) {
+				const Color &col = colors_size == 0 ? Colors::light_green : colors_data[colors_size == 1 ? 0 : run_start];
+				add_or_update_line_with_thickness(duration, lines_data + run_start * 2, (i - run_start) * 2, IS_DEFAULT_COLOR(col) ? Colors::light_green : col);
+				run_start = i;
+			}
+		}
+	}
+
+	if (!heads_size)
+		return;
+
+	GET_SCOPED_CFG_AND_CMD();
+
+	cmd->add_or_update_instances(
+			scfg,
+			ConvertableInstanceType::ARROWHEAD,
+			duration,
+			heads_size,
+			transforms.get(),
+			bounds.get(),
+			arrow_colors.get(),
+			heads_size);
+}
+
 void DebugDraw3D::draw_arrow_path(const PackedVector3Array &path, const Color &color, const real_t &arrow_size, const bool &is_absolute_size, const real_t &duration) {
 	ZoneScoped;
 	draw_arrow_path_c(path.ptr(), path.size(), color, arrow_size, is_absolute_size, duration);
@@ -1374,7 +1951,6 @@ void DebugDraw3D::draw_arrow_path_c(const godot::Vector3 *path_data, const uint6
 	ADD_THREAD_LOCAL_BUFFER(buffer, Vector3, lines_size, 10000);
 	GeometryGenerator::CreateLinesFromPathWireframe(path_data, path_size, buffer.get());
 
-	LOCK_GUARD(datalock);
 	add_or_update_line_with_thickness(duration, buffer.get(), lines_size, IS_DEFAULT_COLOR(color) ? Colors::light_green : color);
 
 	for (int64_t i = 0; i < path_size - 1; i++) {
@@ -1409,7 +1985,6 @@ void DebugDraw3D::draw_point_path_c(const godot::Vector3 *path_data, const uint6
 		return;
 	}
 
-	LOCK_GUARD(datalock);
 	draw_points_c(path_data, path_size, type, size, IS_DEFAULT_COLOR(points_color) ? Colors::red : points_color, duration);
 	draw_line_path_c(path_data, path_size, IS_DEFAULT_COLOR(lines_color) ? Colors::green : lines_color, duration);
 }
@@ -1423,10 +1998,9 @@ void DebugDraw3D::draw_square(const Vector3 &position, const real_t &size, const
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			InstanceType::BILLBOARD_SQUARE,
 			duration,
@@ -1442,8 +2016,7 @@ void DebugDraw3D::draw_plane(const Plane &plane, const Color &color, const Vecto
 
 	Color front_color = IS_DEFAULT_COLOR(color) ? Colors::plane_light_sky_blue : color;
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
 	Camera3D *cam = scfg->dcd.viewport ? scfg->dcd.viewport->get_camera_3d() : nullptr;
 
@@ -1453,7 +2026,7 @@ void DebugDraw3D::draw_plane(const Plane &plane, const Color &color, const Vecto
 	t = t.looking_at(center_pos + plane.normal, get_up_vector(plane.normal)).scaled_local(VEC3_ONE(plane_size));
 	Color custom_col = Color::from_hsv(front_color.get_h(), Math::clamp(front_color.get_s() - 0.25f, 0.f, 1.f), Math::clamp(front_color.get_v() - 0.25f, 0.f, 1.f), front_color.a);
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			InstanceType::PLANE,
 			duration,
@@ -1475,35 +2048,53 @@ void DebugDraw3D::draw_points_c(const godot::Vector3 *points_data, const uint64_
 	if (!points_data || points_size == 0)
 		return;
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	const bool is_square = type == PointType::POINT_TYPE_SQUARE;
+	const real_t scale = is_square ? size : size * 2;
+	const real_t radius = is_square ? MathUtils::CubeRadiusForSphere * size : Math::abs(size);
+
+	ADD_THREAD_LOCAL_BUFFER(transforms, Transform3D, points_size, 1024);
+	ADD_THREAD_LOCAL_BUFFER(bounds, SphereBounds, points_size, 1024);
+
+	{
+		ZoneScopedN("Convert to xf");
+		Transform3D *xf = transforms.get();
+		SphereBounds *sb = bounds.get();
+		for (uint64_t i = 0; i < points_size; i++) {
+			xf[i] = Transform3D(Basis().scaled(VEC3_ONE(scale)), points_data[i]);
+			sb[i] = SphereBounds(points_data[i], radius);
+		}
+	}
+
+	GET_SCOPED_CFG_AND_CMD();
 
 	switch (type) {
-		case PointType::POINT_TYPE_SQUARE:
-			for (int i = 0; i < points_size; i++) {
-				dgc->geometry_pool.add_or_update_instance(
-						scfg,
-						InstanceType::BILLBOARD_SQUARE,
-						duration,
-						Transform3D(Basis().scaled(VEC3_ONE(size)), points_data[i]),
-						IS_DEFAULT_COLOR(color) ? Colors::red : color,
-						SphereBounds(points_data[i], MathUtils::CubeRadiusForSphere * size),
-						&Colors::empty_color);
-			}
+		case PointType::POINT_TYPE_SQUARE: {
+			const Color col = IS_DEFAULT_COLOR(color) ? Colors::red : color;
+			cmd->add_or_update_instances(
+					scfg,
+					InstanceType::BILLBOARD_SQUARE,
+					duration,
+					points_size,
+					transforms.get(),
+					bounds.get(),
+					&col,
+					1,
+					&Colors::empty_color);
 			break;
-		case PointType::POINT_TYPE_SPHERE:
-			for (int i = 0; i < points_size; i++) {
-				auto transform = Transform3D(Basis().scaled(VEC3_ONE(size * 2)), points_data[i]);
-
-				dgc->geometry_pool.add_or_update_instance(
-						scfg,
-						ConvertableInstanceType::SPHERE,
-						duration,
-						transform,
-						IS_DEFAULT_COLOR(color) ? Colors::chartreuse : color,
-						SphereBounds(transform.origin, MathUtils::get_max_basis_length(transform.basis) * 0.5f));
-			}
+		}
+		case PointType::POINT_TYPE_SPHERE: {
+			const Color col = IS_DEFAULT_COLOR(color) ? Colors::chartreuse : color;
+			cmd->add_or_update_instances(
+					scfg,
+					ConvertableInstanceType::SPHERE,
+					duration,
+					points_size,
+					transforms.get(),
+					bounds.get(),
+					&col,
+					1);
 			break;
+		}
 	}
 }
 
@@ -1511,10 +2102,9 @@ void DebugDraw3D::draw_position(const Transform3D &transform, const Color &color
 	ZoneScoped;
 	CHECK_BEFORE_CALL();
 
-	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_DGC();
+	GET_SCOPED_CFG_AND_CMD();
 
-	dgc->geometry_pool.add_or_update_instance(
+	cmd->add_or_update_instance(
 			scfg,
 			ConvertableInstanceType::POSITION,
 			duration,
@@ -1532,7 +2122,6 @@ void DebugDraw3D::draw_gizmo(const Transform3D &transform, const Color &color, c
 #define MINUS(axis) transform.origin - transform.basis.get_column(axis)
 #define PLUS(axis) transform.origin + transform.basis.get_column(axis)
 
-	LOCK_GUARD(datalock);
 	if (is_centered) {
 		draw_arrow(MINUS(0 /** 0.5f*/), PLUS(0 /** 0.5f*/), COLOR(x), 0.1f, true, duration);
 		draw_arrow(MINUS(1 /** 0.5f*/), PLUS(1 /** 0.5f*/), COLOR(y), 0.1f, true, duration);
@@ -1632,7 +2221,6 @@ void DebugDraw3D::draw_camera_frustum_planes_c(const godot::Plane *camera_frustu
 	thread_local static Vector3 lines[GeometryGenerator::CubeIndexes.size()];
 	GeometryGenerator::CreateCameraFrustumLinesWireframe(camera_frustum_data, camera_frustum_size, lines);
 
-	LOCK_GUARD(datalock);
 	add_or_update_line_with_thickness(duration, lines, GeometryGenerator::CubeIndexes.size(), IS_DEFAULT_COLOR(color) ? Colors::red : color);
 }
 
@@ -1644,7 +2232,19 @@ void DebugDraw3D::draw_text(const Vector3 &position, const String text, const in
 	CHECK_BEFORE_CALL();
 
 	LOCK_GUARD(datalock);
-	GET_SCOPED_CFG_AND_NC();
+	auto scfg = scoped_config_for_current_thread();
+	bool is_world_pending = false;
+	auto vdc = get_debug_container(scfg->dcd, true, &is_world_pending);
+	if (!vdc) {
+		if (is_world_pending) {
+			_add_pending_text(scfg, position, text, size, IS_DEFAULT_COLOR(color) ? Colors::white : color, duration);
+		}
+		return;
+	}
+
+	auto nc = vdc->ncs[!!scfg->dcd.no_depth_test].get();
+	if (!nc)
+		return;
 
 	nc->add_or_update_text(
 			scfg,
@@ -1665,9 +2265,238 @@ void DebugDraw3D::draw_text_c(const godot::Vector3 &position, const char *text_s
 #pragma endregion // Misc
 #endif
 
+#pragma region Retained Shapes
+#ifndef DISABLE_DEBUG_RENDERING
+
+int64_t DebugDraw3D::_add_retained_shape(const RetainedShapeType &p_type, const RetainedObjectId &p_id, const DebugDraw3DScopeConfig::Data *p_cfg, const uint64_t &p_world_id) {
+	uint32_t idx;
+	if (free_retained_shapes.size()) {
+		idx = free_retained_shapes.back();
+		free_retained_shapes.pop_back();
+	} else {
+		idx = (uint32_t)retained_shapes.size();
+		retained_shapes.emplace_back();
+	}
+
+	RetainedShape &shape = retained_shapes[idx];
+	shape.id = p_id;
+	shape.world_id = p_world_id;
+	shape.no_depth_test = !!p_cfg->dcd.no_depth_test;
+	shape.type = p_type;
+	shape.scope_transform = p_cfg->custom_xform ? p_cfg->transform : Transform3D();
+	shape.is_used = true;
+	// 0 is reserved for the invalid handle
+	shape.generation = (shape.generation + 1) & 0x7FFFFFFF;
+	if (!shape.generation) {
+		shape.generation = 1;
+	}
+
+	return ((int64_t)shape.generation << 32) | ((int64_t)idx + 1);
+}
+
+DebugGeometryContainer *DebugDraw3D::_get_retained_shape(const int64_t &p_handle, RetainedShape **r_shape) {
+	uint64_t idx = (uint64_t)p_handle & 0xFFFFFFFF;
+	uint32_t generation = (uint32_t)((uint64_t)p_handle >> 32);
+	if (idx == 0 || idx > retained_shapes.size()) {
+		return nullptr;
+	}
+
+	RetainedShape &shape = retained_shapes[idx - 1];
+	if (!shape.is_used || shape.generation != generation) {
+		return nullptr;
+	}
+
+	DebugGeometryContainer *dgc = nullptr;
+	if (const auto &c = debug_containers.find(shape.world_id); c != debug_containers.end()) {
+		dgc = c->second.dgcs[shape.no_depth_test].get();
+	}
+
+	// The World3D was removed along with its shapes
+	if (!dgc) {
+		_free_retained_shape(p_handle);
+		return nullptr;
+	}
+
+	*r_shape = &shape;
+	return dgc;
+}
+
+void DebugDraw3D::_free_retained_shape(const int64_t &p_handle) {
+	uint32_t idx = (uint32_t)(((uint64_t)p_handle & 0xFFFFFFFF) - 1);
+	retained_shapes[idx].is_used = false;
+	free_retained_shapes.push_back(idx);
+}
+
+void DebugDraw3D::_clear_retained_shapes() {
+	// The generations are kept, so the old handles will not match the new shapes
+	free_retained_shapes.clear();
+	for (uint32_t i = 0; i < retained_shapes.size(); i++) {
+		retained_shapes[i].is_used = false;
+		free_retained_shapes.push_back(i);
+	}
+}
+
+SphereBounds DebugDraw3D::_get_retained_shape_bounds(const RetainedShapeType &p_type, const Transform3D &p_transform) {
+	switch (p_type) {
+		case RetainedShapeType::SPHERE:
+			return SphereBounds(p_transform.origin, MathUtils::get_max_basis_length(p_transform.basis) * 0.5f);
+		case RetainedShapeType::BOX:
+			return SphereBounds(p_transform.origin + (p_transform.basis[0] + p_transform.basis[1] + p_transform.basis[2]) * 0.5f, MathUtils::get_max_basis_length(p_transform.basis) * MathUtils::CubeRadiusForSphere);
+		case RetainedShapeType::BOX_CENTERED:
+			return SphereBounds(p_transform.origin, MathUtils::get_max_basis_length(p_transform.basis) * MathUtils::CubeRadiusForSphere);
+		case RetainedShapeType::LINES:
+		default:
+			// The bounds of the lines are calculated by the GeometryPool
+			return SphereBounds();
+	}
+}
+
+int64_t DebugDraw3D::_create_retained_instance(const RetainedShapeType &p_type, const Transform3D &p_transform, const Color &p_color) {
+	ZoneScoped;
+	if (NEED_LEAVE)
+		return 0;
+
+	LOCK_GUARD(datalock);
+	auto scfg = scoped_config_for_current_thread();
+	auto vdc = get_debug_container(scfg->dcd, true);
+	if (!vdc)
+		return 0;
+	auto dgc = vdc->dgcs[!!scfg->dcd.no_depth_test].get();
+	if (!dgc)
+		return 0;
+
+	ConvertableInstanceType type = ConvertableInstanceType::SPHERE;
+	if (p_type == RetainedShapeType::BOX) {
+		type = ConvertableInstanceType::CUBE;
+	} else if (p_type == RetainedShapeType::BOX_CENTERED) {
+		type = ConvertableInstanceType::CUBE_CENTERED;
+	}
+
+	RetainedObjectId id = dgc->geometry_pool.add_retained_instance(scfg, type, p_transform, p_color, _get_retained_shape_bounds(p_type, p_transform));
+	return _add_retained_shape(p_type, id, scfg, vdc->world_id);
+}
+
+#endif
+
+int64_t DebugDraw3D::create_sphere(const Vector3 &position, const real_t &radius, const Color &color) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	real_t scale = radius * 2;
+	return _create_retained_instance(RetainedShapeType::SPHERE, Transform3D(Basis().scaled(VEC3_ONE(scale)), position), IS_DEFAULT_COLOR(color) ? Colors::chartreuse : color);
+#else
+	return 0;
+#endif
+}
+
+int64_t DebugDraw3D::create_box(const Transform3D &transform, const Color &color, const bool &is_box_centered) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	return _create_retained_instance(is_box_centered ? RetainedShapeType::BOX_CENTERED : RetainedShapeType::BOX, transform, IS_DEFAULT_COLOR(color) ? Colors::forest_green : color);
+#else
+	return 0;
+#endif
+}
+
+int64_t DebugDraw3D::create_line_batch(const PackedVector3Array &lines, const Color &color) {
+	ZoneScoped;
+	return create_line_batch_c(lines.ptr(), lines.size(), color);
+}
+
+int64_t DebugDraw3D::create_line_batch_c(const Vector3 *lines_data, const uint64_t &lines_size, const Color &color) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	if (NEED_LEAVE || !lines_data || lines_size == 0)
+		return 0;
+
+	ERR_FAIL_COND_V_MSG(lines_size % 2 != 0, 0, "The size of the lines array must be even. " + String::num_int64(lines_size) + " is not even.");
+
+	LOCK_GUARD(datalock);
+	auto scfg = scoped_config_for_current_thread();
+	auto vdc = get_debug_container(scfg->dcd, true);
+	if (!vdc)
+		return 0;
+	auto dgc = vdc->dgcs[!!scfg->dcd.no_depth_test].get();
+	if (!dgc)
+		return 0;
+
+	RetainedObjectId id = dgc->geometry_pool.add_retained_line(scfg, lines_data, lines_size, IS_DEFAULT_COLOR(color) ? Colors::red : color);
+	return _add_retained_shape(RetainedShapeType::LINES, id, scfg, vdc->world_id);
+#else
+	return 0;
+#endif
+}
+
+void DebugDraw3D::update_transform(const int64_t &handle, const Transform3D &transform) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	LOCK_GUARD(datalock);
+	RetainedShape *shape = nullptr;
+	DebugGeometryContainer *dgc = _get_retained_shape(handle, &shape);
+	if (!dgc)
+		return;
+
+	const Transform3D xf = shape->scope_transform * transform;
+	if (!dgc->geometry_pool.update_retained_transform(shape->id, xf, _get_retained_shape_bounds(shape->type, xf))) {
+		_free_retained_shape(handle);
+	}
+#else
+	return;
+#endif
+}
+
+void DebugDraw3D::set_color(const int64_t &handle, const Color &color) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	LOCK_GUARD(datalock);
+	RetainedShape *shape = nullptr;
+	DebugGeometryContainer *dgc = _get_retained_shape(handle, &shape);
+	if (!dgc)
+		return;
+
+	if (!dgc->geometry_pool.set_retained_color(shape->id, color)) {
+		_free_retained_shape(handle);
+	}
+#else
+	return;
+#endif
+}
+
+void DebugDraw3D::set_visible(const int64_t &handle, const bool &visible) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	LOCK_GUARD(datalock);
+	RetainedShape *shape = nullptr;
+	DebugGeometryContainer *dgc = _get_retained_shape(handle, &shape);
+	if (!dgc)
+		return;
+
+	if (!dgc->geometry_pool.set_retained_visible(shape->id, visible)) {
+		_free_retained_shape(handle);
+	}
+#else
+	return;
+#endif
+}
+
+void DebugDraw3D::destroy(const int64_t &handle) {
+	ZoneScoped;
+#ifndef DISABLE_DEBUG_RENDERING
+	LOCK_GUARD(datalock);
+	RetainedShape *shape = nullptr;
+	DebugGeometryContainer *dgc = _get_retained_shape(handle, &shape);
+	if (!dgc)
+		return;
+
+	dgc->geometry_pool.remove_retained(shape->id);
+	_free_retained_shape(handle);
+#else
+	return;
+#endif
+}
+
+#pragma endregion // Retained Shapes
+
 #undef IS_DEFAULT_COLOR
 #undef CHECK_BEFORE_CALL
 #undef NEED_LEAVE
-#undef GET_SCOPED_CFG_AND_VDC
-#undef GET_SCOPED_CFG_AND_DGC
-#undef GET_SCOPED_CFG_AND_NC
+#undef GET_SCOPED_CFG_AND_CMD
@@ -3,15 +3,18 @@
 #include "common/colors.h"
 #include "common/i_scope_storage.h"
 #include "config_scope_3d.h"
+#include "draw_commands.h"
 #include "geometry_generators.h"
 #include "render_instances_enums.h"
 #include "utils/compiler.h"
 #include "utils/native_api_hooks.h"
 #include "utils/profiler.h"
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/classes/array_mesh.hpp>
@@ -31,6 +34,7 @@ class DebugDraw3DStats;
 class DebugGeometryContainer;
 class NodesContainer;
 struct DelayedRendererLine;
+struct SphereBounds;
 #endif
 
 /// @private
@@ -39,6 +43,10 @@ enum class MeshMaterialType : char {
 	Billboard,
 	Plane,
 	Extendable,
+	// `Extendable` for the lines whose instances store only the direction
+	ExtendableLine,
+	// Glyph quads of the text
+	Text,
 	MAX,
 };
 
@@ -164,29 +172,80 @@ private:
 #ifndef DISABLE_DEBUG_RENDERING
 	ProfiledMutex(std::recursive_mutex, datalock, "3D Geometry lock");
 
-	struct ScopedPairIdConfig {
-		uint64_t id;
-		DebugDraw3DScopeConfig *scfg;
-		ScopedPairIdConfig(uint64_t id, DebugDraw3DScopeConfig *scfg) :
-				id(id), scfg(scfg) {}
+	// Per-thread data is recreated if it was created for another instance of this class
+	uint64_t thread_data_owner_id = 0;
+
+	// Configs of a thread destroyed by other threads. They are removed from the stack by the owner thread on its next access.
+	struct ScopedConfigsRemovals {
+		std::mutex lock;
+		std::vector<uint64_t> guard_ids;
+		// Checked on every access, so the lock is taken only if there are removals
+		std::atomic<uint32_t> count = 0;
+	};
+
+	// Scoped configs of a thread. Only the owner thread changes it, so no lock is needed to find the current config.
+	// The configs are owned by their `DebugDraw3DScopeConfig`, so a `thread_local` stack never keeps them or their fonts alive.
+	struct ScopedConfigsStack {
+		struct Item {
+			uint64_t guard_id;
+			const DebugDraw3DScopeConfig::Data *data;
+		};
+		std::vector<Item> items;
+		// The top of the stack or the default config
+		const DebugDraw3DScopeConfig::Data *current = nullptr;
+		uint64_t thread_id = 0;
+		uint64_t owner_id = 0;
+		// The stack is cleared on the next access if the configs were cleared at the end of the frame
+		uint64_t generation = 0;
+		std::shared_ptr<ScopedConfigsRemovals> removals;
 	};
-	// stores thread id and array of id's with ptrs
-	std::unordered_map<uint64_t, std::vector<ScopedPairIdConfig>> scoped_configs;
-	// stores thread id and most recent config
-	std::unordered_map<uint64_t, std::shared_ptr<DebugDraw3DScopeConfig::Data>> cached_scoped_configs;
-	uint64_t created_scoped_configs = 0;
+	// The removals of the stacks of the threads by their ids
+	std::mutex scoped_configs_removals_lock;
+	std::unordered_map<uint64_t, std::weak_ptr<ScopedConfigsRemovals>> scoped_configs_removals;
+	std::atomic<uint64_t> scoped_configs_generation = 1;
+	// The configs that are still registered at the end of the frame are orphans
+	std::atomic<int64_t> registered_scoped_configs = 0;
+	std::atomic<uint64_t> created_scoped_configs = 0;
 	struct {
 		uint64_t created;
 		uint64_t orphans;
 	} scoped_stats_3d = {};
 
+	ScopedConfigsStack &_get_scoped_configs_stack();
+	void _remove_scoped_config(ScopedConfigsStack &r_stack, const uint64_t &p_guard_id);
+
 	// Inherited via IScopeStorage
 	const DebugDraw3DScopeConfig::Data *scoped_config_for_current_thread() override;
 
+	// Draw calls are recorded by each thread into its own buffer without `datalock`
+	// and merged into the geometry pools at the end of the process and physics frames.
+	std::mutex command_buffers_lock;
+	std::vector<std::shared_ptr<DrawCommandBuffer>> command_buffers;
+	DrawCommandBuffer::Commands merging_commands;
+	std::vector<DebugGeometryContainer *> merging_containers;
+
+	DrawCommandBuffer *_get_command_buffer();
+	void _merge_command_buffers();
+
 	// Meshes
-	/// Store meshes shared between many debug containers
+	/// Store meshes shared between many debug containers.
+	/// Each type is generated on its first use, so the meshes of the unused types stay empty.
 	std::vector<std::array<GeometryGenerator::GeneratedMeshData, (int)MeshMaterialVariant::MAX>> shared_generated_meshes;
 
+	struct SharedMeshesSettings {
+		bool add_bevel = true;
+		bool use_icosphere = false;
+		bool use_icosphere_hd = true;
+
+		_FORCE_INLINE_ uint32_t get_flags() const {
+			return (uint32_t)add_bevel | (uint32_t)use_icosphere << 1 | (uint32_t)use_icosphere_hd << 2;
+		}
+	} shared_meshes_settings;
+	uint32_t shared_meshes_cache_key = 0;
+	// The surfaces of the generated meshes, `null` for the types that are not generated yet
+	Array shared_meshes_cache;
+	std::vector<InstanceType> shared_meshes_generating_types;
+
 	/// Store World3D id and debug container
 	struct ViewportToDebugContainerItem {
 		uint64_t world_id;
@@ -204,6 +263,19 @@ private:
 	std::unordered_map<const Viewport *, ViewportToDebugContainerItem *> viewport_to_world_cache;
 	std::unordered_map<uint64_t /*Viewport * */, Ref<World3D>> world3ds_found_for_threads_cache;
 
+	// Text drawn by other threads while the World3D of the viewport is being searched.
+	// It is added to the container when the search is completed.
+	struct PendingText {
+		std::shared_ptr<DebugDraw3DScopeConfig::Data> cfg;
+		Vector3 position;
+		String text;
+		int size;
+		Color color;
+		real_t duration;
+	};
+	static constexpr size_t MAX_PENDING_TEXTS_PER_VIEWPORT = 1024;
+	std::unordered_map<uint64_t /*Viewport * */, std::vector<PendingText>> pending_texts;
+
 	// Default materials and shaders
 	Ref<ShaderMaterial> mesh_shaders[(int)MeshMaterialType::MAX][(int)MeshMaterialVariant::MAX];
 
@@ -213,9 +285,21 @@ private:
 	void _clear_scoped_configs() override;
 	void _clear_all_remove_watcher_as_child(uint64_t world_watcher_id);
 
-	std::array<GeometryGenerator::GeneratedMeshData, (int)MeshMaterialVariant::MAX> *get_shared_meshes();
-	DebugDraw3D::ViewportToDebugContainerItem *get_debug_container(const DebugDraw3DScopeConfig::DebugContainerDependent &p_dgcd, const bool p_generate_new_container);
+	SharedMeshesSettings _get_shared_meshes_settings();
+	GeometryGenerator::GeneratedMeshData _generate_shared_mesh(InstanceType p_type) const;
+	static void _generate_shared_mesh_task(void *p_userdata, uint32_t p_idx);
+	// With `p_ignore_cache`, the cache file is not loaded and is rewritten with the generated meshes.
+	// It only matters when no meshes have been generated yet, as in `_regenerate_shared_meshes`.
+	void _generate_shared_meshes(const std::vector<InstanceType> &p_types, bool p_ignore_cache = false);
+	void _regenerate_shared_meshes(bool p_ignore_cache);
+	void _on_project_settings_changed();
+	Ref<ArrayMesh> get_shared_mesh(InstanceType p_type, MeshMaterialVariant p_variant);
+	// `r_is_world_pending` is set to true if the World3D is still being searched for the calling thread
+	DebugDraw3D::ViewportToDebugContainerItem *get_debug_container(const DebugDraw3DScopeConfig::DebugContainerDependent &p_dgcd, const bool p_generate_new_container, bool *r_is_world_pending = nullptr);
 	void _deferred_find_world_in_viewport(uint64_t p_viewport_id);
+	// Finds the World3D of the viewport in the main thread, so other threads do not need the deferred search
+	void _cache_world_for_threads(Viewport *p_viewport);
+	void _add_pending_text(const DebugDraw3DScopeConfig::Data *p_cfg, const Vector3 &p_position, const String &p_text, const int &p_size, const Color &p_color, const real_t &p_duration);
 	void _register_viewport_world_deferred(uint64_t /*Viewport * */ p_viewport_id, const uint64_t p_world_id, _DD3D_WorldWatcher *watcher);
 	Node *_get_root_world_node(Node *p_scene_root, Viewport *p_vp);
 	void _remove_debug_container(const uint64_t &p_world_id);
@@ -227,6 +311,35 @@ private:
 	void create_arrow(const Vector3 &p_a, const Vector3 &p_b, const Color &p_color, const real_t &p_arrow_size, const bool &p_is_absolute_size, const real_t &p_duration = 0);
 	void create_capsule(const Transform3D &p_xf, const Vector3 &p_center, const Vector3 &p_top_cap, const Vector3 &p_bottom_cap, const real_t &p_radius, const real_t &p_height, const Color &p_color, const real_t &p_duration = 0);
 
+	// Retained shapes
+	enum class RetainedShapeType : char {
+		SPHERE,
+		BOX,
+		BOX_CENTERED,
+		LINES,
+	};
+
+	struct RetainedShape {
+		RetainedObjectId id;
+		uint64_t world_id = 0;
+		bool no_depth_test = false;
+		RetainedShapeType type = RetainedShapeType::SPHERE;
+		// The transform of the scope in which the shape was created, it is applied to the new transforms
+		Transform3D scope_transform;
+		// Handles of the freed shapes are invalidated by incrementing the generation
+		uint32_t generation = 0;
+		bool is_used = false;
+	};
+	std::vector<RetainedShape> retained_shapes;
+	std::vector<uint32_t> free_retained_shapes;
+
+	int64_t _add_retained_shape(const RetainedShapeType &p_type, const RetainedObjectId &p_id, const DebugDraw3DScopeConfig::Data *p_cfg, const uint64_t &p_world_id);
+	DebugGeometryContainer *_get_retained_shape(const int64_t &p_handle, RetainedShape **r_shape);
+	void _free_retained_shape(const int64_t &p_handle);
+	void _clear_retained_shapes();
+	SphereBounds _get_retained_shape_bounds(const RetainedShapeType &p_type, const Transform3D &p_transform);
+	int64_t _create_retained_instance(const RetainedShapeType &p_type, const Transform3D &p_transform, const Color &p_color);
+
 #ifdef DEV_ENABLED
 	void _save_generated_meshes();
 #endif
@@ -383,6 +496,22 @@ public:
 	 * @param duration The duration of how long the object will be visible
 	 */
 	NAPI void draw_sphere_xf(const godot::Transform3D &transform, const godot::Color &color = Colors::empty_color, const real_t &duration = 0) FAKE_FUNC_IMPL;
+	/**
+	 * Draw many spheres at once. It is much faster than calling DebugDraw3D.draw_sphere for each sphere.
+	 *
+	 * @note
+	 * The size of `radii` and `colors` can be equal to the size of `positions`, equal to 1 to use the same value for all spheres,
+	 * or equal to 0 to use the default radius of 0.5 and the default color.
+	 *
+	 * @param positions Centers of the spheres
+	 * @param radii Radii of the spheres
+	 * @param colors Primary colors
+	 * @param duration The duration of how long the objects will be visible
+	 */
+	void draw_spheres(const godot::PackedVector3Array &positions, const godot::PackedFloat32Array &radii = godot::PackedFloat32Array(), const godot::PackedColorArray &colors = godot::PackedColorArray(), const real_t &duration = 0) FAKE_FUNC_IMPL;
+	/// @private
+	// #docs_func draw_spheres
+	NAPI void draw_spheres_c(const godot::Vector3 *positions_data, const uint64_t &positions_size, const float *radii_data, const uint64_t &radii_size, const godot::Color *colors_data, const uint64_t &colors_size, const real_t &duration = 0) FAKE_FUNC_IMPL;
 
 #pragma endregion // Spheres
 
@@ -501,6 +630,23 @@ public:
 	 */
 	NAPI void draw_box_xf(const godot::Transform3D &transform, const godot::Color &color = Colors::empty_color, const bool &is_box_centered = true, const real_t &duration = 0) FAKE_FUNC_IMPL;
 
+	/**
+	 * Draw many boxes at once as in DebugDraw3D.draw_box_xf. It is much faster than calling DebugDraw3D.draw_box_xf for each box.
+	 *
+	 * @note
+	 * The size of `colors` can be equal to the size of `transforms`, equal to 1 to use the same color for all boxes,
+	 * or equal to 0 to use the default color.
+	 *
+	 * @param transforms Array of box transforms
+	 * @param colors Primary colors
+	 * @param is_box_centered Set where the center of the boxes will be. In the center or in the bottom corner
+	 * @param duration The duration of how long the objects will be visible
+	 */
+	void draw_boxes(const godot::Array &transforms, const godot::PackedColorArray &colors = godot::PackedColorArray(), const bool &is_box_centered = true, const real_t &duration = 0) FAKE_FUNC_IMPL;
+	/// @private
+	// #docs_func draw_boxes
+	NAPI void draw_boxes_c(const godot::Transform3D *transforms_data, const uint64_t &transforms_size, const godot::Color *colors_data, const uint64_t &colors_size, const bool &is_box_centered = true, const real_t &duration = 0) FAKE_FUNC_IMPL;
+
 	/**
 	 * Draw a box as in DebugDraw3D.draw_box, but based on the AABB
 	 *
@@ -663,6 +809,24 @@ public:
 	 */
 	NAPI void draw_arrow_ray(const godot::Vector3 &origin, const godot::Vector3 &direction, const real_t &length, const godot::Color &color = Colors::empty_color, const real_t &arrow_size = 0.5f, const bool &is_absolute_size = false, const real_t &duration = 0) FAKE_FUNC_IMPL;
 
+	/**
+	 * Draw many arrows at once as in DebugDraw3D.draw_arrow. It is much faster than calling DebugDraw3D.draw_arrow for each arrow.
+	 *
+	 * @note
+	 * The size of `colors` can be equal to the number of arrows, equal to 1 to use the same color for all arrows,
+	 * or equal to 0 to use the default color.
+	 *
+	 * @param lines Pairs of start and end points of the arrows
+	 * @param colors Primary colors
+	 * @param arrow_size Size of the arrows
+	 * @param is_absolute_size Is `arrow_size` absolute or relative to the length of the line?
+	 * @param duration The duration of how long the objects will be visible
+	 */
+	void draw_arrows(const godot::PackedVector3Array &lines, const godot::PackedColorArray &colors = godot::PackedColorArray(), const real_t &arrow_size = 0.5f, const bool &is_absolute_size = false, const real_t &duration = 0) FAKE_FUNC_IMPL;
+	/// @private
+	// #docs_func draw_arrows
+	NAPI void draw_arrows_c(const godot::Vector3 *lines_data, const uint64_t &lines_size, const godot::Color *colors_data, const uint64_t &colors_size, const real_t &arrow_size = 0.5f, const bool &is_absolute_size = false, const real_t &duration = 0) FAKE_FUNC_IMPL;
+
 	/**
 	 * Draw a sequence of points connected by lines with arrows like DebugDraw3D.draw_line_path.
 	 *
@@ -834,7 +998,7 @@ public:
 
 #pragma region Text
 	/**
-	 * Draw text using Label3D.
+	 * Draw text as billboard glyphs, like Label3D.
 	 *
 	 * @note
 	 * Outline can be changed using DebugDraw3DScopeConfig.set_text_outline_color and DebugDraw3DScopeConfig.set_text_outline_size.
@@ -857,6 +1021,90 @@ public:
 #pragma endregion // Text
 
 #pragma endregion // Misc
+
+#pragma region Retained Shapes
+	/**
+	 * Create a sphere that stays visible until it is destroyed using DebugDraw3D.destroy.
+	 *
+	 * Unlike DebugDraw3D.draw_sphere, a retained shape is not recreated every frame,
+	 * so static or rarely changing shapes do not need to be drawn again and again.
+	 *
+	 * @note
+	 * The scope settings, such as the thickness, the viewport and the depth test, are applied only on creation.
+	 *
+	 * @param position Center of the sphere
+	 * @param radius Sphere radius
+	 * @param color Primary color
+	 * @return The handle of the shape or 0 if it cannot be created
+	 */
+	NAPI int64_t create_sphere(const godot::Vector3 &position, const real_t &radius = 0.5f, const godot::Color &color = Colors::empty_color);
+	/**
+	 * Create a box that stays visible until it is destroyed using DebugDraw3D.destroy.
+	 *
+	 * @note
+	 * The scope settings, such as the thickness, the viewport and the depth test, are applied only on creation.
+	 *
+	 * @param transform Box transform
+	 * @param color Primary color
+	 * @param is_box_centered Set whether the box will be centered on the origin
+	 * @return The handle of the shape or 0 if it cannot be created
+	 */
+	NAPI int64_t create_box(const godot::Transform3D &transform, const godot::Color &color = Colors::empty_color, const bool &is_box_centered = true);
+	/**
+	 * Create a batch of lines that stays visible until it is destroyed using DebugDraw3D.destroy.
+	 *
+	 * @note
+	 * Retained lines are always drawn without thickness.
+	 * The transform of the current scope is used as the initial transform of the batch.
+	 *
+	 * @param lines An array of points that are the beginnings and ends of the lines. The size must be even.
+	 * @param color Primary color
+	 * @return The handle of the shape or 0 if it cannot be created
+	 */
+	int64_t create_line_batch(const godot::PackedVector3Array &lines, const godot::Color &color = Colors::empty_color);
+	/// @private
+	// #docs_func create_line_batch
+	NAPI int64_t create_line_batch_c(const godot::Vector3 *lines_data, const uint64_t &lines_size, const godot::Color &color = Colors::empty_color);
+
+	/**
+	 * Change the transform of a retained shape.
+	 *
+	 * The basis of a sphere is its diameter, as in DebugDraw3D.draw_sphere_xf.
+	 * The points of a line batch are transformed from the space in which they were created.
+	 *
+	 * @note
+	 * The new transform is relative to the transform of the scope in which the shape was created,
+	 * so the shapes created with DebugDraw3DScopeConfig.set_transform stay in that space.
+	 *
+	 * @param handle The handle returned by one of the `create_*` methods
+	 * @param transform New transform
+	 */
+	NAPI void update_transform(const int64_t &handle, const godot::Transform3D &transform);
+	/**
+	 * Change the color of a retained shape.
+	 *
+	 * @param handle The handle returned by one of the `create_*` methods
+	 * @param color New color
+	 */
+	NAPI void set_color(const int64_t &handle, const godot::Color &color);
+	/**
+	 * Show or hide a retained shape without destroying it.
+	 *
+	 * @param handle The handle returned by one of the `create_*` methods
+	 * @param visible Visibility of the shape
+	 */
+	NAPI void set_visible(const int64_t &handle, const bool &visible);
+	/**
+	 * Destroy a retained shape. The handle becomes invalid and all calls with it will be ignored.
+	 *
+	 * @note
+	 * Retained shapes are also destroyed by DebugDraw3D.clear_all and when their World3D is removed.
+	 *
+	 * @param handle The handle returned by one of the `create_*` methods
+	 */
+	NAPI void destroy(const int64_t &handle);
+
+#pragma endregion // Retained Shapes
 #pragma endregion // Exposed Draw Methods
 
 #undef FAKE_FUNC_IMPL
@@ -6,7 +6,9 @@
 #include "debug_draw_3d.h"
 #include "stats_3d.h"
 
+#include <algorithm>
 #include <array>
+#include <unordered_set>
 #include <utility>
 
 GODOT_WARNING_DISABLE()
@@ -20,64 +22,17 @@ DebugGeometryContainer::DebugGeometryContainer(DebugDraw3D *p_owner, bool p_no_d
 	ZoneScoped;
 	DEV_PRINT_STD("New %s created: %s\n", NAMEOF(DebugGeometryContainer), p_no_depth_test ? "NoDepth" : "Normal");
 	owner = p_owner;
-	RenderingServer *rs = RenderingServer::get_singleton();
 	no_depth_test = p_no_depth_test;
 	geometry_pool.set_no_depth_test_info(no_depth_test);
 	geometry_pool.set_debug_container_owner(this);
 
-	// Create wireframe mesh drawer
-	{
-		Ref<ArrayMesh> _array_mesh;
-		_array_mesh.instantiate();
-		RID _immediate_instance = rs->instance_create();
-
-		rs->instance_set_base(_immediate_instance, _array_mesh->get_rid());
-		rs->instance_geometry_set_cast_shadows_setting(_immediate_instance, RenderingServer::SHADOW_CASTING_SETTING_OFF);
-		rs->instance_geometry_set_flag(_immediate_instance, RenderingServer::INSTANCE_FLAG_USE_DYNAMIC_GI, false);
-		rs->instance_geometry_set_flag(_immediate_instance, RenderingServer::INSTANCE_FLAG_USE_BAKED_LIGHT, false);
-
-		Ref<ShaderMaterial> mat = owner->get_material_variant(MeshMaterialType::Wireframe, no_depth_test ? MeshMaterialVariant::NoDepth : MeshMaterialVariant::Normal);
-		rs->instance_geometry_set_material_override(_immediate_instance, mat->get_rid());
-
-		immediate_mesh_storage.instance = _immediate_instance;
-		immediate_mesh_storage.material = mat;
-		immediate_mesh_storage.mesh = _array_mesh;
-	}
+	// The RenderingServer objects are created on the first use of each storage, so the empty worlds do not have any of them
+	immediate_mesh_storage.owner = this;
+	immediate_mesh_storage.material = owner->get_material_variant(MeshMaterialType::Wireframe, no_depth_test ? MeshMaterialVariant::NoDepth : MeshMaterialVariant::Normal);
 
-	// Generate geometry and create MMI's in RenderingServer
-	{
-		auto *meshes = owner->get_shared_meshes();
-		int mat_variant = !!no_depth_test;
-
-		CreateMMI(InstanceType::CUBE, meshes[(int)InstanceType::CUBE][mat_variant]);
-		CreateMMI(InstanceType::CUBE_CENTERED, meshes[(int)InstanceType::CUBE_CENTERED][mat_variant]);
-		CreateMMI(InstanceType::ARROWHEAD, meshes[(int)InstanceType::ARROWHEAD][mat_variant]);
-		CreateMMI(InstanceType::POSITION, meshes[(int)InstanceType::POSITION][mat_variant]);
-		CreateMMI(InstanceType::SPHERE, meshes[(int)InstanceType::SPHERE][mat_variant]);
-		CreateMMI(InstanceType::SPHERE_HD, meshes[(int)InstanceType::SPHERE_HD][mat_variant]);
-		CreateMMI(InstanceType::CYLINDER, meshes[(int)InstanceType::CYLINDER][mat_variant]);
-		CreateMMI(InstanceType::CAPSULE_CAP, meshes[(int)InstanceType::CAPSULE_CAP][mat_variant]);
-		CreateMMI(InstanceType::CAPSULE_EDGES, meshes[(int)InstanceType::CAPSULE_EDGES][mat_variant]);
-
-		// VOLUMETRIC
-
-		CreateMMI(InstanceType::LINE_VOLUMETRIC, meshes[(int)InstanceType::LINE_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::CUBE_VOLUMETRIC, meshes[(int)InstanceType::CUBE_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::CUBE_CENTERED_VOLUMETRIC, meshes[(int)InstanceType::CUBE_CENTERED_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::ARROWHEAD_VOLUMETRIC, meshes[(int)InstanceType::ARROWHEAD_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::POSITION_VOLUMETRIC, meshes[(int)InstanceType::POSITION_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::SPHERE_VOLUMETRIC, meshes[(int)InstanceType::SPHERE_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::SPHERE_HD_VOLUMETRIC, meshes[(int)InstanceType::SPHERE_HD_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::CYLINDER_VOLUMETRIC, meshes[(int)InstanceType::CYLINDER_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::CAPSULE_CAP_VOLUMETRIC, meshes[(int)InstanceType::CAPSULE_CAP_VOLUMETRIC][mat_variant]);
-		CreateMMI(InstanceType::CAPSULE_EDGES_VOLUMETRIC, meshes[(int)InstanceType::CAPSULE_EDGES_VOLUMETRIC][mat_variant]);
-
-		// SOLID
-
-		CreateMMI(InstanceType::BILLBOARD_SQUARE, meshes[(int)InstanceType::BILLBOARD_SQUARE][mat_variant]);
-		CreateMMI(InstanceType::PLANE, meshes[(int)InstanceType::PLANE][mat_variant]);
-
-		set_render_layer_mask(1);
+	for (int type = 0; type < (int)InstanceType::MAX; type++) {
+		multi_mesh_storage[type].owner = this;
+		multi_mesh_storage[type].type = (InstanceType)type;
 	}
 }
 
@@ -93,29 +48,307 @@ bool DebugGeometryContainer::is_no_depth_test() const {
 	return no_depth_test;
 }
 
-void DebugGeometryContainer::CreateMMI(InstanceType p_type, const GeometryGenerator::GeneratedMeshData &p_mesh_data) {
+RID DebugGeometryContainer::create_render_instance(const RID &p_base) {
+	ZoneScoped;
+	RenderingServer *rs = RenderingServer::get_singleton();
+
+	RID instance = rs->instance_create();
+	rs->instance_set_base(instance, p_base);
+
+	rs->instance_geometry_set_cast_shadows_setting(instance, RenderingServer::SHADOW_CASTING_SETTING_OFF);
+	rs->instance_geometry_set_flag(instance, RenderingServer::INSTANCE_FLAG_USE_DYNAMIC_GI, false);
+	rs->instance_geometry_set_flag(instance, RenderingServer::INSTANCE_FLAG_USE_BAKED_LIGHT, false);
+	rs->instance_set_layer_mask(instance, render_layers);
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	rs->instance_set_transform(instance, Transform3D(Basis(), center_position));
+#endif
+
+	if (viewport_world.is_valid()) {
+		rs->instance_set_scenario(instance, viewport_world->get_scenario());
+	}
+	return instance;
+}
+
+void DebugGeometryContainer::_update_render_instances(double p_delta) {
+	ZoneScoped;
+	const MeshMaterialVariant mat_variant = no_depth_test ? MeshMaterialVariant::NoDepth : MeshMaterialVariant::Normal;
+	const double release_delay = owner->get_config()->get_geometry_release_delay();
+
+	for (auto &s : multi_mesh_storage) {
+		if (!s.is_created()) {
+			continue;
+		}
+
+		if (s.visible_count) {
+			s.idle_time = 0;
+			if (s.mesh.is_null()) {
+				s.set_mesh(owner->get_shared_mesh(s.type, mat_variant));
+			}
+		} else {
+			s.idle_time += p_delta;
+			if (release_delay > 0 && s.idle_time >= release_delay) {
+				s.release();
+			}
+		}
+	}
+
+	if (immediate_mesh_storage.is_created()) {
+		if (immediate_mesh_storage.used_vertexes) {
+			immediate_mesh_storage.idle_time = 0;
+		} else {
+			immediate_mesh_storage.idle_time += p_delta;
+			if (release_delay > 0 && immediate_mesh_storage.idle_time >= release_delay) {
+				immediate_mesh_storage.release();
+			}
+		}
+	}
+}
+
+void DebugGeometryContainer::reset_meshes() {
+	ZoneScoped;
+	for (auto &s : multi_mesh_storage) {
+		s.set_mesh(Ref<ArrayMesh>());
+	}
+
+	// the materials could have been reloaded
+	immediate_mesh_storage.material = owner->get_material_variant(MeshMaterialType::Wireframe, no_depth_test ? MeshMaterialVariant::NoDepth : MeshMaterialVariant::Normal);
+	if (immediate_mesh_storage.is_created()) {
+		RenderingServer::get_singleton()->instance_geometry_set_material_override(immediate_mesh_storage.instance, immediate_mesh_storage.material->get_rid());
+	}
+}
+
+void ImmediateMeshStorage::create() {
+	ZoneScoped;
+	mesh.instantiate();
+	instance = owner->create_render_instance(mesh->get_rid());
+	RenderingServer::get_singleton()->instance_geometry_set_material_override(instance, material->get_rid());
+	idle_time = 0;
+}
+
+void ImmediateMeshStorage::release() {
+	if (!is_created()) {
+		return;
+	}
+
+	clear();
+	RenderingServer::get_singleton()->free_rid(instance);
+	instance = RID();
+	mesh.unref();
+	custom_aabb = AABB();
+	idle_time = 0;
+}
+
+void ImmediateMeshStorage::begin(const int64_t &p_count) {
+	ZoneScoped;
+	if (p_count && !is_created()) {
+		create();
+	}
+
+	if (!vertex_stride) {
+		RenderingServer *rs = RenderingServer::get_singleton();
+		const int64_t format = RenderingServer::ARRAY_FORMAT_VERTEX | RenderingServer::ARRAY_FORMAT_COLOR;
+		vertex_stride = rs->mesh_surface_get_format_vertex_stride(format, 1);
+		attribute_stride = rs->mesh_surface_get_format_attribute_stride(format, 1);
+		color_offset = rs->mesh_surface_get_format_offset(format, 1, RenderingServer::ARRAY_COLOR);
+	}
+
+	// The capacity is doubled when growing and is reduced only if less than a quarter of it is required
+	int64_t new_capacity = capacity;
+	if (p_count > capacity) {
+		new_capacity = std::max(std::max(p_count, capacity * 2), MIN_CAPACITY);
+	} else if (p_count < capacity / 4) {
+		new_capacity = p_count ? std::max(p_count * 2, MIN_CAPACITY) : 0;
+	}
+	// lines require an even number of vertices
+	new_capacity += new_capacity % 2;
+
+	prev_used_vertexes = used_vertexes;
+	used_vertexes = p_count;
+
+	if (new_capacity != capacity) {
+		ZoneScopedN("Resize buffers");
+		ZoneValue(new_capacity);
+		capacity = new_capacity;
+		is_surface_recreated = true;
+		vertex_data.assign(capacity * vertex_stride, 0);
+		attribute_data.assign(capacity * attribute_stride, 0);
+		// the whole surface will be uploaded
+		changed_chunks.assign((capacity + CHUNK_SIZE - 1) / CHUNK_SIZE, CHUNK_VERTEX_CHANGED | CHUNK_ATTRIBUTE_CHANGED);
+	} else if (prev_used_vertexes > used_vertexes) {
+		// the vertices that are no longer used become degenerate lines
+		memset(vertex_data.data() + used_vertexes * vertex_stride, 0, (prev_used_vertexes - used_vertexes) * vertex_stride);
+		memset(attribute_data.data() + used_vertexes * attribute_stride, 0, (prev_used_vertexes - used_vertexes) * attribute_stride);
+		for (int64_t c = used_vertexes / CHUNK_SIZE; c <= (prev_used_vertexes - 1) / CHUNK_SIZE; c++) {
+			changed_chunks[c] |= CHUNK_VERTEX_CHANGED | CHUNK_ATTRIBUTE_CHANGED;
+		}
+	}
+}
+
+void ImmediateMeshStorage::commit(const AABB &p_aabb) {
+	ZoneScoped;
+	if (!capacity) {
+		clear();
+		return;
+	}
+
+	if (is_surface_recreated) {
+		ZoneScopedN("Create surface");
+		is_surface_recreated = false;
+
+		PackedVector3Array vertexes;
+		PackedColorArray colors;
+		vertexes.resize(capacity);
+		colors.resize(capacity);
+
+		Array arrays = Array();
+		arrays.resize(ArrayMesh::ArrayType::ARRAY_MAX);
+		arrays[ArrayMesh::ArrayType::ARRAY_VERTEX] = vertexes;
+		arrays[ArrayMesh::ArrayType::ARRAY_COLOR] = colors;
+
+		mesh->clear_surfaces();
+		mesh->add_surface_from_arrays(Mesh::PrimitiveType::PRIMITIVE_LINES, arrays);
+	}
+
+	// Consecutive changed chunks are uploaded by one call
+	auto upload_changed_chunks = [this](const std::vector<uint8_t> &p_data, const int64_t &p_stride, const uint8_t &p_flag) {
+		const int64_t chunks_count = (int64_t)changed_chunks.size();
+		int64_t first = -1;
+		for (int64_t c = 0; c <= chunks_count; c++) {
+			const bool is_changed = c < chunks_count && (changed_chunks[c] & p_flag);
+			if (is_changed && first < 0) {
+				first = c;
+			}
+
+			if (!is_changed && first >= 0) {
+				ZoneScopedN("Update region");
+				const int64_t region_start = first * CHUNK_SIZE * p_stride;
+				const int64_t region_size = std::min(c * CHUNK_SIZE, capacity) * p_stride - region_start;
+				ZoneValue(region_size);
+
+				upload_buffer.resize(region_size);
+				memcpy(upload_buffer.ptrw(), p_data.data() + region_start, region_size);
+				if (p_flag == CHUNK_ATTRIBUTE_CHANGED) {
+					mesh->surface_update_attribute_region(0, (int32_t)region_start, upload_buffer);
+				} else {
+					mesh->surface_update_vertex_region(0, (int32_t)region_start, upload_buffer);
+				}
+				first = -1;
+			}
+		}
+	};
+
+	upload_changed_chunks(vertex_data, vertex_stride, CHUNK_VERTEX_CHANGED);
+	upload_changed_chunks(attribute_data, attribute_stride, CHUNK_ATTRIBUTE_CHANGED);
+	std::fill(changed_chunks.begin(), changed_chunks.end(), 0);
+
+	// The surface is larger than the lines, so its own AABB cannot be used
+	if (custom_aabb != p_aabb) {
+		mesh->set_custom_aabb(p_aabb);
+		custom_aabb = p_aabb;
+	}
+}
+
+void ImmediateMeshStorage::clear() {
+	if (mesh.is_valid() && mesh->get_surface_count()) {
+		mesh->clear_surfaces();
+	}
+
+	capacity = 0;
+	used_vertexes = 0;
+	prev_used_vertexes = 0;
+	is_surface_recreated = false;
+	vertex_data.clear();
+	attribute_data.clear();
+	changed_chunks.clear();
+}
+
+void MultiMeshStorage::create() {
 	ZoneScoped;
+	// The data is allocated on the first update, and the mesh is assigned after it
+	multimesh = RenderingServer::get_singleton()->multimesh_create();
+	instance = owner->create_render_instance(multimesh);
+	idle_time = 0;
+}
+
+void MultiMeshStorage::release() {
+	if (!is_created()) {
+		return;
+	}
+
 	RenderingServer *rs = RenderingServer::get_singleton();
+	rs->free_rid(instance);
+	rs->free_rid(multimesh);
+	instance = RID();
+	multimesh = RID();
+	mesh.unref();
+	capacity = 0;
+	visible_count = 0;
+	custom_aabb = AABB();
+	idle_time = 0;
+}
 
-	RID mmi = rs->instance_create();
+void MultiMeshStorage::set_mesh(const Ref<ArrayMesh> &p_mesh) {
+	if (mesh == p_mesh || !is_created()) {
+		return;
+	}
 
-	Ref<MultiMesh> new_mm;
-	new_mm.instantiate();
-	new_mm->set_name(String::num_int64((int)p_type));
+	mesh = p_mesh;
+	RenderingServer::get_singleton()->multimesh_set_mesh(multimesh, mesh.is_valid() ? mesh->get_rid() : RID());
+}
 
-	new_mm->set_use_colors(true);
-	new_mm->set_transform_format(MultiMesh::TRANSFORM_3D);
-	new_mm->set_use_custom_data(true);
-	new_mm->set_mesh(p_mesh_data.mesh);
+void MultiMeshStorage::update(const PackedFloat32Array &p_buffer, const int32_t &p_visible_count, const AABB &p_custom_aabb) {
+	ZoneScoped;
+	if (!is_created()) {
+		if (p_visible_count == 0) {
+			return;
+		}
+		create();
+	}
 
-	rs->instance_set_base(mmi, new_mm->get_rid());
+	RenderingServer *rs = RenderingServer::get_singleton();
+	int32_t new_capacity = (int32_t)(p_buffer.size() / GeometryPool::get_instance_data_float_count(type));
+	if (new_capacity != capacity) {
+		ZoneScopedN("Changing amount of instances");
+		ZoneValue(new_capacity);
+		rs->multimesh_allocate_data(multimesh, new_capacity, RenderingServer::MULTIMESH_TRANSFORM_3D, true, is_instance_custom_data_used(type));
+		capacity = new_capacity;
+		// all instances are visible after the allocation
+		visible_count = -1;
+	}
+
+	set_visible_count(p_visible_count);
+
+	if (p_visible_count == 0) {
+		return;
+	}
+
+	if (custom_aabb != p_custom_aabb) {
+		rs->multimesh_set_custom_aabb(multimesh, p_custom_aabb);
+		custom_aabb = p_custom_aabb;
+	}
+
+	{
+		ZoneScopedN("Set buffer");
+		rs->multimesh_set_buffer(multimesh, p_buffer);
+	}
+}
 
-	rs->instance_geometry_set_cast_shadows_setting(mmi, RenderingServer::SHADOW_CASTING_SETTING_OFF);
-	rs->instance_geometry_set_flag(mmi, RenderingServer::INSTANCE_FLAG_USE_DYNAMIC_GI, false);
-	rs->instance_geometry_set_flag(mmi, RenderingServer::INSTANCE_FLAG_USE_BAKED_LIGHT, false);
+void MultiMeshStorage::set_visible_count(const int32_t &p_visible_count) {
+	if (visible_count != p_visible_count) {
+		ZoneScopedN("Set visible instances");
+		ZoneValue(p_visible_count);
+		RenderingServer::get_singleton()->multimesh_set_visible_instances(multimesh, p_visible_count);
+		visible_count = p_visible_count;
+	}
+}
 
-	multi_mesh_storage[(int)p_type].instance = mmi;
-	multi_mesh_storage[(int)p_type].mesh = new_mm;
+void MultiMeshStorage::clear() {
+	if (capacity) {
+		RenderingServer::get_singleton()->multimesh_allocate_data(multimesh, 0, RenderingServer::MULTIMESH_TRANSFORM_3D, true, true);
+		capacity = 0;
+	}
+	visible_count = 0;
+	custom_aabb = AABB();
 }
 
 void DebugGeometryContainer::set_world(Ref<World3D> p_new_world) {
@@ -130,16 +363,24 @@ void DebugGeometryContainer::set_world(Ref<World3D> p_new_world) {
 	RID scenario = viewport_world.is_valid() ? viewport_world->get_scenario() : RID();
 
 	for (auto &s : multi_mesh_storage) {
-		rs->instance_set_scenario(s.instance, scenario);
+		if (s.is_created()) {
+			rs->instance_set_scenario(s.instance, scenario);
+		}
 	}
 
-	rs->instance_set_scenario(immediate_mesh_storage.instance, scenario);
+	if (immediate_mesh_storage.is_created()) {
+		rs->instance_set_scenario(immediate_mesh_storage.instance, scenario);
+	}
 }
 
 Ref<World3D> DebugGeometryContainer::get_world() {
 	return viewport_world;
 }
 
+const std::vector<WorldCamera> &DebugGeometryContainer::get_world_cameras() const {
+	return world_cameras;
+}
+
 #if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
 const Vector3 &DebugGeometryContainer::get_center_position() {
 	return center_position;
@@ -149,34 +390,23 @@ void DebugGeometryContainer::update_center_positions() {
 	if (center_position.distance_to(new_center_position) < 8192)
 		return;
 
-	DEV_PRINT_STD(NAMEOF(DebugGeometryContainer) " Updated instance positions: %s, World3D (%" PRIu64 ")\n", no_depth_test ? "NoDepth" : "Normal", viewport_world.is_valid() ? viewport_world->get_instance_id() : 0);
+	DEV_PRINT_STD(NAMEOF(DebugGeometryContainer) " Updated center position: %s, World3D (%" PRIu64 ")\n", no_depth_test ? "NoDepth" : "Normal", viewport_world.is_valid() ? viewport_world->get_instance_id() : 0);
 
-	Vector3 pos_diff = center_position - new_center_position;
+	// Objects are stored relative to their position cells, so only the offsets of the cells are updated during the next fill
 	center_position = new_center_position;
-
-	geometry_pool.for_each_instance([&pos_diff](DelayedRendererInstance *i) {
-		if (!i->is_expired()) {
-			i->data.origin_x += (float)pos_diff.x;
-			i->data.origin_y += (float)pos_diff.y;
-			i->data.origin_z += (float)pos_diff.z;
-		}
-	});
-
-	geometry_pool.for_each_line([&pos_diff](DelayedRendererLine *i) {
-		if (!i->is_expired()) {
-			for (size_t l = 0; l < i->lines_count; l++) {
-				i->lines.get()[l] += pos_diff;
-			}
-		}
-	});
+	geometry_pool.mark_all_dirty();
 
 	RenderingServer *rs = RenderingServer::get_singleton();
 	Transform3D xf = Transform3D(Basis(), center_position);
 	for (auto &s : multi_mesh_storage) {
-		rs->instance_set_transform(s.instance, xf);
+		if (s.is_created()) {
+			rs->instance_set_transform(s.instance, xf);
+		}
 	}
 
-	rs->instance_set_transform(immediate_mesh_storage.instance, xf);
+	if (immediate_mesh_storage.is_created()) {
+		rs->instance_set_transform(immediate_mesh_storage.instance, xf);
+	}
 }
 #endif
 
@@ -194,20 +424,17 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 	if (owner->get_config()->is_freeze_3d_render())
 		return;
 
-	if (immediate_mesh_storage.mesh->get_surface_count()) {
-		ZoneScopedN("Clear lines");
-		immediate_mesh_storage.mesh->clear_surfaces();
-	}
-
 	// Return if nothing to do
 	if (!owner->is_debug_enabled()) {
 		ZoneScopedN("Reset instances");
 		for (auto &item : multi_mesh_storage) {
-			if (item.mesh->get_visible_instance_count())
-				item.mesh->set_visible_instance_count(0);
+			item.set_visible_count(0);
 		}
+		immediate_mesh_storage.clear();
 		geometry_pool.reset_counter(p_delta);
 		geometry_pool.reset_visible_objects();
+		// the buffers must be filled again after enabling
+		geometry_pool.mark_all_dirty();
 		return;
 	}
 
@@ -220,25 +447,47 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 #define FIX_DOUBLE_PRECISION_ERRORS
 #endif
 
-	std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> culling_data;
+	GeometryPoolLODSettings lod_settings;
+	lod_settings.min_screen_size = (float)owner->get_config()->get_culling_min_screen_size();
+	lod_settings.hd_sphere_distance = (float)owner->get_config()->get_lod_hd_sphere_distance();
+	lod_settings.volumetric_distance = (float)owner->get_config()->get_lod_volumetric_distance();
+
+	// All viewports of the World3D show the same meshes, so the objects of all viewports are culled in one pass by all of their cameras
+	std::shared_ptr<GeometryPoolCullingData> culling_data;
 	{
 		ZoneScopedN("Get frustums");
 
-		for (const auto &vp_p : available_viewports) {
-			std::vector<std::array<Plane, 6>> frustum_planes;
-			std::vector<AABBMinMax> frustum_boxes;
+		std::vector<std::array<Plane, 6>> frustum_planes;
+		std::vector<AABBMinMax> frustum_boxes;
 
-			std::vector<std::pair<Array, Camera3D *>> frustum_arrays;
-			frustum_arrays.reserve(1);
+		// Cameras can be used by several viewports, but their frustums are added only once
+		std::vector<std::pair<Array, Camera3D *>> frustum_arrays;
+		std::unordered_set<Camera3D *> used_cameras;
+		auto add_camera = [&frustum_arrays, &used_cameras](Camera3D *p_cam) {
+			if (used_cameras.insert(p_cam).second) {
+				frustum_arrays.push_back({ p_cam->get_frustum(), p_cam });
+			}
+		};
 
 #ifdef DEBUG_ENABLED
-			auto custom_editor_viewports = owner->get_custom_editor_viewports();
+		auto custom_editor_viewports = owner->get_custom_editor_viewports();
+		bool is_editor_cameras_added = false;
+#endif
+
+		for (const auto &vp_p : available_viewports) {
+#ifdef DEBUG_ENABLED
 			bool is_editor_vp = std::find_if(
 										custom_editor_viewports.cbegin(),
 										custom_editor_viewports.cend(),
 										[&vp_p](const auto &it) { return it == vp_p; }) != custom_editor_viewports.cend();
 
 			if (IS_EDITOR_HINT() && is_editor_vp) {
+				// The cameras are the same for all editor viewports
+				if (is_editor_cameras_added) {
+					continue;
+				}
+				is_editor_cameras_added = true;
+
 				Camera3D *cam = nullptr;
 				Node *root = SCENE_TREE()->get_edited_scene_root();
 				if (root) {
@@ -246,7 +495,7 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 				}
 
 				if (owner->config->is_force_use_camera_from_scene() && cam) {
-					frustum_arrays.push_back({ cam->get_frustum(), cam });
+					add_camera(cam);
 
 #ifdef FIX_DOUBLE_PRECISION_ERRORS
 					new_center_position = cam->get_global_position();
@@ -257,7 +506,7 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 						if (evp->get_update_mode() == SubViewport::UpdateMode::UPDATE_ALWAYS) {
 							Camera3D *vp_cam = evp->get_camera_3d();
 							if (vp_cam) {
-								frustum_arrays.push_back({ vp_cam->get_frustum(), vp_cam });
+								add_camera(vp_cam);
 
 								if (!is_updated) {
 									is_updated = true;
@@ -273,7 +522,7 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 #endif
 				Camera3D *vp_cam = vp_p->get_camera_3d();
 				if (vp_cam) {
-					frustum_arrays.push_back({ vp_cam->get_frustum(), vp_cam });
+					add_camera(vp_cam);
 
 #ifdef FIX_DOUBLE_PRECISION_ERRORS
 					new_center_position = vp_cam->get_global_position();
@@ -282,42 +531,75 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 #ifdef DEBUG_ENABLED
 			}
 #endif
+		}
 
-			if (owner->get_config()->get_frustum_culling_mode() != DebugDraw3DConfig::CullingMode::FRUSTUM_DISABLED) {
-				// Convert Array to vector
-				if (frustum_arrays.size()) {
-					for (auto &pair : frustum_arrays) {
-						Array &arr = pair.first;
-						if (arr.size() == 6) {
-							std::array<Plane, 6> a;
-							for (int i = 0; i < arr.size(); i++)
-								a[i] = (Plane)arr[i];
+		std::vector<CullingCamera> cameras;
+		cameras.reserve(frustum_arrays.size());
+		world_cameras.clear();
+		for (auto &pair : frustum_arrays) {
+			Camera3D *cam = pair.second;
+
+			// The size of the projection in pixels
+			Vector2 vp_size = cam->get_viewport()->get_visible_rect().size;
+			real_t screen_size = cam->get_keep_aspect_mode() == Camera3D::KEEP_WIDTH ? vp_size.x : vp_size.y;
+
+			CullingCamera c;
+			Vector3 pos = cam->get_global_position();
+			c.x = (culling_real_t)pos.x;
+			c.y = (culling_real_t)pos.y;
+			c.z = (culling_real_t)pos.z;
+			c.is_orthogonal = cam->get_projection() == Camera3D::PROJECTION_ORTHOGONAL;
+			if (c.is_orthogonal) {
+				c.pixels_per_unit = (float)(screen_size / Math::max(cam->get_size(), (real_t)0.001));
+			} else {
+				c.pixels_per_unit = (float)(screen_size / (2 * Math::tan(Math::deg_to_rad(cam->get_fov()) * 0.5)));
+			}
+			cameras.push_back(c);
+
+			WorldCamera wc;
+			wc.position = pos;
+			wc.orthogonal_half_height = 0;
+			if (c.is_orthogonal) {
+				// `size` is the width of the view for `KEEP_WIDTH`
+				wc.orthogonal_half_height = cam->get_size() * 0.5f * (cam->get_keep_aspect_mode() == Camera3D::KEEP_WIDTH && vp_size.x > 0 ? vp_size.y / vp_size.x : 1);
+			}
+			world_cameras.push_back(wc);
+		}
+
+		if (owner->get_config()->get_frustum_culling_mode() != DebugDraw3DConfig::CullingMode::FRUSTUM_DISABLED) {
+			// Convert Array to vector
+			if (frustum_arrays.size()) {
+				for (auto &pair : frustum_arrays) {
+					Array &arr = pair.first;
+					if (arr.size() == 6) {
+						std::array<Plane, 6> a;
+						for (int i = 0; i < arr.size(); i++)
+							a[i] = (Plane)arr[i];
 
-							MathUtils::scale_frustum_far_plane_distance(a, pair.second->get_global_transform(), owner->get_config()->get_frustum_length_scale());
+						MathUtils::scale_frustum_far_plane_distance(a, pair.second->get_global_transform(), owner->get_config()->get_frustum_length_scale());
 
-							if (owner->get_config()->get_frustum_culling_mode() == DebugDraw3DConfig::CullingMode::FRUSTUM_PRECISE)
-								frustum_planes.push_back(a);
+						if (owner->get_config()->get_frustum_culling_mode() == DebugDraw3DConfig::CullingMode::FRUSTUM_PRECISE)
+							frustum_planes.push_back(a);
 
-							auto cube = MathUtils::get_frustum_cube(a);
-							AABB aabb = MathUtils::calculate_vertex_bounds(cube.data(), cube.size());
-							frustum_boxes.push_back(aabb);
+						auto cube = MathUtils::get_frustum_cube(a);
+						AABB aabb = MathUtils::calculate_vertex_bounds(cube.data(), cube.size());
+						frustum_boxes.push_back(aabb);
 
 #if false
-							// Debug camera bounds
-							{
-								SphereBounds sb = aabb;
-								auto cfg = owner->new_scoped_config()->set_thickness(0.1f)->set_hd_sphere(true); //->set_viewport(vp_p);
-								owner->draw_sphere(sb.position, sb.radius, Colors::crimson);
-								owner->draw_aabb(aabb, Colors::yellow);
-							}
-#endif
+						// Debug camera bounds
+						{
+							SphereBounds sb = aabb;
+							auto cfg = owner->new_scoped_config()->set_thickness(0.1f)->set_hd_sphere(true); //->set_viewport(vp_p);
+							owner->draw_sphere(sb.position, sb.radius, Colors::crimson);
+							owner->draw_aabb(aabb, Colors::yellow);
 						}
+#endif
 					}
 				}
 			}
-
-			culling_data[vp_p] = std::make_shared<GeometryPoolCullingData>(frustum_planes, frustum_boxes);
 		}
+
+		culling_data = std::make_shared<GeometryPoolCullingData>(frustum_planes, frustum_boxes, cameras, lod_settings);
 	}
 
 #ifdef FIX_DOUBLE_PRECISION_ERRORS
@@ -341,20 +623,20 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 			auto cfg = std::make_unique<DebugDraw3DScopeConfig::Data>(owner->scoped_config()->data.get());
 			cfg->thickness = 0;
 
-			std::vector<AABBMinMax> new_instances;
-			geometry_pool.for_each_instance([&new_instances](DelayedRendererInstance *o) {
-				if (!o->is_visible || o->is_expired())
+			std::vector<CullingSphere> new_instances;
+			geometry_pool.for_each_instance([&new_instances](const DelayedRendererState &s, const CullingSphere &b, GeometryPoolData3DInstance &) {
+				if (!s.is_visible || s.is_expired())
 					return;
-				new_instances.push_back(o->bounds);
+				new_instances.push_back(b);
 			});
 
 			// Draw custom sphere for 1 frame
 			for (auto &i : new_instances) {
 				cfg->dcd.viewport = vp;
 				cfg->dcd.viewport_id = vp_id;
-				Vector3 diag = i.max - i.min;
-				Vector3 center = i.center;
+				Vector3 center = i.get_center();
 				real_t radius = i.radius;
+				Vector3 diag = VEC3_ONE(radius) * 2;
 
 				geometry_pool.add_or_update_instance(
 						cfg.get(),
@@ -401,31 +683,30 @@ void DebugGeometryContainer::update_geometry(double p_delta) {
 						SphereBounds(center, radius));
 			});
 
-			for (const auto &culling_data : culling_data) {
-				for (const auto &frustum : culling_data.second->m_frustums) {
-					thread_local static Vector3 lines[GeometryGenerator::CubeIndexes.size()];
-					GeometryGenerator::CreateCameraFrustumLinesWireframe(frustum, lines);
-
-					auto bounds = MathUtils::calculate_vertex_bounds(lines, GeometryGenerator::CubeIndexes.size());
-					geometry_pool.add_or_update_line(
-							cfg.get(),
-							0,
-							lines,
-							GeometryGenerator::CubeIndexes.size(),
-							Colors::red,
-							bounds);
-				}
+			for (const auto &frustum : culling_data->m_frustums) {
+				thread_local static Vector3 lines[GeometryGenerator::CubeIndexes.size()];
+				GeometryGenerator::CreateCameraFrustumLinesWireframe(frustum, lines);
+
+				auto bounds = MathUtils::calculate_vertex_bounds(lines, GeometryGenerator::CubeIndexes.size());
+				geometry_pool.add_or_update_line(
+						cfg.get(),
+						0,
+						lines,
+						GeometryGenerator::CubeIndexes.size(),
+						Colors::red,
+						bounds);
 			}
 		}
 	}
 
-	std::vector<Ref<MultiMesh> *> meshes((int)InstanceType::MAX);
+	std::vector<MultiMeshStorage *> meshes((int)InstanceType::MAX);
 	for (int i = 0; i < (int)InstanceType::MAX; i++) {
-		meshes[i] = &multi_mesh_storage[i].mesh;
+		meshes[i] = &multi_mesh_storage[i];
 	}
 
 	geometry_pool.reset_visible_objects();
-	geometry_pool.fill_mesh_data(meshes, immediate_mesh_storage.mesh, culling_data);
+	geometry_pool.fill_mesh_data(meshes, &immediate_mesh_storage, culling_data);
+	_update_render_instances(p_delta);
 
 	geometry_pool.reset_counter(p_delta, ProcessType::PROCESS);
 
@@ -454,10 +735,13 @@ void DebugGeometryContainer::set_render_layer_mask(int32_t p_layers) {
 	LOCK_GUARD(owner->datalock);
 	if (render_layers != p_layers) {
 		RenderingServer *rs = RenderingServer::get_singleton();
-		for (auto &mmi : multi_mesh_storage)
-			rs->instance_set_layer_mask(mmi.instance, p_layers);
+		for (auto &mmi : multi_mesh_storage) {
+			if (mmi.is_created())
+				rs->instance_set_layer_mask(mmi.instance, p_layers);
+		}
 
-		rs->instance_set_layer_mask(immediate_mesh_storage.instance, p_layers);
+		if (immediate_mesh_storage.is_created())
+			rs->instance_set_layer_mask(immediate_mesh_storage.instance, p_layers);
 		render_layers = p_layers;
 	}
 }
@@ -470,9 +754,9 @@ void DebugGeometryContainer::clear_3d_objects() {
 	ZoneScoped;
 	LOCK_GUARD(owner->datalock);
 	for (auto &s : multi_mesh_storage) {
-		s.mesh->set_instance_count(0);
+		s.clear();
 	}
-	immediate_mesh_storage.mesh->clear_surfaces();
+	immediate_mesh_storage.clear();
 
 	geometry_pool.clear_pool();
 }
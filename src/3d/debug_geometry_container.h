@@ -4,9 +4,11 @@
 #include "geometry_generators.h"
 #include "render_instances.h"
 
+#include <cstring>
+#include <vector>
+
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/classes/array_mesh.hpp>
-#include <godot_cpp/classes/multi_mesh.hpp>
 #include <godot_cpp/classes/rendering_server.hpp>
 #include <godot_cpp/classes/shader_material.hpp>
 #include <godot_cpp/classes/world3d.hpp>
@@ -14,37 +16,158 @@ GODOT_WARNING_RESTORE()
 using namespace godot;
 
 class DebugDraw3DStats;
+class DebugGeometryContainer;
+
+// A MultiMesh created directly in the RenderingServer.
+// The last sent state is cached, so unchanged and empty MultiMeshes do not generate any commands.
+// The RenderingServer objects are created with the first visible instances and released after being idle for a while.
+struct MultiMeshStorage {
+	DebugGeometryContainer *owner = nullptr;
+	InstanceType type = InstanceType::MAX;
+	RID instance;
+	RID multimesh;
+	Ref<ArrayMesh> mesh;
+	int32_t capacity = 0;
+	int32_t visible_count = 0;
+	AABB custom_aabb;
+	// Time without visible instances
+	double idle_time = 0;
+
+	~MultiMeshStorage() {
+		release();
+	}
+
+	_FORCE_INLINE_ bool is_created() const {
+		return instance.is_valid();
+	}
+
+	void create();
+	void release();
+	// The mesh is assigned after the first instances of the type are drawn
+	void set_mesh(const Ref<ArrayMesh> &p_mesh);
+	// The size of `p_buffer` is the capacity of the MultiMesh
+	void update(const PackedFloat32Array &p_buffer, const int32_t &p_visible_count, const AABB &p_custom_aabb);
+	void set_visible_count(const int32_t &p_visible_count);
+	void clear();
+};
 
-class DebugGeometryContainer {
-	friend class DebugDraw3D;
-	class DebugDraw3D *owner;
-
-	struct MultiMeshStorage {
-		RID instance;
-		Ref<MultiMesh> mesh;
+// A persistent surface of lines with reserved capacity.
+// Vertices are written in the format of the surface, and only the changed chunks are uploaded.
+// Unused vertices at the end of the surface are degenerate lines.
+// The instance and the mesh are created with the first lines and released after being idle for a while.
+struct ImmediateMeshStorage {
+	static constexpr int64_t MIN_CAPACITY = 1024;
+	static constexpr int64_t CHUNK_SIZE = 4096;
+
+	DebugGeometryContainer *owner = nullptr;
+	RID instance;
+	Ref<ArrayMesh> mesh;
+	Ref<ShaderMaterial> material;
+	// Time without visible lines
+	double idle_time = 0;
+
+	int64_t capacity = 0;
+	int64_t used_vertexes = 0;
+	int64_t prev_used_vertexes = 0;
+	bool is_surface_recreated = false;
+	AABB custom_aabb;
+
+	int64_t vertex_stride = 0;
+	int64_t attribute_stride = 0;
+	int64_t color_offset = 0;
+	// The data of the surface. Only the changed bytes are written, so the chunks whose data differs from the uploaded data are marked.
+	enum : uint8_t {
+		CHUNK_VERTEX_CHANGED = 1 << 0,
+		CHUNK_ATTRIBUTE_CHANGED = 1 << 1,
+	};
+	std::vector<uint8_t> vertex_data;
+	std::vector<uint8_t> attribute_data;
+	std::vector<uint8_t> changed_chunks;
+	PackedByteArray upload_buffer;
+
+	~ImmediateMeshStorage() {
+		release();
+		material.unref();
+	}
+
+	_FORCE_INLINE_ bool is_created() const {
+		return instance.is_valid();
+	}
+
+	void create();
+	void release();
+	// Prepares the buffers for `p_count` vertices
+	void begin(const int64_t &p_count);
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// `p_offset` moves the vertices from their position cell to the center
+	_FORCE_INLINE_ void write(const int64_t &p_pos, const LineVertex *p_vertexes, const int64_t &p_count, const Color &p_color, const Vector3Float &p_offset);
+#else
+	_FORCE_INLINE_ void write(const int64_t &p_pos, const LineVertex *p_vertexes, const int64_t &p_count, const Color &p_color);
+#endif
+	// Uploads the changed chunks
+	void commit(const AABB &p_aabb);
+	void clear();
+};
 
-		~MultiMeshStorage() {
-			RenderingServer::get_singleton()->free_rid(instance);
-			mesh.unref();
-		}
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+_FORCE_INLINE_ void ImmediateMeshStorage::write(const int64_t &p_pos, const LineVertex *p_vertexes, const int64_t &p_count, const Color &p_color, const Vector3Float &p_offset) {
+#else
+_FORCE_INLINE_ void ImmediateMeshStorage::write(const int64_t &p_pos, const LineVertex *p_vertexes, const int64_t &p_count, const Color &p_color) {
+#endif
+	// The surface stores colors as RGBA8
+	const uint8_t color[4] = {
+		(uint8_t)CLAMP(p_color.r * 255.0f, 0.0f, 255.0f),
+		(uint8_t)CLAMP(p_color.g * 255.0f, 0.0f, 255.0f),
+		(uint8_t)CLAMP(p_color.b * 255.0f, 0.0f, 255.0f),
+		(uint8_t)CLAMP(p_color.a * 255.0f, 0.0f, 255.0f),
 	};
-	MultiMeshStorage multi_mesh_storage[(int)InstanceType::MAX] = {};
 
-	struct ImmediateMeshStorage {
-		RID instance;
-		Ref<ArrayMesh> mesh;
-		Ref<ShaderMaterial> material;
+	if (p_count <= 0) {
+		return;
+	}
+
+	uint8_t *v = vertex_data.data() + p_pos * vertex_stride;
+	uint8_t *a = attribute_data.data() + p_pos * attribute_stride + color_offset;
+	int64_t chunk = p_pos / CHUNK_SIZE;
+	int64_t chunk_end = (chunk + 1) * CHUNK_SIZE;
+	uint8_t changed = 0;
+	for (int64_t i = 0; i < p_count; i++) {
+		if (p_pos + i == chunk_end) {
+			changed_chunks[chunk] |= changed;
+			changed = 0;
+			chunk++;
+			chunk_end += CHUNK_SIZE;
+		}
 
-		~ImmediateMeshStorage() {
-			RenderingServer::get_singleton()->free_rid(instance);
-			mesh.unref();
-			material.unref();
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		const float pos[3] = { p_vertexes[i].x + p_offset.x, p_vertexes[i].y + p_offset.y, p_vertexes[i].z + p_offset.z };
+#else
+		const float pos[3] = { (float)p_vertexes[i].x, (float)p_vertexes[i].y, (float)p_vertexes[i].z };
+#endif
+		if (memcmp(v, pos, sizeof(pos)) != 0) {
+			memcpy(v, pos, sizeof(pos));
+			changed |= CHUNK_VERTEX_CHANGED;
 		}
-	};
+		if (memcmp(a, color, sizeof(color)) != 0) {
+			memcpy(a, color, sizeof(color));
+			changed |= CHUNK_ATTRIBUTE_CHANGED;
+		}
+		v += vertex_stride;
+		a += attribute_stride;
+	}
+	changed_chunks[chunk] |= changed;
+}
+
+class DebugGeometryContainer {
+	friend class DebugDraw3D;
+	class DebugDraw3D *owner;
+
+	MultiMeshStorage multi_mesh_storage[(int)InstanceType::MAX] = {};
 	ImmediateMeshStorage immediate_mesh_storage;
 
 	GeometryPool geometry_pool;
 	Ref<World3D> viewport_world;
+	std::vector<WorldCamera> world_cameras;
 #if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
 	Vector3 center_position;
 	Vector3 new_center_position;
@@ -54,7 +177,7 @@ class DebugGeometryContainer {
 	bool is_frame_rendered = false;
 	bool no_depth_test = false;
 
-	void CreateMMI(InstanceType p_type, const GeometryGenerator::GeneratedMeshData& p_mesh_data);
+	void _update_render_instances(double p_delta);
 
 public:
 	DebugGeometryContainer(class DebugDraw3D *p_owner, bool p_no_depth_test);
@@ -62,8 +185,13 @@ public:
 
 	bool is_no_depth_test() const;
 
+	// Creates a RenderingServer instance with the current world, layers and position of this container
+	RID create_render_instance(const RID &p_base);
+
 	void set_world(Ref<World3D> p_new_world);
 	Ref<World3D> get_world();
+	// The cameras found during the last update
+	const std::vector<WorldCamera> &get_world_cameras() const;
 
 #if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
 	const Vector3 &get_center_position();
@@ -71,6 +199,8 @@ public:
 #endif
 
 	void update_geometry(double p_delta);
+	// Releases the shared meshes, so the new ones are requested on the next update, and applies the current material of the lines
+	void reset_meshes();
 	void update_geometry_physics_start(double p_delta);
 	void update_geometry_physics_end(double p_delta);
 
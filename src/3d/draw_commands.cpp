@@ -0,0 +1,131 @@
+#include "draw_commands.h"
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "utils/utils.h"
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/classes/engine.hpp>
+GODOT_WARNING_RESTORE()
+
+void DrawCommandBuffer::Commands::clear() {
+	configs.clear();
+	commands.clear();
+	transforms.clear();
+	bounds.clear();
+	colors.clear();
+	vertices.clear();
+}
+
+uint32_t DrawCommandBuffer::_get_config_index(const DebugDraw3DScopeConfig::Data *p_cfg) {
+	// Versions are unique for all configs, so the copy is made only when the config is changed or replaced
+	if (data.configs.empty() || p_cfg->version != last_config_version) {
+		data.configs.push_back(std::make_shared<DebugDraw3DScopeConfig::Data>(p_cfg));
+		last_config_version = p_cfg->version;
+	}
+	return (uint32_t)data.configs.size() - 1;
+}
+
+void DrawCommandBuffer::_add_instances(const DebugDraw3DScopeConfig::Data *p_cfg, CommandType p_type, char p_instance_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col) {
+	ZoneScoped;
+	if (!p_count)
+		return;
+
+	const ProcessType proc = Engine::get_singleton()->is_in_physics_frame() ? ProcessType::PHYSICS_PROCESS : ProcessType::PROCESS;
+
+	std::lock_guard<std::mutex> lock(datalock);
+	if (is_closed)
+		return;
+
+	Command cmd;
+	cmd.type = p_type;
+	cmd.instance_type = p_instance_type;
+	cmd.proc = proc;
+	cmd.has_custom_col = p_custom_col != nullptr;
+	cmd.config = _get_config_index(p_cfg);
+	cmd.exp_time = p_exp_time;
+	cmd.first = data.transforms.size();
+	cmd.count = p_count;
+	cmd.first_color = data.colors.size();
+	cmd.colors_count = p_colors_count;
+	cmd.custom_col = p_custom_col ? *p_custom_col : Color();
+
+	data.transforms.insert(data.transforms.end(), p_transforms, p_transforms + p_count);
+	data.bounds.insert(data.bounds.end(), p_bounds, p_bounds + p_count);
+	data.colors.insert(data.colors.end(), p_colors, p_colors + p_colors_count);
+	data.commands.push_back(cmd);
+}
+
+void DrawCommandBuffer::add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col) {
+	_add_instances(p_cfg, CommandType::CONVERTABLE_INSTANCES, (char)p_type, p_exp_time, 1, &p_transform, &p_bounds, &p_col, 1, p_custom_col);
+}
+
+void DrawCommandBuffer::add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col) {
+	_add_instances(p_cfg, CommandType::INSTANCES, (char)p_type, p_exp_time, 1, &p_transform, &p_bounds, &p_col, 1, p_custom_col);
+}
+
+void DrawCommandBuffer::add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col) {
+	_add_instances(p_cfg, CommandType::CONVERTABLE_INSTANCES, (char)p_type, p_exp_time, p_count, p_transforms, p_bounds, p_colors, p_colors_count, p_custom_col);
+}
+
+void DrawCommandBuffer::add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col) {
+	_add_instances(p_cfg, CommandType::INSTANCES, (char)p_type, p_exp_time, p_count, p_transforms, p_bounds, p_colors, p_colors_count, p_custom_col);
+}
+
+void DrawCommandBuffer::add_or_update_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb) {
+	ZoneScoped;
+	if (!p_line_count)
+		return;
+
+	const ProcessType proc = Engine::get_singleton()->is_in_physics_frame() ? ProcessType::PHYSICS_PROCESS : ProcessType::PROCESS;
+
+	std::lock_guard<std::mutex> lock(datalock);
+	if (is_closed)
+		return;
+
+	Command cmd;
+	cmd.type = CommandType::LINES;
+	cmd.instance_type = 0;
+	cmd.proc = proc;
+	cmd.has_custom_col = false;
+	cmd.config = _get_config_index(p_cfg);
+	cmd.exp_time = p_exp_time;
+	cmd.first = data.vertices.size();
+	cmd.count = p_line_count;
+	cmd.first_color = data.colors.size();
+	cmd.colors_count = 1;
+	cmd.aabb = p_aabb;
+
+	data.vertices.insert(data.vertices.end(), p_lines, p_lines + p_line_count);
+	data.colors.push_back(p_col);
+	data.commands.push_back(cmd);
+}
+
+bool DrawCommandBuffer::is_empty() {
+	std::lock_guard<std::mutex> lock(datalock);
+	return data.is_empty();
+}
+
+void DrawCommandBuffer::take_commands(Commands &r_commands) {
+	ZoneScoped;
+	std::lock_guard<std::mutex> lock(datalock);
+	std::swap(data, r_commands);
+	// The next command must copy its config to the new list
+	last_config_version = 0;
+}
+
+void DrawCommandBuffer::clear() {
+	std::lock_guard<std::mutex> lock(datalock);
+	data.clear();
+	last_config_version = 0;
+}
+
+void DrawCommandBuffer::close() {
+	std::lock_guard<std::mutex> lock(datalock);
+	// `clear` keeps the capacity of the vectors
+	data = Commands();
+	last_config_version = 0;
+	is_closed = true;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "config_scope_3d.h"
+#include "render_instances_enums.h"
+#include "utils/math_utils.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Draw calls of one thread recorded until the end of the frame, when they are merged into the geometry pools.
+// Only the owner thread records the commands, so the lock of the buffer is contended only while the commands are taken for the merge.
+class DrawCommandBuffer {
+public:
+	enum class CommandType : char {
+		INSTANCES,
+		CONVERTABLE_INSTANCES,
+		LINES,
+	};
+
+	struct Command {
+		CommandType type;
+		// `InstanceType` or `ConvertableInstanceType`
+		char instance_type;
+		ProcessType proc;
+		bool has_custom_col;
+		// Index in `Commands::configs`
+		uint32_t config;
+		real_t exp_time;
+		// The range in `transforms` and `bounds`, or in `vertices` for lines
+		size_t first;
+		size_t count;
+		// The range in `colors`. It can contain only one color for all instances.
+		size_t first_color;
+		size_t colors_count;
+		Color custom_col;
+		AABB aabb;
+	};
+
+	struct Commands {
+		// Copies of the scoped configs at the time of the draw calls
+		std::vector<std::shared_ptr<const DebugDraw3DScopeConfig::Data>> configs;
+		std::vector<Command> commands;
+		std::vector<Transform3D> transforms;
+		std::vector<SphereBounds> bounds;
+		std::vector<Color> colors;
+		std::vector<Vector3> vertices;
+
+		_FORCE_INLINE_ bool is_empty() const {
+			return commands.empty();
+		}
+
+		void clear();
+	};
+
+private:
+	std::mutex datalock;
+	Commands data;
+	// The version of the config copied last, so its copy is reused by the following commands
+	uint64_t last_config_version = 0;
+	// Set when the owner of the buffers is destroyed, but the threads still own the buffer
+	bool is_closed = false;
+
+	uint32_t _get_config_index(const DebugDraw3DScopeConfig::Data *p_cfg);
+	void _add_instances(const DebugDraw3DScopeConfig::Data *p_cfg, CommandType p_type, char p_instance_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col);
+
+public:
+	// Same as in `GeometryPool`
+	void add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col = nullptr);
+	void add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col = nullptr);
+	void add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col = nullptr);
+	void add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col = nullptr);
+	void add_or_update_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb);
+
+	bool is_empty();
+	// Exchanges the recorded commands with `r_commands`, which must be cleared, so the buffers of both are reused
+	void take_commands(Commands &r_commands);
+	void clear();
+	// Releases the commands and their configs and ignores the following commands
+	void close();
+};
+
+#endif
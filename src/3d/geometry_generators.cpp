@@ -142,6 +142,20 @@ const std::array<int, 6> GeometryGenerator::SquareIndexes{
 	0, 3
 };
 
+const std::array<Vector3, 4> GeometryGenerator::GlyphQuadVertexes{
+	Vector3(1, 1, 0),
+	Vector3(1, 0, 0),
+	Vector3(0, 0, 0),
+	Vector3(0, 1, 0),
+};
+
+const std::array<Vector2, 4> GeometryGenerator::GlyphQuadUV{
+	Vector2(1, 0),
+	Vector2(1, 1),
+	Vector2(0, 1),
+	Vector2(0, 0),
+};
+
 const std::array<Vector3, 6> GeometryGenerator::PositionVertexes{
 	Vector3(0.5f, 0, 0),
 	Vector3(-0.5f, 0, 0),
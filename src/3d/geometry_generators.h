@@ -47,6 +47,10 @@ public:
 	const static std::array<int, 6> SquareBackwardsIndexes;
 	const static std::array<int, 6> SquareIndexes;
 
+	// A square from (0, 0) to (1, 1) with the same order of vertices as `CenteredSquareVertexes`
+	const static std::array<Vector3, 4> GlyphQuadVertexes;
+	const static std::array<Vector2, 4> GlyphQuadUV;
+
 	const static std::array<Vector3, 6> PositionVertexes;
 	const static std::array<int, 6> PositionIndexes;
 
@@ -3,226 +3,514 @@
 #ifndef DISABLE_DEBUG_RENDERING
 #include "config_3d.h"
 #include "debug_draw_3d.h"
+#include "geometry_generators.h"
 #include "stats_3d.h"
 
-#include <array>
+#include <algorithm>
 
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/classes/camera3d.hpp>
 #include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/classes/os.hpp>
-#include <godot_cpp/templates/hashfuncs.hpp>
+#include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/classes/text_server.hpp>
+#include <godot_cpp/classes/text_server_manager.hpp>
+#include <godot_cpp/classes/theme.hpp>
+#include <godot_cpp/classes/theme_db.hpp>
 GODOT_WARNING_RESTORE()
 using namespace godot;
 
-NodesContainer::TextNodeItem *NodesContainer::LabelsPool::get(uint32_t opts_hash, uint32_t text_hash) {
-	ZoneScoped;
+// Same as the default `Label3D.pixel_size`
+static constexpr real_t default_text_pixel_size = 0.005f;
+
+Ref<Font> NodesContainer::_get_default_font() {
+	ThemeDB *theme_db = ThemeDB::get_singleton();
+	if (Ref<Theme> theme = theme_db->get_project_theme(); theme.is_valid() && theme->has_default_font()) {
+		return theme->get_default_font();
+	}
+	return theme_db->get_fallback_font();
+}
+
+NodesContainer::ShapedText *NodesContainer::_get_shaped_text(const String &p_text, const Ref<Font> &p_font, const int32_t &p_size, const int32_t &p_outline_size) {
+	ShapedTextKey key = { p_text, p_font.is_valid() ? p_font->get_instance_id() : 0, p_size, p_outline_size };
+	if (auto it = shaped_texts.find(key); it != shaped_texts.end()) {
+		return &it->second;
+	}
+
+	ShapedText &shaped = shaped_texts[key];
+	shaped.font = p_font.is_valid() ? p_font : _get_default_font();
+	_shape_text(shaped, key);
+	return &shaped;
+}
 
-	if (auto &r = recent[opts_hash][text_hash]; !r.empty()) {
-		ZoneScopedN("Returning first recent node.");
-		used.splice(used.begin(), r, r.begin());
-		return &used.front();
+void NodesContainer::_shape_text(ShapedText &r_shaped, const ShapedTextKey &p_key) {
+	if (r_shaped.font.is_null()) {
+		return;
 	}
 
-	// if no recent same
-	if (!unused.empty()) {
-		ZoneScopedN("Returning first unused node.");
-		used.splice(used.begin(), unused, unused.begin());
-		return &used.front();
+	ZoneScoped;
+	TextServer *ts = TextServerManager::get_singleton()->get_primary_interface().ptr();
+	const TypedArray<RID> font_rids = r_shaped.font->get_rids();
+	const Dictionary features = r_shaped.font->get_opentype_features();
+	const PackedStringArray text_lines = p_key.text.split("\n");
+
+	std::vector<RID> lines;
+	real_t total_height = 0;
+	for (const String &text_line : text_lines) {
+		RID line = ts->create_shaped_text();
+		ts->shaped_text_add_string(line, text_line, font_rids, p_key.size, features);
+		total_height += (real_t)(ts->shaped_text_get_ascent(line) + ts->shaped_text_get_descent(line));
+		lines.push_back(line);
 	}
 
-	{
-		ZoneScopedN("Creating");
+	// The lines are centered around the position like in `Label3D`. Y is down in the TextServer.
+	real_t y = -total_height * 0.5f;
+	for (const RID &line : lines) {
+		const real_t ascent = (real_t)ts->shaped_text_get_ascent(line);
+		const Vector2 pen((real_t)-ts->shaped_text_get_width(line) * 0.5f, y + ascent);
 
-		// int to_create = Math::clamp((int)delayed.size(), 2, 1024);
-		int to_create = 2;
-		for (int i = 0; i < to_create; i++) {
-			unused.push_front(owner->_create_text_node_item(opts_hash, text_hash));
+		if (p_key.outline_size > 0) {
+			_add_shaped_glyphs(r_shaped, line, pen, p_key.outline_size, true);
 		}
-		used.splice(used.begin(), unused, unused.begin());
+		_add_shaped_glyphs(r_shaped, line, pen, 0, false);
+
+		y += ascent + (real_t)ts->shaped_text_get_descent(line);
+		ts->free_rid(line);
 	}
-	return &used.front();
 }
 
-void NodesContainer::LabelsPool::update_unused(double delta, bool is_physics) {
+void NodesContainer::_add_shaped_glyphs(ShapedText &r_shaped, const RID &p_line, Vector2 p_pen, const int32_t &p_outline_size, const bool &p_is_outline) {
 	ZoneScoped;
-
-	nodes_count = 0;
-	{
-		ZoneScopedN("Delete nodes");
-		size_t destroyed = 0;
-
-		size_t idx = 0;
-		for (auto it = unused.begin(); it != unused.end();) {
-			if (it->unused_time < 0) {
-				// Save at least 32 (+1) nodes
-				if (idx > 32) {
-					DEV_PRINT_STD("Destroyed %s\n", it->node->get_text().utf8().ptr());
-
-					owner->_destroy_text_node_item(*it);
-					it = unused.erase(it);
-					destroyed++;
-				} else {
-					++it;
+	TextServer *ts = TextServerManager::get_singleton()->get_primary_interface().ptr();
+	const TypedArray<Dictionary> glyphs = ts->shaped_text_get_glyphs(p_line);
+	// MSDF fonts draw the outline from the same glyphs, the outline size is only passed to the material
+	const int32_t glyph_outline_size = r_shaped.font->is_multichannel_signed_distance_field() ? 0 : p_outline_size;
+
+	for (int64_t i = 0; i < glyphs.size(); i++) {
+		const Dictionary glyph = glyphs[i];
+		const RID font_rid = glyph["font_rid"];
+		const int64_t index = glyph["index"];
+		const int64_t repeat = glyph["repeat"];
+		const Vector2 offset = glyph["offset"];
+		const real_t advance = glyph["advance"];
+		const Vector2i size((int32_t)(int64_t)glyph["font_size"], glyph_outline_size);
+
+		for (int64_t r = 0; r < repeat; r++) {
+			if (font_rid.is_valid() && ts->font_get_glyph_texture_idx(font_rid, size, index) >= 0) {
+				const Vector2 glyph_size = ts->font_get_glyph_size(font_rid, size, index);
+				const Vector2 texture_size = ts->font_get_glyph_texture_size(font_rid, size, index);
+
+				if (glyph_size.x > 0 && glyph_size.y > 0 && texture_size.x > 0 && texture_size.y > 0) {
+					const Rect2 uv = ts->font_get_glyph_uv_rect(font_rid, size, index);
+					const Vector2 top_left = p_pen + offset + ts->font_get_glyph_offset(font_rid, size, index);
+
+					ShapedGlyph g;
+					g.stream = _get_glyph_stream(ts->font_get_glyph_texture_rid(font_rid, size, index), r_shaped.font, font_rid, size, index, p_is_outline ? p_outline_size : 0, p_is_outline);
+					glyph_streams[g.stream].users++;
+					g.is_outline = p_is_outline;
+					g.offset = Vector2(top_left.x, -(top_left.y + glyph_size.y));
+					g.size = glyph_size;
+					g.uv_rect = Color(uv.position.x / texture_size.x, uv.position.y / texture_size.y, uv.size.x / texture_size.x, uv.size.y / texture_size.y);
+					r_shaped.glyphs.push_back(g);
+
+					const Vector2 far_corner = g.offset.abs().max((g.offset + g.size).abs());
+					r_shaped.extent = Math::max(r_shaped.extent, far_corner.length());
 				}
-			} else {
-				it->unused_time -= delta;
-				nodes_count++;
-				++it;
 			}
-			idx++;
+			p_pen.x += advance;
 		}
+	}
+}
 
-		if (destroyed) {
-			DEV_PRINT_STD("Destroyed unused Label3D nodes: %" PRIu64 ". %" PRIu64 " nodes remain.\n", destroyed, unused.size());
+uint32_t NodesContainer::_get_glyph_stream(const RID &p_texture, const Ref<Font> &p_font, const RID &p_font_rid, const Vector2i &p_size, const int64_t &p_glyph_index, const int32_t &p_outline_size, const bool &p_is_outline) {
+	uint32_t free_idx = (uint32_t)glyph_streams.size();
+	for (uint32_t i = 0; i < (uint32_t)glyph_streams.size(); i++) {
+		const GlyphStream &s = glyph_streams[i];
+		if (s.texture == p_texture && s.is_outline == p_is_outline && s.outline_size == p_outline_size) {
+			return i;
+		}
+		if (!s.is_used() && free_idx == glyph_streams.size()) {
+			free_idx = i;
 		}
 	}
 
-	{
-		ZoneScopedN("Move to unused");
+	ZoneScoped;
+	Ref<ShaderMaterial> base = owner->get_material_variant(MeshMaterialType::Text, no_depth_test ? MeshMaterialVariant::NoDepth : MeshMaterialVariant::Normal);
+	const bool is_msdf = p_font->is_multichannel_signed_distance_field();
+
+	GlyphStream s;
+	s.texture = p_texture;
+	s.font_rid = p_font_rid;
+	s.font_size = p_size;
+	s.glyph_index = p_glyph_index;
+	s.is_outline = p_is_outline;
+	s.outline_size = p_outline_size;
+	s.material.instantiate();
+	s.material->set_shader(base->get_shader());
+	// The outline is drawn behind the text like in `Label3D`
+	s.material->set_render_priority(base->get_render_priority() - (p_is_outline ? 1 : 0));
+	s.material->set_shader_parameter("glyphs_texture", p_texture);
+	s.material->set_shader_parameter("is_msdf", is_msdf);
+	s.material->set_shader_parameter("msdf_pixel_range", is_msdf ? p_font->get_msdf_pixel_range() : 0);
+	s.material->set_shader_parameter("msdf_outline_size", is_msdf ? p_outline_size : 0);
+
+	if (free_idx < glyph_streams.size()) {
+		glyph_streams[free_idx] = s;
+		return free_idx;
+	}
 
-		size_t moved = 0;
+	glyph_streams.push_back(s);
+	return (uint32_t)glyph_streams.size() - 1;
+}
 
-		for (auto &r : recent) {
-			for (auto &rt : r.second) {
-				for (auto it = rt.second.begin(); it != rt.second.end();) {
-					if (it->unused_time < 0) {
-						it->unused_time = TIME_UNUSED_LABEL3D_DELETE;
+void NodesContainer::_create_glyph_stream(GlyphStream &r_stream) {
+	ZoneScoped;
+	RenderingServer *rs = RenderingServer::get_singleton();
 
-						auto next = std::next(it);
-						unused.splice(unused.begin(), rt.second, it);
-						// DEV_PRINT_STD("Moved %s\n", it->node->get_text().utf8().ptr());
-						it = next;
-						moved++;
-					} else {
-						it->unused_time -= delta;
-						++it;
-					}
+	if (glyph_mesh.is_null()) {
+		glyph_mesh = GeometryGenerator::CreateMeshNative(Mesh::PrimitiveType::PRIMITIVE_TRIANGLES, GeometryGenerator::GlyphQuadVertexes, GeometryGenerator::SquareBackwardsIndexes, {}, {}, GeometryGenerator::GlyphQuadUV).mesh;
+	}
 
-					nodes_count++;
-				}
+	r_stream.multimesh = rs->multimesh_create();
+	rs->multimesh_set_mesh(r_stream.multimesh, glyph_mesh->get_rid());
+
+	r_stream.instance = rs->instance_create();
+	rs->instance_set_base(r_stream.instance, r_stream.multimesh);
+	rs->instance_geometry_set_cast_shadows_setting(r_stream.instance, RenderingServer::SHADOW_CASTING_SETTING_OFF);
+	rs->instance_geometry_set_flag(r_stream.instance, RenderingServer::INSTANCE_FLAG_USE_DYNAMIC_GI, false);
+	rs->instance_geometry_set_flag(r_stream.instance, RenderingServer::INSTANCE_FLAG_USE_BAKED_LIGHT, false);
+	rs->instance_geometry_set_material_override(r_stream.instance, r_stream.material->get_rid());
+	rs->instance_set_layer_mask(r_stream.instance, render_layers);
+	if (world.is_valid()) {
+		rs->instance_set_scenario(r_stream.instance, world->get_scenario());
+	}
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	rs->instance_set_transform(r_stream.instance, Transform3D(Basis(), center_position));
+#endif
+	r_stream.idle_time = 0;
+}
+
+void NodesContainer::_release_glyph_stream(GlyphStream &r_stream) {
+	if (!r_stream.is_created()) {
+		return;
+	}
+
+	RenderingServer *rs = RenderingServer::get_singleton();
+	rs->free_rid(r_stream.instance);
+	rs->free_rid(r_stream.multimesh);
+	r_stream.instance = RID();
+	r_stream.multimesh = RID();
+	r_stream.capacity = 0;
+	r_stream.visible_count = 0;
+	r_stream.custom_aabb = AABB();
+	r_stream.buffer = PackedFloat32Array();
+	r_stream.idle_time = 0;
+}
+
+void NodesContainer::_update_text_items(TextItemsPool &r_pool, const double &p_delta, const bool &p_is_physics) {
+	ZoneScoped;
+	auto &items = r_pool.items;
+
+	for (size_t i = 0; i < items.size();) {
+		TextItem &item = items[i];
+		if (p_is_physics ? item.is_expired_physics() : item.is_expired()) {
+			if (item.shaped && --item.shaped->users == 0) {
+				item.shaped->unused_time = TIME_UNUSED_SHAPED_TEXT_DELETE;
 			}
+
+			// The order of the items does not matter
+			item = items.back();
+			items.pop_back();
+			is_text_dirty = true;
+		} else {
+			item.update_expiration(p_delta);
+			i++;
 		}
+	}
+
+	r_pool.visible_count = items.size();
+}
+
+void NodesContainer::_release_shaped_glyphs(ShapedText &r_shaped) {
+	for (const ShapedGlyph &g : r_shaped.glyphs) {
+		glyph_streams[g.stream].users--;
+	}
+	r_shaped.glyphs.clear();
+	r_shaped.extent = 0;
+}
 
-		if (moved) {
-			// DEV_PRINT_STD("Moved Label3D nodes to unused: %" PRIu64 ".\n", moved);
+void NodesContainer::_update_shaped_texts(const double &p_delta) {
+	ZoneScoped;
+	for (auto it = shaped_texts.begin(); it != shaped_texts.end();) {
+		ShapedText &shaped = it->second;
+		if (shaped.users == 0) {
+			shaped.unused_time -= p_delta;
+			if (shaped.unused_time < 0) {
+				_release_shaped_glyphs(shaped);
+				it = shaped_texts.erase(it);
+				continue;
+			}
 		}
+		++it;
 	}
+}
 
-	{
-		ZoneScopedN("Move to recent");
+void NodesContainer::_check_glyph_streams() {
+	ZoneScoped;
+	TextServer *ts = TextServerManager::get_singleton()->get_primary_interface().ptr();
+
+	// The cache textures are replaced when the cache of a font is cleared or rebuilt,
+	// so the streams of the old textures are removed and the text using them is shaped again
+	bool has_removed = false;
+	for (auto &s : glyph_streams) {
+		if (s.is_used() && (!ts->has(s.font_rid) || ts->font_get_glyph_texture_rid(s.font_rid, s.font_size, s.glyph_index) != s.texture)) {
+			DEV_PRINT_STD(NAMEOF(NodesContainer) " The cache texture of a font was removed, the text will be shaped again\n");
+			_release_glyph_stream(s);
+			s.texture = RID();
+			has_removed = true;
+		}
+	}
 
-		used_count = 0;
-		for (auto it = used.begin(); it != used.end();) {
-			if (is_physics ? it->is_expired_physics() : it->is_expired()) {
-				ZoneScopedN("Hide");
-				it->node->set_visible(false);
+	if (!has_removed) {
+		return;
+	}
 
-				auto &rt = recent[it->opts_hash][it->text_hash];
-				auto next = std::next(it);
-				rt.splice(rt.begin(), used, it);
-				it = next;
-			} else {
-				used_count++;
-				it->update_expiration(delta);
-				++it;
+	std::vector<std::pair<const ShapedTextKey *, ShapedText *>> reshaping;
+	for (auto &p : shaped_texts) {
+		for (const ShapedGlyph &g : p.second.glyphs) {
+			if (!glyph_streams[g.stream].is_used()) {
+				reshaping.push_back({ &p.first, &p.second });
+				break;
 			}
+		}
+	}
 
-			nodes_count++;
+	// The glyphs are released first, so the free streams can be used again by the new glyphs
+	for (auto &p : reshaping) {
+		_release_shaped_glyphs(*p.second);
+	}
+	for (auto &s : glyph_streams) {
+		if (!s.is_used()) {
+			s = GlyphStream();
 		}
 	}
+	for (auto &p : reshaping) {
+		_shape_text(*p.second, *p.first);
+	}
 
-	{
-		ZoneScopedN("Clear empty lists");
+	is_text_dirty = true;
+}
 
-		std::vector<uint32_t> keys_to_remove;
-		bool is_something_cleared = false;
+void NodesContainer::_fill_glyph_streams() {
+	ZoneScoped;
+	for (auto &s : glyph_streams) {
+		s.count = 0;
+		s.has_scaled_text = false;
+		s.has_fixed_size = false;
+		s.fixed_size_extent = 0;
+	}
 
-		// Clear empty lists for the String hashes
-		for (auto &r : recent) { // each options group
-			for (auto &rt : r.second) { // each text hash
-				if (rt.second.empty()) {
-					keys_to_remove.push_back(rt.first);
+	// Count the glyphs to allocate the buffers
+	for (const auto &pool : text_pools) {
+		for (const TextItem &item : pool.items) {
+			for (const ShapedGlyph &g : item.shaped->glyphs) {
+				if (!g.is_outline || item.outline_color.a > 0) {
+					glyph_streams[g.stream].count++;
 				}
 			}
+		}
+	}
 
-			if (!keys_to_remove.empty()) {
-				for (auto &k : keys_to_remove) {
-					r.second.erase(k);
+	for (auto &s : glyph_streams) {
+		// The whole buffer is uploaded, so its capacity follows the number of glyphs
+		const int64_t new_capacity = GeometryPool::get_multimesh_capacity(s.buffer.size() / GLYPH_INSTANCE_FLOAT_COUNT, s.count);
+		if (new_capacity != s.buffer.size() / GLYPH_INSTANCE_FLOAT_COUNT) {
+			s.buffer.resize((int64_t)new_capacity * GLYPH_INSTANCE_FLOAT_COUNT);
+		}
+		s.count = 0;
+	}
+
+	for (const auto &pool : text_pools) {
+		for (const TextItem &item : pool.items) {
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+			const Vector3 position = item.position - center_position;
+#else
+			const Vector3 &position = item.position;
+#endif
+			const real_t extent = item.shaped->extent * item.pixel_size;
+			const AABB item_aabb(position - Vector3(extent, extent, extent), Vector3(extent, extent, extent) * 2);
+
+			for (const ShapedGlyph &g : item.shaped->glyphs) {
+				if (g.is_outline && item.outline_color.a <= 0) {
+					continue;
 				}
 
-				is_something_cleared = true;
-				// DEV_PRINT_STD("Removed TextNodeItems lists: %" PRIu64 ".\n", keys_to_remove.size());
+				GlyphStream &s = glyph_streams[g.stream];
+				const Vector2 offset = g.offset * item.pixel_size;
+				const Vector2 size = g.size * item.pixel_size;
+				const GeometryPoolData3DInstance instance(
+						Transform3D(Basis(Vector3(offset.x, offset.y, item.fixed_size ? 1.f : 0.f), Vector3(size.x, size.y, 0), Vector3()), position),
+						g.is_outline ? item.outline_color : item.color);
+
+				float *w = s.buffer.ptrw() + (int64_t)s.count * GLYPH_INSTANCE_FLOAT_COUNT;
+				memcpy(w, &instance, sizeof(GeometryPoolData3DInstance));
+				memcpy(w + sizeof(GeometryPoolData3DInstance) / sizeof(float), &g.uv_rect, sizeof(Color));
+
+				if (item.fixed_size) {
+					if (s.has_fixed_size) {
+						s.fixed_size_positions.expand_to(position);
+					} else {
+						s.fixed_size_positions = AABB(position, Vector3());
+						s.has_fixed_size = true;
+					}
+					s.fixed_size_extent = Math::max(s.fixed_size_extent, extent);
+				} else if (s.has_scaled_text) {
+					s.scaled_text_aabb.merge_with(item_aabb);
+				} else {
+					s.scaled_text_aabb = item_aabb;
+					s.has_scaled_text = true;
+				}
+				s.count++;
 			}
-			keys_to_remove.clear();
 		}
+	}
+}
+
+AABB NodesContainer::_get_glyph_stream_aabb(const GlyphStream &p_stream) const {
+	if (!p_stream.has_fixed_size) {
+		return p_stream.scaled_text_aabb;
+	}
+
+	// The size of a fixed size text grows with the distance to the camera like in the `text_glyphs` shader,
+	// so the farthest position from each camera is used
+	real_t scale = 0;
+	for (const WorldCamera &cam : cameras) {
+		if (cam.orthogonal_half_height > 0) {
+			scale = Math::max(scale, cam.orthogonal_half_height);
+			continue;
+		}
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		const Vector3 cam_pos = cam.position - center_position;
+#else
+		const Vector3 &cam_pos = cam.position;
+#endif
+		const Vector3 to_start = (p_stream.fixed_size_positions.position - cam_pos).abs();
+		const Vector3 to_end = (p_stream.fixed_size_positions.get_end() - cam_pos).abs();
+		scale = Math::max(scale, to_start.max(to_end).length());
+	}
+
+	AABB aabb = p_stream.fixed_size_positions.grow(p_stream.fixed_size_extent * scale);
+	if (p_stream.has_scaled_text) {
+		aabb.merge_with(p_stream.scaled_text_aabb);
+	}
+	return aabb;
+}
 
-		// Clear option groups
-		if (is_something_cleared) {
-			for (auto &r : recent) {
-				if (r.second.empty()) {
-					keys_to_remove.push_back(r.first);
+void NodesContainer::_update_glyph_streams(const double &p_delta) {
+	ZoneScoped;
+	RenderingServer *rs = RenderingServer::get_singleton();
+
+	if (is_text_dirty) {
+		is_text_dirty = false;
+		_fill_glyph_streams();
+
+		for (auto &s : glyph_streams) {
+			if (!s.is_created()) {
+				if (s.count == 0) {
+					continue;
 				}
+				_create_glyph_stream(s);
 			}
 
-			if (!keys_to_remove.empty()) {
-				for (auto &k : keys_to_remove) {
-					recent.erase(k);
-				}
-				// DEV_PRINT_STD("Removed TextNodeItems option groups: %" PRIu64 ".\n", keys_to_remove.size());
+			const int32_t new_capacity = (int32_t)(s.buffer.size() / GLYPH_INSTANCE_FLOAT_COUNT);
+			if (new_capacity != s.capacity) {
+				ZoneScopedN("Changing amount of glyphs");
+				rs->multimesh_allocate_data(s.multimesh, new_capacity, RenderingServer::MULTIMESH_TRANSFORM_3D, true, true);
+				s.capacity = new_capacity;
+				// all instances are visible after the allocation
+				s.visible_count = -1;
+			}
+
+			if (s.visible_count != s.count) {
+				rs->multimesh_set_visible_instances(s.multimesh, s.count);
+				s.visible_count = s.count;
+			}
+
+			if (s.count == 0) {
+				continue;
 			}
-			keys_to_remove.clear();
+
+			ZoneScopedN("Set buffer");
+			rs->multimesh_set_buffer(s.multimesh, s.buffer);
 		}
 	}
-}
 
-void NodesContainer::LabelsPool::clear_pools() {
-	ZoneScoped;
-	for_each([&](TextNodeItem &i) {
-		owner->_destroy_text_node_item(i);
-	});
+	const double release_delay = owner->get_config()->get_geometry_release_delay();
+	for (auto &s : glyph_streams) {
+		if (!s.is_created()) {
+			// Streams without shaped glyphs are removed, their slots are used for the next textures
+			if (s.is_used() && s.users == 0) {
+				s = GlyphStream();
+			}
+			continue;
+		}
 
-	recent.clear();
-	unused.clear();
-	used.clear();
+		if (s.visible_count) {
+			s.idle_time = 0;
 
-	nodes_count = 0;
-	used_count = 0;
+			// The bounds of the fixed size text change with the cameras, so they are checked every frame
+			const AABB aabb = _get_glyph_stream_aabb(s);
+			if (s.custom_aabb != aabb) {
+				rs->multimesh_set_custom_aabb(s.multimesh, aabb);
+				s.custom_aabb = aabb;
+			}
+		} else {
+			s.idle_time += p_delta;
+			if (s.users == 0 || (release_delay > 0 && s.idle_time >= release_delay)) {
+				_release_glyph_stream(s);
+			}
+		}
+	}
 }
 
-NodesContainer::TextNodeItem NodesContainer::_create_text_node_item(uint32_t opts_hash, uint32_t text_hash) {
+void NodesContainer::_hide_glyph_streams() {
 	ZoneScoped;
-	Label3D *lbl = memnew(Label3D);
-	lbl->set_layer_mask(render_layers);
-	lbl->set_visible(false);
-	lbl->set_draw_flag(Label3D::DrawFlags::FLAG_DISABLE_DEPTH_TEST, no_depth_test);
-	lbl->set_billboard_mode(BaseMaterial3D::BillboardMode::BILLBOARD_ENABLED);
-	root->add_child(lbl);
-	return TextNodeItem(lbl, opts_hash, text_hash);
+	for (auto &s : glyph_streams) {
+		if (s.is_created() && s.visible_count != 0) {
+			RenderingServer::get_singleton()->multimesh_set_visible_instances(s.multimesh, 0);
+			s.visible_count = 0;
+		}
+	}
+	// the buffers must be filled again after enabling
+	is_text_dirty = true;
 }
 
-void NodesContainer::_destroy_text_node_item(TextNodeItem &item) {
+void NodesContainer::_clear_text() {
 	ZoneScoped;
-	root->remove_child(item.node);
-	item.node->queue_free();
-	DEV_PRINT_STD(NAMEOF(TextNodeItem) "'s Label3D node is destroyed\n");
-}
+	for (auto &pool : text_pools) {
+		pool.items.clear();
+		pool.visible_count = 0;
+	}
 
-NodesContainer::NodesContainer(DebugDraw3D *p_owner, Node *p_root, bool p_no_depth_test) {
-	for (auto &p : text_pools) {
-		p.owner = this;
+	for (auto &s : glyph_streams) {
+		_release_glyph_stream(s);
 	}
 
+	shaped_texts.clear();
+	glyph_streams.clear();
+	is_text_dirty = false;
+}
+
+NodesContainer::NodesContainer(DebugDraw3D *p_owner, Ref<World3D> p_world, bool p_no_depth_test) {
 	owner = p_owner;
-	root = p_root;
+	world = p_world;
 	no_depth_test = p_no_depth_test;
 }
 
 NodesContainer::~NodesContainer() {
 	LOCK_GUARD(owner->datalock);
-	for (auto &p : text_pools) {
-		p.clear_pools();
-	}
+	_clear_text();
 }
 
 void NodesContainer::update_expiration_delta(const double &p_delta, const ProcessType &p_proc) {
@@ -239,8 +527,6 @@ void NodesContainer::update_geometry(double p_delta) {
 	ZoneScoped;
 	LOCK_GUARD(owner->datalock);
 
-	_render_queued_nodes();
-
 	// accumulate a time delta to delete objects in any case after their timers expire.
 	update_expiration_delta(p_delta, ProcessType::PROCESS);
 
@@ -250,8 +536,9 @@ void NodesContainer::update_geometry(double p_delta) {
 
 	// Return if nothing to do
 	if (!owner->is_debug_enabled()) {
-		ZoneScopedN("Reset Label3Ds");
+		ZoneScopedN("Reset text");
 		update_unused(p_delta);
+		_hide_glyph_streams();
 		return;
 	}
 
@@ -261,6 +548,9 @@ void NodesContainer::update_geometry(double p_delta) {
 	}
 
 	update_unused(p_delta, ProcessType::PROCESS);
+	_update_shaped_texts(p_delta);
+	_check_glyph_streams();
+	_update_glyph_streams(p_delta);
 
 	is_frame_rendered = true;
 }
@@ -284,10 +574,10 @@ void NodesContainer::update_unused(const double &p_delta, const ProcessType &p_p
 	LOCK_GUARD(owner->datalock);
 	if (p_proc == ProcessType::MAX) {
 		for (int p = 0; p < (int)ProcessType::MAX; p++) {
-			text_pools[p].update_unused(p_delta, p == (int)ProcessType::PHYSICS_PROCESS);
+			_update_text_items(text_pools[p], p_delta, p == (int)ProcessType::PHYSICS_PROCESS);
 		}
 	} else {
-		text_pools[(int)p_proc].update_unused(p_delta, p_proc == ProcessType::PHYSICS_PROCESS);
+		_update_text_items(text_pools[(int)p_proc], p_delta, p_proc == ProcessType::PHYSICS_PROCESS);
 	}
 }
 
@@ -295,10 +585,10 @@ void NodesContainer::set_render_layer_mask(int32_t p_layers) {
 	ZoneScoped;
 	LOCK_GUARD(owner->datalock);
 	if (render_layers != p_layers) {
-		for (auto &proc : text_pools) {
-			proc.for_each([&p_layers](TextNodeItem &i) {
-				i.node->set_layer_mask(p_layers);
-			});
+		RenderingServer *rs = RenderingServer::get_singleton();
+		for (auto &s : glyph_streams) {
+			if (s.is_created())
+				rs->instance_set_layer_mask(s.instance, p_layers);
 		}
 
 		render_layers = p_layers;
@@ -309,22 +599,36 @@ int32_t NodesContainer::get_render_layer_mask() const {
 	return render_layers;
 }
 
+void NodesContainer::set_cameras(const std::vector<WorldCamera> &p_cameras) {
+	cameras = p_cameras;
+}
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+void NodesContainer::set_center_position(const Vector3 &p_center) {
+	LOCK_GUARD(owner->datalock);
+	if (center_position == p_center) {
+		return;
+	}
+
+	center_position = p_center;
+	// the glyphs must be written relative to the new center
+	is_text_dirty = true;
+
+	RenderingServer *rs = RenderingServer::get_singleton();
+	const Transform3D xf(Basis(), center_position);
+	for (auto &s : glyph_streams) {
+		if (s.is_created()) {
+			rs->instance_set_transform(s.instance, xf);
+		}
+	}
+}
+#endif
+
 void NodesContainer::add_or_update_text(const DebugDraw3DScopeConfig::Data *p_cfg, const Vector3 &position, const String text, int size, const Color &color, const real_t &duration) {
 	ZoneScoped;
 
-	uint32_t opts_hash = hash_murmur3_one_32(size);
-	opts_hash = hash_murmur3_one_64((uint64_t)p_cfg->text_font.ptr(), opts_hash);
-	opts_hash = hash_murmur3_one_float(color.r, opts_hash);
-	opts_hash = hash_murmur3_one_float(color.g, opts_hash);
-	opts_hash = hash_murmur3_one_float(color.b, opts_hash);
-	opts_hash = hash_murmur3_one_float(color.a, opts_hash);
-	opts_hash = hash_murmur3_one_32(p_cfg->text_outline_color_hash, opts_hash);
-	opts_hash = hash_murmur3_one_32((uint32_t)p_cfg->text_outline_size, opts_hash);
-	opts_hash = hash_murmur3_one_32((uint32_t)p_cfg->text_fixed_size, opts_hash);
-
 	// fixed size
-	uint32_t text_hash = text.hash();
-	real_t pixel_size = 0.005f; // godot default
+	real_t pixel_size = default_text_pixel_size;
 	if (p_cfg->text_fixed_size) {
 		Vector2 viewport_size = p_cfg->dcd.viewport ? p_cfg->dcd.viewport->get_visible_rect().size : Vector2(1.f, 1.f);
 		Camera3D *cam = p_cfg->dcd.viewport ? p_cfg->dcd.viewport->get_camera_3d() : nullptr;
@@ -336,79 +640,27 @@ void NodesContainer::add_or_update_text(const DebugDraw3DScopeConfig::Data *p_cf
 		}
 	}
 
-	// if called from the main thread, just add/update
-	if (auto *os = OS::get_singleton(); os->get_thread_caller_id() == os->get_main_thread_id()) {
-		auto *lblit = text_pools[(int)(Engine::get_singleton()->is_in_physics_frame() ? ProcessType::PHYSICS_PROCESS : ProcessType::PROCESS)].get(opts_hash, text_hash);
-
-		lblit->expiration_time = duration;
-		lblit->is_used_one_time = false;
-		lblit->opts_hash = opts_hash;
-		lblit->text_hash = text_hash;
-		lblit->unused_time = Math::clamp((double)duration * 2, (double)1, DBL_MAX);
-
-		Label3D *lbl3d = lblit->node;
-		lbl3d->set_position(position);
-		lbl3d->set_visible(true);
-		lbl3d->set_text(text);
-		lbl3d->set_font(p_cfg->text_font);
-		lbl3d->set_font_size(size);
-		lbl3d->set_modulate(color);
-		lbl3d->set_outline_modulate(p_cfg->text_outline_color);
-		lbl3d->set_outline_size(p_cfg->text_outline_size);
-		lbl3d->set_draw_flag(Label3D::DrawFlags::FLAG_FIXED_SIZE, p_cfg->text_fixed_size);
-		lbl3d->set_pixel_size(pixel_size);
-	} else {
-		// wait for the end of the frame to display anything from the user thread
-		deferred_text_queue.emplace(
-				/* real_t duration */ duration,
-				/* uint64_t opts_hash */ opts_hash,
-				/* uint64_t text_hash */ text_hash,
-				/* Vector3 position */ position,
-				/* String text */ text,
-				/* Ref<Font> font */ p_cfg->text_font,
-				/* int font_size */ size,
-				/* Color color */ color,
-				/* Color outline_color */ p_cfg->text_outline_color,
-				/* int outline_size */ p_cfg->text_outline_size,
-				/* bool fixed_size */ p_cfg->text_fixed_size,
-				/* real_t pixel_size */ pixel_size);
-	}
-}
-
-void NodesContainer::_render_queued_nodes() {
-	ZoneScoped;
-	LOCK_GUARD(owner->datalock);
+	ShapedText *shaped = _get_shaped_text(text, p_cfg->text_font, size, p_cfg->text_outline_size);
+	shaped->users++;
 
-	while (!deferred_text_queue.empty()) {
-		ZoneScopedN("Updating item");
-		const auto &i = deferred_text_queue.front();
-
-		// Use ProcessType::PROCESS as the default value for user threads
-		auto *lblit = text_pools[(int)ProcessType::PROCESS].get(i.opts_hash, i.text_hash);
-
-		lblit->expiration_time = i.duration;
-		lblit->is_used_one_time = false;
-		lblit->opts_hash = i.opts_hash;
-		lblit->text_hash = i.text_hash;
-		lblit->unused_time = Math::clamp((double)i.duration * 2, (double)1, DBL_MAX);
-
-		{
-			ZoneScopedN("Setting node properties");
-			Label3D *lbl3d = lblit->node;
-			lbl3d->set_position(i.position);
-			lbl3d->set_visible(true);
-			lbl3d->set_text(i.text);
-			lbl3d->set_font(i.font);
-			lbl3d->set_font_size(i.font_size);
-			lbl3d->set_modulate(i.color);
-			lbl3d->set_outline_modulate(i.outline_color);
-			lbl3d->set_outline_size(i.outline_size);
-			lbl3d->set_draw_flag(Label3D::DrawFlags::FLAG_FIXED_SIZE, i.fixed_size);
-			lbl3d->set_pixel_size(i.pixel_size);
-		}
-
-		deferred_text_queue.pop();
+	// Use ProcessType::PROCESS as the default value for user threads
+	ProcessType proc = ProcessType::PROCESS;
+	if (auto *os = OS::get_singleton(); os->get_thread_caller_id() == os->get_main_thread_id() && Engine::get_singleton()->is_in_physics_frame()) {
+		proc = ProcessType::PHYSICS_PROCESS;
 	}
+
+	TextItem item;
+	item.expiration_time = duration;
+	item.is_used_one_time = false;
+	item.shaped = shaped;
+	item.position = position;
+	item.color = color;
+	item.outline_color = p_cfg->text_outline_size > 0 ? p_cfg->text_outline_color : Color(0, 0, 0, 0);
+	item.pixel_size = pixel_size;
+	item.fixed_size = p_cfg->text_fixed_size;
+	text_pools[(int)proc].items.push_back(item);
+
+	is_text_dirty = true;
 }
 
 void NodesContainer::get_render_stats(Ref<DebugDraw3DStats> &p_stats) const {
@@ -419,10 +671,10 @@ void NodesContainer::get_render_stats(Ref<DebugDraw3DStats> &p_stats) const {
 	const int py = (int)ProcessType::PHYSICS_PROCESS;
 
 	p_stats->set_nodes_stats(
-			/* p_nodes_label3d_visible */ text_pools[p].used_count,
-			/* p_nodes_label3d_visible_physics */ text_pools[py].used_count,
-			/* p_nodes_label3d_exists */ text_pools[p].nodes_count,
-			/* p_nodes_label3d_exists_physics */ text_pools[py].nodes_count);
+			/* p_nodes_label3d_visible */ text_pools[p].visible_count,
+			/* p_nodes_label3d_visible_physics */ text_pools[py].visible_count,
+			/* p_nodes_label3d_exists */ text_pools[p].items.size(),
+			/* p_nodes_label3d_exists_physics */ text_pools[py].items.size());
 }
 
-#endif
\ No newline at end of file
+#endif
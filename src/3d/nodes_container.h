@@ -2,24 +2,31 @@
 #ifndef DISABLE_DEBUG_RENDERING
 
 #include "config_scope_3d.h"
+#include "render_instances.h"
 #include "render_instances_enums.h"
 #include "utils/utils.h"
 
-#include <functional>
-#include <list>
-#include <queue>
+#include <unordered_map>
+#include <vector>
 
 GODOT_WARNING_DISABLE()
-#include <godot_cpp/classes/label3d.hpp>
+#include <godot_cpp/classes/array_mesh.hpp>
+#include <godot_cpp/classes/font.hpp>
+#include <godot_cpp/classes/shader_material.hpp>
+#include <godot_cpp/classes/world3d.hpp>
+#include <godot_cpp/templates/hashfuncs.hpp>
 GODOT_WARNING_RESTORE()
 using namespace godot;
 
 class DebugDraw3DStats;
 
+// Text is drawn as billboard glyph quads instead of `Label3D` nodes.
+// Strings are shaped once, and their glyphs are taken from the cache textures of the fonts,
+// so all text with the same cache texture is drawn by one MultiMesh.
 class NodesContainer {
 	friend class DebugDraw3D;
 	class DebugDraw3D *owner;
-	Node *root;
+	Ref<World3D> world;
 
 	bool no_depth_test = false;
 
@@ -45,122 +52,147 @@ class NodesContainer {
 		}
 	};
 
-	struct TextNodeItem : public DelayedNode {
-		Label3D *node;
-		uint32_t opts_hash;
-		uint32_t text_hash;
-		double unused_time;
-
-		TextNodeItem() :
-				DelayedNode(),
-				node(nullptr),
-				opts_hash(0),
-				text_hash(0),
-				unused_time(-1000) {
-			DEV_PRINT_STD("New " NAMEOF(TextNodeItem) " created\n");
-		};
-
-		TextNodeItem(Label3D *lbl, uint32_t opts_hash, uint32_t text_hash) :
-				DelayedNode(),
-				node(lbl),
-				opts_hash(opts_hash),
-				text_hash(text_hash),
-				unused_time(-1000) {
-			DEV_PRINT_STD("New " NAMEOF(TextNodeItem) " created\n");
-		};
+	enum ShrinkTimers : char {
+		TIME_UNUSED_SHAPED_TEXT_DELETE = 5,
 	};
 
-	enum ShrinkTimers : char {
-		TIME_UNUSED_LABEL3D_MOVE = 1,
-		TIME_UNUSED_LABEL3D_DELETE = 5,
+	// The glyph instances in the MultiMesh buffer: `GeometryPoolData3DInstance` and the UV rect as the custom data
+	static constexpr int32_t GLYPH_INSTANCE_FLOAT_COUNT = (sizeof(GeometryPoolData3DInstance) + sizeof(Color)) / sizeof(float);
+
+	struct ShapedTextKey {
+		String text;
+		uint64_t font_id;
+		int32_t size;
+		int32_t outline_size;
+
+		bool operator==(const ShapedTextKey &p_other) const {
+			return font_id == p_other.font_id && size == p_other.size && outline_size == p_other.outline_size && text == p_other.text;
+		}
 	};
 
-	struct LabelsPool {
-		std::unordered_map<uint32_t, std::unordered_map<uint32_t, std::list<TextNodeItem> > > recent;
-		std::list<TextNodeItem> unused;
-		std::list<TextNodeItem> used;
-		NodesContainer *owner;
-
-		size_t nodes_count = 0;
-		size_t used_count = 0;
-
-	public:
-		TextNodeItem *get(uint32_t opts_hash, uint32_t text_hash);
-		void update_unused(double delta, bool is_physics);
-		void clear_pools();
-
-		_FORCE_INLINE_ void for_each(std::function<void(TextNodeItem &)> func) {
-			for (auto &r : recent) {
-				for (auto &rt : r.second) {
-					for (auto &i : rt.second) {
-						func(i);
-					}
-				}
-			}
-			for (auto &i : unused) {
-				func(i);
-			}
-			for (auto &i : used) {
-				func(i);
-			}
+	struct ShapedTextKeyHasher {
+		size_t operator()(const ShapedTextKey &p_key) const {
+			uint32_t h = p_key.text.hash();
+			h = hash_murmur3_one_64(p_key.font_id, h);
+			h = hash_murmur3_one_32((uint32_t)p_key.size, h);
+			h = hash_murmur3_one_32((uint32_t)p_key.outline_size, h);
+			return hash_fmix32(h);
 		}
 	};
 
-	int32_t render_layers = 1;
-	double process_delta_sum = 0;
-	double physics_delta_sum = 0;
-	bool is_frame_rendered = false;
+	// A glyph quad in pixels relative to the position of the text. Y is up.
+	struct ShapedGlyph {
+		uint32_t stream;
+		bool is_outline;
+		Vector2 offset;
+		Vector2 size;
+		// The UV rect in the texture of the stream
+		Color uv_rect;
+	};
 
-	TextNodeItem _create_text_node_item(uint32_t opts_hash, uint32_t text_hash);
-	void _destroy_text_node_item(TextNodeItem &item);
-	LabelsPool text_pools[(int)ProcessType::MAX];
+	struct ShapedText {
+		// Keeps the cache textures of the glyphs
+		Ref<Font> font;
+		std::vector<ShapedGlyph> glyphs;
+		// The largest distance from the position of the text to the corners of its glyphs in pixels
+		real_t extent = 0;
+		// The number of the text items using it. Unused texts are deleted after `TIME_UNUSED_SHAPED_TEXT_DELETE`.
+		uint32_t users = 0;
+		double unused_time = 0;
+	};
 
-	struct TextNodeDeferredQueueItem {
-		real_t duration;
-		uint64_t opts_hash;
-		uint64_t text_hash;
+	// One `draw_text` call
+	struct TextItem : public DelayedNode {
+		ShapedText *shaped;
 		Vector3 position;
-		String text;
-		Ref<Font> font;
-		int font_size;
 		Color color;
 		Color outline_color;
-		int outline_size;
-		bool fixed_size;
 		real_t pixel_size;
+		bool fixed_size;
+	};
+
+	struct TextItemsPool {
+		std::vector<TextItem> items;
+		size_t visible_count = 0;
+	};
+
+	// All glyphs with the same cache texture and material, drawn by one MultiMesh.
+	// The RenderingServer objects are created with the first glyphs and released after being idle for a while.
+	// Streams without shaped glyphs or with a removed texture are freed, and their slots are used again.
+	struct GlyphStream {
+		RID texture;
+		// A glyph of the texture, used to check that the font cache still has this texture
+		RID font_rid;
+		Vector2i font_size;
+		int64_t glyph_index = 0;
+		// The number of shaped glyphs in this stream
+		uint32_t users = 0;
+		bool is_outline = false;
+		int32_t outline_size = 0;
+		Ref<ShaderMaterial> material;
+
+		RID instance;
+		RID multimesh;
+		int32_t capacity = 0;
+		int32_t visible_count = 0;
+		int32_t count = 0;
+		AABB custom_aabb;
+		// The bounds of the text with a size in the world
+		bool has_scaled_text = false;
+		AABB scaled_text_aabb;
+		// The positions of the fixed size text and the largest distance from them to the corners of the glyphs at a distance of 1 from a camera
+		bool has_fixed_size = false;
+		AABB fixed_size_positions;
+		real_t fixed_size_extent = 0;
+		PackedFloat32Array buffer;
+		// Time without visible glyphs
+		double idle_time = 0;
+
+		_FORCE_INLINE_ bool is_created() const {
+			return instance.is_valid();
+		}
 
-		TextNodeDeferredQueueItem(
-				const real_t &duration,
-				const uint64_t &opts_hash,
-				const uint64_t &text_hash,
-				const Vector3 &position,
-				const String &text,
-				const Ref<Font> &font,
-				const int &font_size,
-				const Color &color,
-				const Color &outline_color,
-				const int &outline_size,
-				const bool &fixed_size,
-				const real_t &pixel_size) :
-
-				duration(duration),
-				opts_hash(opts_hash),
-				text_hash(text_hash),
-				position(position),
-				text(text),
-				font(font),
-				font_size(font_size),
-				color(color),
-				outline_color(outline_color),
-				outline_size(outline_size),
-				fixed_size(fixed_size),
-				pixel_size(pixel_size) {}
+		_FORCE_INLINE_ bool is_used() const {
+			return texture.is_valid();
+		}
 	};
-	std::queue<TextNodeDeferredQueueItem> deferred_text_queue;
-	void _render_queued_nodes();
+
+	int32_t render_layers = 1;
+	std::vector<WorldCamera> cameras;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// The glyphs are stored relative to the center position of the DebugGeometryContainer of the same World3D
+	Vector3 center_position;
+#endif
+	double process_delta_sum = 0;
+	double physics_delta_sum = 0;
+	bool is_frame_rendered = false;
+
+	TextItemsPool text_pools[(int)ProcessType::MAX];
+	std::unordered_map<ShapedTextKey, ShapedText, ShapedTextKeyHasher> shaped_texts;
+	std::vector<GlyphStream> glyph_streams;
+	Ref<ArrayMesh> glyph_mesh;
+	// The glyph buffers must be filled again
+	bool is_text_dirty = false;
+
+	Ref<Font> _get_default_font();
+	ShapedText *_get_shaped_text(const String &p_text, const Ref<Font> &p_font, const int32_t &p_size, const int32_t &p_outline_size);
+	void _shape_text(ShapedText &r_shaped, const ShapedTextKey &p_key);
+	void _release_shaped_glyphs(ShapedText &r_shaped);
+	void _add_shaped_glyphs(ShapedText &r_shaped, const RID &p_line, Vector2 p_pen, const int32_t &p_outline_size, const bool &p_is_outline);
+	uint32_t _get_glyph_stream(const RID &p_texture, const Ref<Font> &p_font, const RID &p_font_rid, const Vector2i &p_size, const int64_t &p_glyph_index, const int32_t &p_outline_size, const bool &p_is_outline);
+	void _create_glyph_stream(GlyphStream &r_stream);
+	void _release_glyph_stream(GlyphStream &r_stream);
+	void _update_text_items(TextItemsPool &r_pool, const double &p_delta, const bool &p_is_physics);
+	void _update_shaped_texts(const double &p_delta);
+	void _check_glyph_streams();
+	void _fill_glyph_streams();
+	AABB _get_glyph_stream_aabb(const GlyphStream &p_stream) const;
+	void _update_glyph_streams(const double &p_delta);
+	void _hide_glyph_streams();
+	void _clear_text();
 
 public:
-	NodesContainer(class DebugDraw3D *p_owner, Node *p_root, bool p_no_depth_test);
+	NodesContainer(class DebugDraw3D *p_owner, Ref<World3D> p_world, bool p_no_depth_test);
 	~NodesContainer();
 
 	void update_geometry(double p_delta);
@@ -173,9 +205,15 @@ public:
 	void set_render_layer_mask(int32_t p_layers);
 	int32_t get_render_layer_mask() const;
 
+	// The view of the DebugGeometryContainer of the same World3D, set before `update_geometry`
+	void set_cameras(const std::vector<WorldCamera> &p_cameras);
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	void set_center_position(const Vector3 &p_center);
+#endif
+
 	void add_or_update_text(const DebugDraw3DScopeConfig::Data *p_cfg, const Vector3 &position, const String text, int size, const Color &color, const real_t &duration);
 
 	void get_render_stats(Ref<DebugDraw3DStats> &p_stats) const;
 };
 
-#endif
\ No newline at end of file
+#endif
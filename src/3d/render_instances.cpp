@@ -7,7 +7,7 @@
 
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/classes/mesh.hpp>
-#include <godot_cpp/classes/multi_mesh.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
 GODOT_WARNING_RESTORE()
 
 bool DelayedRenderer::update_visibility(const std::shared_ptr<GeometryPoolCullingData> &p_culling_data) {
@@ -35,161 +35,437 @@ frustum:
 	}
 }
 
-DelayedRendererInstance::DelayedRendererInstance() :
-		DelayedRenderer() {
-	DEV_PRINT_STD("New %s created\n", NAMEOF(DelayedRendererInstance));
-}
-
 DelayedRendererLine::DelayedRendererLine() :
 		DelayedRenderer(),
+		lines(nullptr),
 		lines_count(0) {
 	DEV_PRINT_STD("New %s created\n", NAMEOF(DelayedRendererLine));
 }
 
-void GeometryPool::fill_mesh_data(const std::vector<Ref<MultiMesh> *> &p_meshes, Ref<ArrayMesh> p_ig, std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> &p_culling_data) {
+void GeometryPool::fill_mesh_data(const std::vector<MultiMeshStorage *> &p_meshes, ImmediateMeshStorage *p_ig, const std::shared_ptr<GeometryPoolCullingData> &p_culling_data) {
 	ZoneScoped;
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	_update_position_cell_offsets();
+#endif
+
+	// Everything must be culled again if the cameras have moved
+	uint32_t culling_hash = hash_murmur3_one_32((uint32_t)pools.size());
+	culling_hash = hash_murmur3_one_32(p_culling_data->m_hash, culling_hash);
+
+	if (culling_hash != prev_culling_hash) {
+		prev_culling_hash = culling_hash;
+		mark_all_dirty();
+	}
+
 	fill_instance_data(p_meshes, p_culling_data);
 	fill_lines_data(p_ig, p_culling_data);
 
-	process_delta_sum = 0;
-	physics_delta_sum = 0;
-}
+	for (int proc_i = 0; proc_i < (int)ProcessType::MAX; proc_i++) {
+		expiration_clocks_at_last_fill[proc_i] = expiration_clocks[proc_i];
+	}
 
-void GeometryPool::fill_instance_data(const std::vector<Ref<MultiMesh> *> &p_meshes, std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> &p_culling_data) {
-	ZoneScoped;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	_prune_position_cells();
+#endif
+}
 
-	constexpr size_t INSTANCE_DATA_FLOAT_COUNT = ((sizeof(float) * 3 /*3 components*/ * 4 /*4 vectors3*/ + sizeof(godot::Color) /*Instance Color*/ + sizeof(godot::Color) /*Custom Data*/) / sizeof(float));
+void GeometryPool::_fill_instance_group_task(void *p_userdata, uint32_t p_idx) {
+	GeometryPool *pool = static_cast<GeometryPool *>(p_userdata);
+	pool->_fill_instance_group(pool->instances_fill_groups[p_idx]);
+}
 
-	// reset timers
-	time_spent_to_cull_instances = 0;
-	time_spent_to_fill_buffers_of_instances = 0;
+void GeometryPool::_fill_instance_group(InstanceType p_group) {
+	ZoneScopedN("Fill iteration");
+	ZoneValue((int)p_group);
 
+	InstanceType types[(int)InstanceType::MAX];
+	int types_count = 0;
 	for (int type = 0; type < (int)InstanceType::MAX; type++) {
-		ZoneScopedN("Fill iteration");
+		if (get_instance_lod_group((InstanceType)type) == p_group) {
+			types[types_count++] = (InstanceType)type;
+			instances_fill_results[type] = InstanceTypeFillResult();
+			temp_lod_instances[type].clear();
+		}
+	}
+
+	// All types of the group must be culled before filling, because the distant instances are passed to the simpler types
+	for (int i = 0; i < types_count; i++) {
+		_cull_instance_type(types[i]);
+	}
+
+	for (int i = 0; i < types_count; i++) {
+		_fill_instance_type_buffer(types[i]);
+	}
+}
+
+void GeometryPool::_cull_instance_type(InstanceType p_type) {
+	const int type = (int)p_type;
+	InstanceTypeFillResult &res = instances_fill_results[type];
+	GODOT_STOPWATCH_ADD(&res.time_spent_to_fill);
+
+	// Visibility masks of all pools of this type are kept until the buffer is filled.
+	std::vector<uint64_t> &visibility_mask = temp_visibility_masks[type];
+	std::vector<InstancesFillSegment> &segments = temp_fill_segments[type];
+	visibility_mask.clear();
+	segments.clear();
+
+	{
+		ZoneScopedN("Update visibility and expiration");
 		ZoneValue(type);
-		GODOT_STOPWATCH_ADD(&time_spent_to_fill_buffers_of_instances);
+		GODOT_STOPWATCH_ADD(&res.time_spent_to_cull);
+
+		// Adds a visible instance to the type selected by the LOD. Returns the selected type or `InstanceType::MAX` if the instance is too small to draw.
+		auto add_visible = [&](InstancesStorage &p_storage, size_t p_idx, const GeometryPoolCullingData *p_culling_data) -> InstanceType {
+			const CullingSphere &bounds = p_storage.bounds[p_idx];
+			InstanceType lod_type = p_culling_data->get_lod_type(p_type, bounds);
+			if (lod_type == InstanceType::MAX) {
+				return lod_type;
+			}
 
-		AABBMinMax custom_aabb;
-		std::vector<DelayedRendererInstance *> visible_buffer;
-		visible_buffer.reserve(prev_buffer_visible_instance_count[type]);
+			InstanceTypeFillResult &lod_res = instances_fill_results[(int)lod_type];
+			lod_res.custom_aabb.merge_with(bounds, lod_res.visible_count == 0);
+			lod_res.visible_count++;
 
-		{
-			ZoneScopedN("Update visibility and expiration");
+			if (lod_type != p_type) {
+				InstancesLODEntry entry;
+				entry.data = &p_storage.data[p_idx];
+				entry.custom = p_storage.use_custom_data ? &p_storage.custom[p_idx] : nullptr;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+				entry.cell = p_storage.cells[p_idx];
+#endif
+				temp_lod_instances[(int)lod_type].push_back(entry);
+			}
+			return lod_type;
+		};
 
-			for (auto &vp_pool : pools) {
-				GODOT_STOPWATCH_ADD(&time_spent_to_cull_instances);
-				auto &culling_data = p_culling_data[vp_pool.first];
+		auto cull_storage = [&](InstancesStorage &p_storage, size_t p_count, const GeometryPoolCullingData *p_culling_data) -> uint64_t * {
+			InstancesFillSegment seg;
+			seg.data = p_storage.data.data();
+			seg.custom = p_storage.use_custom_data ? p_storage.custom.data() : nullptr;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+			seg.cells = p_storage.cells.data();
+#endif
+			seg.count = p_count;
+			seg.mask_offset = visibility_mask.size();
+			segments.push_back(seg);
+
+			visibility_mask.resize(seg.mask_offset + CullingKernels::get_mask_size(p_count));
+			uint64_t *mask = visibility_mask.data() + seg.mask_offset;
+			p_culling_data->cull(p_storage.bounds.data(), p_count, mask);
+			return mask;
+		};
+
+		// Culls the storage with free slots. Expired and hidden objects are culled too, it is cheaper than skipping them in the kernel.
+		auto cull_slots_storage = [&](InstancesStorage &p_storage, const GeometryPoolCullingData *p_culling_data) {
+			uint64_t *mask = cull_storage(p_storage, p_storage.size(), p_culling_data);
+
+			for (size_t i = 0; i < p_storage.size(); i++) {
+				auto &state = p_storage.states[i];
+				if (!state.is_drawable()) {
+					state.is_visible = false;
+					CullingKernels::set_invisible(mask, i);
+					continue;
+				}
 
-				for (int proc_i = 0; proc_i < (int)ProcessType::MAX; proc_i++) {
-					auto &itype = vp_pool.second[proc_i].instances[type];
-
-					auto &inst_arr = itype.instant;
-					for (int i = 0; i < itype.used_instant; i++) {
-						auto &inst = inst_arr[i];
-						if (inst.update_visibility(culling_data)) {
-							visible_buffer.push_back(&inst);
-							custom_aabb.merge_with(inst.bounds);
-						}
+				if ((state.is_visible = CullingKernels::is_visible(mask, i))) {
+					InstanceType lod_type = add_visible(p_storage, i, p_culling_data);
+					state.is_visible = lod_type != InstanceType::MAX;
+					if (lod_type != p_type) {
+						CullingKernels::set_invisible(mask, i);
 					}
+				}
+			}
+		};
 
-					itype.used_delayed = 0;
-					if (proc_i == (int)ProcessType::PHYSICS_PROCESS) {
-						for (auto &inst : itype.delayed) {
-							if (!inst.is_expired()) {
-								if (inst.is_used_one_time) {
-									inst.expiration_time -= physics_delta_sum;
-								}
-								inst.is_used_one_time = true;
-								itype.used_delayed++;
-
-								if (inst.update_visibility(culling_data)) {
-									visible_buffer.push_back(&inst);
-									custom_aabb.merge_with(inst.bounds);
-								}
-							}
-						}
-					} else {
-						for (auto &inst : itype.delayed) {
-							if (!inst.is_expired()) {
-								inst.expiration_time -= process_delta_sum;
-								inst.is_used_one_time = true;
-								itype.used_delayed++;
-
-								if (inst.update_visibility(culling_data)) {
-									visible_buffer.push_back(&inst);
-									custom_aabb.merge_with(inst.bounds);
-								}
+		// Culls a lot of delayed objects using the tree, so only the slots near the cameras are checked.
+		auto cull_tree_storage = [&](ObjectsPool<InstancesStorage> &p_pool, const GeometryPoolCullingData *p_culling_data) {
+			InstancesStorage &storage = p_pool.delayed;
+
+			InstancesFillSegment seg;
+			seg.data = storage.data.data();
+			seg.custom = storage.use_custom_data ? storage.custom.data() : nullptr;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+			seg.cells = storage.cells.data();
+#endif
+			seg.count = storage.size();
+			seg.mask_offset = visibility_mask.size();
+			segments.push_back(seg);
+
+			// new elements of the mask are zeroed
+			visibility_mask.resize(seg.mask_offset + CullingKernels::get_mask_size(seg.count));
+			uint64_t *mask = visibility_mask.data() + seg.mask_offset;
+
+			p_pool.query_delayed(p_culling_data, [&](size_t p_idx, bool p_is_inside) {
+				if (!storage.states[p_idx].is_drawable() || (!p_is_inside && !p_culling_data->is_visible(storage.bounds[p_idx]))) {
+					return false;
+				}
+
+				InstanceType lod_type = add_visible(storage, p_idx, p_culling_data);
+				if (lod_type == p_type) {
+					CullingKernels::set_visible(mask, p_idx);
+				}
+				return lod_type != InstanceType::MAX;
+			});
+		};
+
+		const GeometryPoolCullingData *culling_data = fill_culling_data;
+		for (auto &fill_pool : instances_fill_pools) {
+
+			for (int proc_i = 0; proc_i < (int)ProcessType::MAX; proc_i++) {
+				auto &itype = fill_pool.procs[proc_i].instances[type];
+
+				auto &inst_arr = itype.instant;
+				if (itype.used_instant) {
+					uint64_t *mask = cull_storage(inst_arr, itype.used_instant, culling_data);
+
+					for (size_t i = 0; i < itype.used_instant; i++) {
+						if ((inst_arr.states[i].is_visible = CullingKernels::is_visible(mask, i))) {
+							InstanceType lod_type = add_visible(inst_arr, i, culling_data);
+							inst_arr.states[i].is_visible = lod_type != InstanceType::MAX;
+							if (lod_type != p_type) {
+								CullingKernels::set_invisible(mask, i);
 							}
 						}
 					}
 				}
 
-				stat_visible_instances += visible_buffer.size();
-				prev_buffer_visible_instance_count[type] = visible_buffer.size();
+				auto &delayed_arr = itype.delayed;
+				if (delayed_arr.size() == 0) {
+					continue;
+				}
+
+				itype.update_expiration(_get_expiration_anchor_time(proc_i), expiration_clocks_at_last_fill[proc_i], [](size_t) {});
+				if (itype.update_culling_tree()) {
+					cull_tree_storage(itype, culling_data);
+				} else {
+					cull_slots_storage(delayed_arr, culling_data);
+				}
+			}
+
+			if (fill_pool.retained && fill_pool.retained->instances[type].size()) {
+				cull_slots_storage(fill_pool.retained->instances[type], culling_data);
 			}
 		}
+	}
+}
 
-		PackedFloat32Array &buffer = temp_instances_buffers[type];
-		size_t used_buffer_size = visible_buffer.size() * INSTANCE_DATA_FLOAT_COUNT;
+void GeometryPool::_fill_instance_type_buffer(InstanceType p_type) {
+	const int type = (int)p_type;
+	InstanceTypeFillResult &res = instances_fill_results[type];
+	GODOT_STOPWATCH_ADD(&res.time_spent_to_fill);
 
-		{
-			ZoneScopedN("Prepare buffer");
-			ZoneValue(buffer.size());
+	prev_buffer_visible_instance_count[type] = res.visible_count;
+
+	PackedFloat32Array &buffer = temp_instances_buffers[type];
+	const int64_t float_count = (int64_t)get_instance_data_float_count(p_type);
+
+	{
+		ZoneScopedN("Prepare buffer");
+		ZoneValue(buffer.size());
+
+		// The size of the buffer is the capacity of the MultiMesh
+		const int64_t capacity = get_multimesh_capacity(buffer.size() / float_count, (int64_t)res.visible_count);
+		if (capacity * float_count != buffer.size()) {
+			ZoneScopedN("Resize buffer");
+			ZoneValue(capacity);
+			buffer.resize(capacity * float_count);
+		}
+	}
 
-			if ((int64_t)used_buffer_size > buffer.size()) {
-				ZoneScopedN("Resize buffer (grew)");
-				ZoneValue(used_buffer_size);
-				buffer.resize(used_buffer_size);
+	if (res.visible_count) {
+		ZoneScopedN("Fill buffer");
+		ZoneValue(res.visible_count);
+
+		if (is_instance_custom_data_used(p_type)) {
+			_fill_instances_buffer<true>(p_type, buffer.ptrw());
+		} else {
+			_fill_instances_buffer<false>(p_type, buffer.ptrw());
+		}
+	}
+}
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+// Moves the origin of an instance in the MultiMesh layout from its position cell to the center
+static _FORCE_INLINE_ void add_position_cell_offset(float *r_instance, const Vector3Float &p_offset) {
+	r_instance[offsetof(GeometryPoolData3DInstance, origin_x) / sizeof(float)] += p_offset.x;
+	r_instance[offsetof(GeometryPoolData3DInstance, origin_y) / sizeof(float)] += p_offset.y;
+	r_instance[offsetof(GeometryPoolData3DInstance, origin_z) / sizeof(float)] += p_offset.z;
+}
+#endif
+
+template <bool t_use_custom_data>
+void GeometryPool::_fill_instances_buffer(InstanceType p_type, float *r_buffer) {
+	const std::vector<uint64_t> &visibility_mask = temp_visibility_masks[(int)p_type];
+
+	// Without the custom data, the payload is already stored in the MultiMesh layout, so the visible ranges are copied directly to the buffer.
+	// Otherwise, the custom data is appended to each instance.
+	float *w = r_buffer;
+	for (const auto &seg : temp_fill_segments[(int)p_type]) {
+		const uint64_t *mask = visibility_mask.data() + seg.mask_offset;
+
+		size_t i = 0;
+		while (i < seg.count) {
+			if (!CullingKernels::is_visible(mask, i)) {
+				// skip the whole invisible word
+				i = (i % 64 == 0 && mask[i / 64] == 0) ? i + 64 : i + 1;
+				continue;
 			}
 
-			// shrink the buffer only if half of it is required.
-			if ((int64_t)used_buffer_size < (int64_t)ceil(buffer.size() * 0.5)) {
-				ZoneScopedN("Resize buffer (shrink)");
-				ZoneValue(used_buffer_size);
-				buffer.resize(used_buffer_size);
+			size_t run_start = i;
+			while (i < seg.count && CullingKernels::is_visible(mask, i)) {
+				i++;
+			}
+
+			if constexpr (t_use_custom_data) {
+				for (size_t r = run_start; r < i; r++) {
+					memcpy(w, seg.data + r, sizeof(GeometryPoolData3DInstance));
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+					add_position_cell_offset(w, position_cell_offsets[seg.cells[r]]);
+#endif
+					w += sizeof(GeometryPoolData3DInstance) / sizeof(float);
+					memcpy(w, seg.custom + r, sizeof(Color));
+					w += sizeof(Color) / sizeof(float);
+				}
+			} else {
+				memcpy(w, seg.data + run_start, (i - run_start) * sizeof(GeometryPoolData3DInstance));
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+				for (size_t r = run_start; r < i; r++) {
+					add_position_cell_offset(w + (r - run_start) * (sizeof(GeometryPoolData3DInstance) / sizeof(float)), position_cell_offsets[seg.cells[r]]);
+				}
+#endif
+				w += (i - run_start) * (sizeof(GeometryPoolData3DInstance) / sizeof(float));
 			}
 		}
+	}
 
-		size_t last_added = 0;
-		{
-			ZoneScopedN("Fill buffer");
-			ZoneValue(visible_buffer.size());
-			auto w = buffer.ptrw();
+	// Distant instances of the other types of the LOD group
+	for (const auto &lod : temp_lod_instances[(int)p_type]) {
+		memcpy(w, lod.data, sizeof(GeometryPoolData3DInstance));
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		add_position_cell_offset(w, position_cell_offsets[lod.cell]);
+#endif
+		w += sizeof(GeometryPoolData3DInstance) / sizeof(float);
+		if constexpr (t_use_custom_data) {
+			memcpy(w, lod.custom, sizeof(Color));
+			w += sizeof(Color) / sizeof(float);
+		}
+	}
+}
+
+int64_t GeometryPool::get_multimesh_capacity(const int64_t &p_capacity, const int64_t &p_required) {
+	// a quarter of the capacity can be unused before shrinking
+	if (p_required <= p_capacity && p_required >= p_capacity - p_capacity / 4) {
+		return p_capacity;
+	}
+
+	if (p_required == 0) {
+		return 0;
+	}
+
+	// an eighth is reserved for the growth
+	const int64_t capacity = p_required + p_required / 8;
+	return (capacity + MULTIMESH_CAPACITY_STEP - 1) / MULTIMESH_CAPACITY_STEP * MULTIMESH_CAPACITY_STEP;
+}
 
-			for (auto &inst : visible_buffer) {
-				memcpy(w + last_added++ * INSTANCE_DATA_FLOAT_COUNT, reinterpret_cast<const float *>(&inst->data), INSTANCE_DATA_FLOAT_COUNT * sizeof(float));
+void GeometryPool::fill_instance_data(const std::vector<MultiMeshStorage *> &p_meshes, const std::shared_ptr<GeometryPoolCullingData> &p_culling_data) {
+	ZoneScoped;
+
+	// reset timers
+	time_spent_to_cull_instances = 0;
+	time_spent_to_fill_buffers_of_instances = 0;
+
+	// The pools are resolved here because the maps are not safe to modify from the tasks.
+	fill_culling_data = p_culling_data.get();
+	instances_fill_pools.clear();
+	instances_fill_pools.reserve(pools.size());
+	size_t total_instances = 0;
+	for (auto &vp_pool : pools) {
+		RetainedPools *retained = nullptr;
+		if (auto it = retained_pools.find(vp_pool.first); it != retained_pools.end()) {
+			retained = &it->second;
+			for (auto &i : retained->instances) {
+				total_instances += i.size();
 			}
 		}
 
-		// resize if the buffer size has changed.
-		auto &mesh = *p_meshes[type];
-		mesh->set_custom_aabb(custom_aabb);
+		instances_fill_pools.push_back({ vp_pool.second, retained });
+
+		for (int proc_i = 0; proc_i < (int)ProcessType::MAX; proc_i++) {
+			for (int type = 0; type < (int)InstanceType::MAX; type++) {
+				auto &i = vp_pool.second[proc_i].instances[type];
+				total_instances += i.used_instant + i.delayed.size();
 
-		int32_t new_inst_count = (int)(buffer.size() / INSTANCE_DATA_FLOAT_COUNT);
-		if (new_inst_count != mesh->get_instance_count()) {
-			ZoneScopedN("Changing amount of instances");
-			ZoneValue(new_inst_count);
-			mesh->set_instance_count(new_inst_count);
+				if (i.is_expiration_due(expiration_clocks_at_last_fill[proc_i])) {
+					is_instances_dirty[type] = true;
+				}
+			}
 		}
+	}
 
-		// just change the visible instances instead of resizing the entire buffer.
-		{
-			int32_t new_visible_count = (int32_t)used_buffer_size / INSTANCE_DATA_FLOAT_COUNT;
-			ZoneScopedN("Set visible instances");
-			ZoneValue(new_visible_count);
-			mesh->set_visible_instance_count(new_visible_count);
+	// Unchanged groups keep their buffers and the results of the previous fill
+	instances_fill_groups.clear();
+	for (int type = 0; type < (int)InstanceType::MAX; type++) {
+		InstanceType group = get_instance_lod_group((InstanceType)type);
+		if (is_instances_dirty[type] && std::find(instances_fill_groups.begin(), instances_fill_groups.end(), group) == instances_fill_groups.end()) {
+			instances_fill_groups.push_back(group);
 		}
+	}
+
+	instances_fill_types.clear();
+	for (int type = 0; type < (int)InstanceType::MAX; type++) {
+		if (std::find(instances_fill_groups.begin(), instances_fill_groups.end(), get_instance_lod_group((InstanceType)type)) != instances_fill_groups.end()) {
+			instances_fill_types.push_back((InstanceType)type);
+		}
+	}
 
-		if (buffer.size()) {
-			ZoneScopedN("Set buffer");
-			mesh->set_buffer(buffer);
+	// Each group has its own pools and buffers, so they can be culled and filled independently.
+	if (total_instances >= INSTANCES_COUNT_FOR_PARALLEL_FILL && instances_fill_groups.size() > 1) {
+		ZoneScopedN("Parallel fill");
+		WorkerThreadPool *wtp = WorkerThreadPool::get_singleton();
+		int64_t group_id = wtp->add_native_group_task(&GeometryPool::_fill_instance_group_task, this, (int)instances_fill_groups.size(), -1, true, "DD3D: Culling and filling of instances");
+		wtp->wait_for_group_task_completion(group_id);
+	} else {
+		for (const InstanceType &group : instances_fill_groups) {
+			_fill_instance_group(group);
 		}
 	}
 
+	instances_fill_pools.clear();
+
+	for (int type = 0; type < (int)InstanceType::MAX; type++) {
+		stat_visible_instances += instances_fill_results[type].visible_count;
+	}
+
+	// MultiMesh calls should be made only from one thread.
+	for (const InstanceType &itype : instances_fill_types) {
+		const int type = (int)itype;
+		ZoneScopedN("Update MultiMesh");
+		ZoneValue(type);
+
+		is_instances_dirty[type] = false;
+
+		const InstanceTypeFillResult &res = instances_fill_results[type];
+		const PackedFloat32Array &buffer = temp_instances_buffers[type];
+
+		time_spent_to_cull_instances += res.time_spent_to_cull;
+		time_spent_to_fill_buffers_of_instances += res.time_spent_to_fill;
+		GODOT_STOPWATCH_ADD(&time_spent_to_fill_buffers_of_instances);
+
+		AABB custom_aabb = res.custom_aabb;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		// the instance of the MultiMesh is placed at the center
+		custom_aabb.position -= owner_dgc->get_center_position();
+#endif
+
+		// the MultiMesh is reallocated only if the capacity of the buffer has changed.
+		p_meshes[type]->update(buffer, (int32_t)res.visible_count, custom_aabb);
+	}
+
 	time_spent_to_fill_buffers_of_instances -= time_spent_to_cull_instances;
 }
 
-void GeometryPool::fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> &p_culling_data) {
+void GeometryPool::fill_lines_data(ImmediateMeshStorage *p_ig, const std::shared_ptr<GeometryPoolCullingData> &p_culling_data) {
 	ZoneScoped;
 
 	uint64_t used_lines = 0;
@@ -199,8 +475,32 @@ void GeometryPool::fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewp
 			used_lines += proc.lines.delayed.size();
 		}
 	}
+	for (auto &vp_retained : retained_pools) {
+		used_lines += vp_retained.second.lines.size();
+	}
+
+	if (!is_lines_dirty) {
+		for (auto &vp_pool : pools) {
+			for (int proc_i = 0; proc_i < (int)ProcessType::MAX; proc_i++) {
+				if (vp_pool.second[proc_i].lines.is_expiration_due(expiration_clocks_at_last_fill[proc_i])) {
+					is_lines_dirty = true;
+				}
+			}
+		}
+	}
+
+	// The mesh from the previous fill is still valid
+	if (!is_lines_dirty) {
+		stat_visible_lines = prev_buffer_visible_lines_count;
+		return;
+	}
+	is_lines_dirty = false;
 
 	if (used_lines == 0) {
+		ZoneScopedN("Clear lines");
+		prev_buffer_visible_lines_count = 0;
+		p_ig->begin(0);
+		p_ig->commit(AABB());
 		return;
 	}
 
@@ -208,9 +508,6 @@ void GeometryPool::fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewp
 
 	size_t used_vertexes = 0;
 
-	PackedVector3Array vertexes;
-	PackedColorArray colors;
-
 	std::vector<DelayedRendererLine *> visible_buffer;
 
 	{
@@ -224,51 +521,58 @@ void GeometryPool::fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewp
 			// pre calculate buffer size
 
 			for (auto &vp_pool : pools) {
-				auto &culling_data = p_culling_data[vp_pool.first];
-
 				for (int proc_i = 0; proc_i < (int)ProcessType::MAX; proc_i++) {
 					auto &proc = vp_pool.second[proc_i];
 
 					for (size_t i = 0; i < proc.lines.used_instant; i++) {
 						auto &o = proc.lines.instant[i];
-						if (o.update_visibility(culling_data)) {
-							o.is_used_one_time = true;
+						if (o.update_visibility(p_culling_data)) {
 							used_vertexes += o.lines_count;
 							visible_buffer.push_back(&o);
 						}
 					}
 
-					proc.lines.used_delayed = 0;
-					if (proc_i == (int)ProcessType::PHYSICS_PROCESS) {
-						for (auto &o : proc.lines.delayed) {
-							if (!o.is_expired()) {
-								if (o.is_used_one_time) {
-									o.expiration_time -= physics_delta_sum;
-								}
-								o.is_used_one_time = true;
-								proc.lines.used_delayed++;
-
-								if (o.update_visibility(culling_data)) {
-									used_vertexes += o.lines_count;
-									visible_buffer.push_back(&o);
-								}
+					proc.lines.update_expiration(_get_expiration_anchor_time(proc_i), expiration_clocks_at_last_fill[proc_i], [&proc](size_t p_idx) {
+						proc.lines.free_vertices(proc.lines.delayed[p_idx]);
+					});
+
+					if (proc.lines.update_culling_tree()) {
+						proc.lines.query_delayed(p_culling_data.get(), [&](size_t p_idx, bool p_is_inside) {
+							auto &o = proc.lines.delayed[p_idx];
+							if (o.is_expired() || !(p_is_inside || o.update_visibility(p_culling_data))) {
+								return false;
 							}
-						}
+
+							used_vertexes += o.lines_count;
+							visible_buffer.push_back(&o);
+							return true;
+						});
 					} else {
-						for (auto &o : proc.lines.delayed) {
-							if (!o.is_expired()) {
-								o.expiration_time -= process_delta_sum;
-								o.is_used_one_time = true;
-								proc.lines.used_delayed++;
-
-								if (o.update_visibility(culling_data)) {
-									used_vertexes += o.lines_count;
-									visible_buffer.push_back(&o);
-								}
+						for (auto &o : proc.lines.delayed.objects) {
+							if (!o.is_expired() && o.update_visibility(p_culling_data)) {
+								used_vertexes += o.lines_count;
+								visible_buffer.push_back(&o);
 							}
 						}
 					}
 				}
+
+				if (auto it = retained_pools.find(vp_pool.first); it != retained_pools.end()) {
+					RetainedPools &retained = it->second;
+					for (size_t idx : retained.dirty_lines) {
+						_update_retained_line_vertices(retained, retained.lines[idx]);
+					}
+					retained.dirty_lines.clear();
+
+					for (auto &o : retained.lines.objects) {
+						if (o.is_drawable() && o.update_visibility(p_culling_data)) {
+							used_vertexes += o.lines_count;
+							visible_buffer.push_back(&o);
+						} else {
+							o.is_visible = false;
+						}
+					}
+				}
 			}
 		}
 
@@ -276,35 +580,42 @@ void GeometryPool::fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewp
 		prev_buffer_visible_lines_count = visible_buffer.size();
 
 		ZoneValue(used_vertexes);
-		vertexes.resize(used_vertexes);
-		colors.resize(used_vertexes);
+		p_ig->begin(used_vertexes);
 	}
 
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// the retained lines transformed above can add new cells
+	_update_position_cell_offsets();
+#endif
+
 	size_t prev_pos = 0;
-	auto vertexes_write = vertexes.ptrw();
-	auto colors_write = colors.ptrw();
+	AABB custom_aabb;
 
 	{
 		ZoneScopedN("Fill buffers");
 		ZoneValue(visible_buffer.size());
 
 		for (const auto &o : visible_buffer) {
-			size_t lines_size = o->lines_count;
-			memcpy(vertexes_write + prev_pos, o->lines.get(), o->lines_count * sizeof(Vector3));
-			std::fill(colors_write + prev_pos, colors_write + prev_pos + lines_size, o->color);
-			prev_pos += lines_size;
+			AABB line_aabb(o->bounds.min, o->bounds.max - o->bounds.min);
+			custom_aabb = prev_pos ? custom_aabb.merge(line_aabb) : line_aabb;
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+			p_ig->write(prev_pos, o->lines, o->lines_count, o->color, position_cell_offsets[o->cell]);
+#else
+			p_ig->write(prev_pos, o->lines, o->lines_count, o->color);
+#endif
+			prev_pos += o->lines_count;
 		}
 	}
 
-	if (used_vertexes > 1) {
-		ZoneScopedN("Set mesh arrays");
-
-		Array mesh = Array();
-		mesh.resize(ArrayMesh::ArrayType::ARRAY_MAX);
-		mesh[ArrayMesh::ArrayType::ARRAY_VERTEX] = vertexes;
-		mesh[ArrayMesh::ArrayType::ARRAY_COLOR] = colors;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// the vertices are relative to the center, where the instance of the mesh is placed
+	custom_aabb.position -= owner_dgc->get_center_position();
+#endif
 
-		p_ig->add_surface_from_arrays(Mesh::PrimitiveType::PRIMITIVE_LINES, mesh);
+	{
+		ZoneScopedN("Update mesh");
+		p_ig->commit(custom_aabb);
 	}
 
 	time_spent_to_fill_buffers_of_lines -= time_spent_to_cull_lines;
@@ -312,22 +623,30 @@ void GeometryPool::fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewp
 
 void GeometryPool::reset_counter(const double &p_delta, const ProcessType &p_proc) {
 	ZoneScoped;
+	// The instant objects of the previous frame disappear, so their buffers must be filled again
+	auto reset_proc = [this, &p_delta](processTypePools &proc) {
+		for (int i = 0; i < (int)InstanceType::MAX; i++) {
+			if (proc.instances[i].used_instant) {
+				is_instances_dirty[i] = true;
+			}
+			proc.instances[i].reset_counter(p_delta, i);
+		}
+
+		if (proc.lines.used_instant) {
+			is_lines_dirty = true;
+		}
+		proc.lines.reset_counter(p_delta);
+	};
+
 	if (p_proc == ProcessType::MAX) {
 		for (auto &vp_pool : pools) {
 			for (auto &proc : vp_pool.second) {
-				for (int i = 0; i < (int)InstanceType::MAX; i++) {
-					proc.instances[i].reset_counter(p_delta, i);
-				}
-				proc.lines.reset_counter(p_delta);
+				reset_proc(proc);
 			}
 		}
 	} else {
 		for (auto &vp_pool : pools) {
-			auto &proc = vp_pool.second[(int)p_proc];
-			for (int i = 0; i < (int)InstanceType::MAX; i++) {
-				proc.instances[i].reset_counter(p_delta, i);
-			}
-			proc.lines.reset_counter(p_delta);
+			reset_proc(vp_pool.second[(int)p_proc]);
 		}
 	}
 }
@@ -338,6 +657,21 @@ void GeometryPool::reset_visible_objects() {
 	stat_visible_lines = 0;
 }
 
+void GeometryPool::mark_all_dirty() {
+	for (int i = 0; i < (int)InstanceType::MAX; i++) {
+		is_instances_dirty[i] = true;
+	}
+	is_lines_dirty = true;
+}
+
+void GeometryPool::_mark_dirty(const InstanceType &p_type) {
+	if (p_type == InstanceType::MAX) {
+		is_lines_dirty = true;
+	} else {
+		is_instances_dirty[(int)p_type] = true;
+	}
+}
+
 void GeometryPool::set_stats(Ref<DebugDraw3DStats> &p_stats) const {
 	ZoneScoped;
 
@@ -358,6 +692,14 @@ void GeometryPool::set_stats(Ref<DebugDraw3DStats> &p_stats) const {
 		}
 	}
 
+	// Retained objects are counted as the objects of the process
+	for (auto &vp_retained : retained_pools) {
+		const RetainedPools &retained = vp_retained.second;
+		size_t retained_lines = retained.lines.size() - retained.free_lines.size();
+		counts[(int)ProcessType::PROCESS].used_instances += retained.count - retained_lines;
+		counts[(int)ProcessType::PROCESS].used_lines += retained_lines;
+	}
+
 	const int p = (int)ProcessType::PROCESS;
 	const int py = (int)ProcessType::PHYSICS_PROCESS;
 
@@ -387,23 +729,40 @@ void GeometryPool::clear_pool() {
 			proc.lines.clear_pools();
 		}
 	}
+	retained_pools.clear();
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// all objects that referenced the cells are removed
+	position_cell_ids.clear();
+	position_cells.clear();
+	position_cell_offsets.clear();
+	position_cell_unused_checks.clear();
+#endif
+	mark_all_dirty();
 }
 
-void GeometryPool::for_each_instance(const std::function<void(DelayedRendererInstance *)> &p_func) {
+void GeometryPool::for_each_instance(const std::function<void(const DelayedRendererState &, const CullingSphere &, GeometryPoolData3DInstance &)> &p_func) {
 	ZoneScoped;
 	for (auto &vp_pool : pools) {
 		for (auto &proc : vp_pool.second) {
 			for (auto &inst : proc.instances) {
 				for (size_t i = 0; i < inst.used_instant; i++) {
-					p_func(&inst.instant[i]);
+					p_func(inst.instant.states[i], inst.instant.bounds[i], inst.instant.data[i]);
 				}
 				for (size_t i = 0; i < inst.delayed.size(); i++) {
-					if (!inst.delayed[i].is_expired())
-						p_func(&inst.delayed[i]);
+					if (!inst.delayed.is_expired(i))
+						p_func(inst.delayed.states[i], inst.delayed.bounds[i], inst.delayed.data[i]);
 				}
 			}
 		}
 	}
+	for (auto &vp_retained : retained_pools) {
+		for (auto &inst : vp_retained.second.instances) {
+			for (size_t i = 0; i < inst.size(); i++) {
+				if (!inst.is_expired(i))
+					p_func(inst.states[i], inst.bounds[i], inst.data[i]);
+			}
+		}
+	}
 }
 
 void GeometryPool::for_each_line(const std::function<void(DelayedRendererLine *)> &p_func) {
@@ -414,24 +773,41 @@ void GeometryPool::for_each_line(const std::function<void(DelayedRendererLine *)
 				p_func(&proc.lines.instant[i]);
 			}
 			for (size_t i = 0; i < proc.lines.delayed.size(); i++) {
-				if (!proc.lines.delayed[i].is_expired())
+				if (!proc.lines.delayed.is_expired(i))
 					p_func(&proc.lines.delayed[i]);
 			}
 		}
 	}
+	for (auto &vp_retained : retained_pools) {
+		auto &lines = vp_retained.second.lines;
+		for (size_t i = 0; i < lines.size(); i++) {
+			if (!lines.is_expired(i))
+				p_func(&lines[i]);
+		}
+	}
 }
 
 void GeometryPool::update_expiration_delta(const double &p_delta, const ProcessType &p_proc) {
 	ZoneScoped;
 
-	if (p_proc == ProcessType::PHYSICS_PROCESS) {
-		physics_delta_sum += p_delta;
-	} else {
-		process_delta_sum += p_delta;
+	expiration_clocks[(int)p_proc] += p_delta;
+}
+
+double GeometryPool::_get_expiration_anchor_time(int p_proc) {
+	// Process objects also count the time between the previous fill and their addition.
+	// Physics objects start counting from the first fill, so they are displayed at least once
+	// even if several physics frames were processed before rendering.
+	if (p_proc == (int)ProcessType::PHYSICS_PROCESS) {
+		return expiration_clocks[p_proc];
 	}
+	return expiration_clocks_at_last_fill[p_proc];
 }
 
 bool GeometryPool::_is_viewport_empty(Viewport *vp) {
+	if (auto it = retained_pools.find(vp); it != retained_pools.end() && it->second.count) {
+		return false;
+	}
+
 	for (auto &proc : pools[vp]) {
 		for (auto &i : proc.instances) {
 			if (i.instant.size() || i.delayed.size()) {
@@ -474,84 +850,529 @@ std::vector<Viewport *> GeometryPool::get_and_validate_viewports() {
 	for (const auto &vp : to_delete) {
 		viewport_ids.erase(vp);
 		pools.erase(vp);
+		retained_pools.erase(vp);
+	}
+
+	if (to_delete.size()) {
+		mark_all_dirty();
 	}
 
 	return res;
 }
 
 void GeometryPool::add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col) {
-	add_or_update_instance(p_cfg, _scoped_config_type_convert(p_type, p_cfg), p_exp_time, p_transform, p_col, p_bounds, p_custom_col);
+	add_or_update_instances(p_cfg, _scoped_config_type_convert(p_type, p_cfg), p_exp_time, 1, &p_transform, &p_bounds, &p_col, 1, p_custom_col);
 }
 
 void GeometryPool::add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col) {
+	add_or_update_instances(p_cfg, p_type, p_exp_time, 1, &p_transform, &p_bounds, &p_col, 1, p_custom_col);
+}
+
+ProcessType GeometryPool::_get_process_type(const ProcessType &p_proc) {
+	if (p_proc != ProcessType::MAX) {
+		return p_proc;
+	}
+	return Engine::get_singleton()->is_in_physics_frame() ? ProcessType::PHYSICS_PROCESS : ProcessType::PROCESS;
+}
+
+void GeometryPool::add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col, const ProcessType &p_proc) {
+	add_or_update_instances(p_cfg, _scoped_config_type_convert(p_type, p_cfg), p_exp_time, p_count, p_transforms, p_bounds, p_colors, p_colors_count, p_custom_col, p_proc);
+}
+
+void GeometryPool::add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col, const ProcessType &p_proc) {
 	ZoneScoped;
-	auto &proc = pools[p_cfg->dcd.viewport][(int)(Engine::get_singleton()->is_in_physics_frame() ? ProcessType::PHYSICS_PROCESS : ProcessType::PROCESS)];
-	DelayedRendererInstance *inst = proc.instances[(int)p_type].get(p_exp_time > 0);
+	if (!p_count)
+		return;
+
+	auto &proc = pools[p_cfg->dcd.viewport][(int)_get_process_type(p_proc)];
+	auto &pool = proc.instances[(int)p_type];
+	const bool is_delayed = p_exp_time > 0;
+	InstancesStorage &storage = is_delayed ? pool.delayed : pool.instant;
 
 	if (viewport_ids.count(p_cfg->dcd.viewport) == 0) {
 		viewport_ids[p_cfg->dcd.viewport] = p_cfg->dcd.viewport_id;
 	}
 
+	if (p_count > 1) {
+		pool.reserve(is_delayed, p_count);
+	}
+
+	is_instances_dirty[(int)p_type] = true;
+
+	const Color custom_col = p_custom_col ? *p_custom_col : _scoped_config_to_custom(p_cfg);
+
+	{
+		// A single zone for all the elements, the per-element zones cost more than the elements
+		ZoneScopedN("Fill instances");
+		ZoneValue(p_count);
+		for (size_t i = 0; i < p_count; i++) {
+			size_t idx = pool.get(is_delayed);
+			_set_instance_data(p_cfg, storage, idx, p_transforms[i], p_colors_count == 1 ? p_colors[0] : p_colors[i], custom_col, p_bounds[i]);
+
+			DelayedRendererState &state = storage.states[idx];
+			state.expiration_time = p_exp_time;
+			state.is_retired = false;
+			state.is_visible = true;
+		}
+	}
+}
+
+void GeometryPool::_set_instance_data(const DebugDraw3DScopeConfig::Data *p_cfg, InstancesStorage &p_storage, const size_t &p_idx, const Transform3D &p_transform, const Color &p_col, const Color &p_custom_col, const SphereBounds &p_bounds) {
+	GeometryPoolData3DInstance &data = p_storage.data[p_idx];
+	const real_t half_thickness = p_cfg->thickness * 0.5f;
+
 	if (p_cfg->custom_xform) {
-		ZoneScopedN("Transform");
 		Transform3D xf = p_cfg->transform * p_transform;
 		auto len_old = MathUtils::get_max_basis_length(p_transform.basis);
 		auto len_new = MathUtils::get_max_basis_length(xf.basis);
-		inst->data = GeometryPoolData3DInstance(xf, p_col, p_custom_col ? *p_custom_col : _scoped_config_to_custom(p_cfg));
-		inst->bounds = SphereBounds(p_cfg->transform.xform(p_bounds.position), (len_new / len_old * p_bounds.radius) + p_cfg->thickness * 0.5f);
+		data = GeometryPoolData3DInstance(xf, p_col);
+		p_storage.bounds[p_idx] = SphereBounds(p_cfg->transform.xform(p_bounds.position), (len_new / len_old * p_bounds.radius) + half_thickness);
 	} else {
-		inst->data = GeometryPoolData3DInstance(p_transform, p_col, p_custom_col ? *p_custom_col : _scoped_config_to_custom(p_cfg));
-		inst->bounds = SphereBounds(p_bounds.position, p_bounds.radius + p_cfg->thickness * 0.5f);
+		data = GeometryPoolData3DInstance(p_transform, p_col);
+		p_storage.bounds[p_idx] = SphereBounds(p_bounds.position, p_bounds.radius + half_thickness);
+	}
+
+	if (p_storage.use_custom_data) {
+		p_storage.custom[p_idx] = p_custom_col;
 	}
 
 #if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
-	{
-		inst->data.origin_x -= (float)owner_dgc->get_center_position().x;
-		inst->data.origin_y -= (float)owner_dgc->get_center_position().y;
-		inst->data.origin_z -= (float)owner_dgc->get_center_position().z;
+	_set_instance_origin(p_storage, p_idx, p_cfg->custom_xform ? p_cfg->transform.xform(p_transform.origin) : p_transform.origin);
+#endif
+}
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+void GeometryPool::_set_instance_origin(InstancesStorage &p_storage, const size_t &p_idx, const Vector3 &p_origin) {
+	const uint32_t cell = _get_position_cell(p_origin);
+	const Vector3 local = p_origin - _get_position_cell_origin(cell);
+
+	GeometryPoolData3DInstance &data = p_storage.data[p_idx];
+	data.origin_x = (float)local.x;
+	data.origin_y = (float)local.y;
+	data.origin_z = (float)local.z;
+	p_storage.cells[p_idx] = cell;
+}
+
+uint32_t GeometryPool::_get_position_cell(const Vector3 &p_position) {
+	const Vector3i cell(
+			(int32_t)Math::floor(p_position.x / POSITION_CELL_SIZE),
+			(int32_t)Math::floor(p_position.y / POSITION_CELL_SIZE),
+			(int32_t)Math::floor(p_position.z / POSITION_CELL_SIZE));
+
+	auto it = position_cell_ids.find(cell);
+	if (it != position_cell_ids.end()) {
+		return it->second;
+	}
+
+	const uint32_t id = (uint32_t)position_cells.size();
+	position_cell_ids[cell] = id;
+	position_cells.push_back(cell);
+	position_cell_unused_checks.push_back(0);
+	return id;
+}
+
+void GeometryPool::_update_position_cell_offsets() {
+	const Vector3 &center = owner_dgc->get_center_position();
+	if (position_cell_offsets.size() == position_cells.size() && position_cells_center == center) {
+		return;
+	}
+	ZoneScoped;
+	ZoneValue(position_cells.size());
+
+	position_cells_center = center;
+	position_cell_offsets.resize(position_cells.size());
+	for (size_t i = 0; i < position_cells.size(); i++) {
+		position_cell_offsets[i] = Vector3Float(_get_position_cell_origin((uint32_t)i) - center);
+	}
+}
+
+template <class TFunc>
+void GeometryPool::_for_each_used_position_cell(TFunc p_func) {
+	auto for_each_line = [&p_func](std::vector<DelayedRendererLine> &p_lines, size_t p_count) {
+		for (size_t i = 0; i < p_count; i++) {
+			if (!p_lines[i].is_expired()) {
+				p_func(p_lines[i].cell);
+			}
+		}
+	};
+
+	auto for_each_instance = [&p_func](InstancesStorage &p_storage, size_t p_count) {
+		for (size_t i = 0; i < p_count; i++) {
+			if (!p_storage.is_expired(i)) {
+				p_func(p_storage.cells[i]);
+			}
+		}
+	};
+
+	for (auto &vp_pool : pools) {
+		for (auto &proc : vp_pool.second) {
+			for (auto &i : proc.instances) {
+				for_each_instance(i.instant, i.used_instant);
+				for_each_instance(i.delayed, i.delayed.size());
+			}
+			for_each_line(proc.lines.instant.objects, proc.lines.used_instant);
+			for_each_line(proc.lines.delayed.objects, proc.lines.delayed.size());
+		}
+	}
+
+	for (auto &vp_retained : retained_pools) {
+		for (auto &i : vp_retained.second.instances) {
+			for_each_instance(i, i.size());
+		}
+		for (auto &l : vp_retained.second.lines.objects) {
+			if (!l.is_expired()) {
+				p_func(l.cell);
+			}
+		}
 	}
+}
+
+void GeometryPool::_prune_position_cells() {
+	if (++position_cells_check_frames < POSITION_CELLS_CHECK_FRAMES) {
+		return;
+	}
+	position_cells_check_frames = 0;
+
+	if (position_cells.empty()) {
+		return;
+	}
+
+	ZoneScoped;
+	ZoneValue(position_cells.size());
+
+	std::vector<uint32_t> &remap = temp_position_cells_remap;
+	remap.assign(position_cells.size(), 0);
+	_for_each_used_position_cell([&remap](uint32_t &p_cell) { remap[p_cell] = 1; });
+
+	bool has_removed = false;
+	for (size_t i = 0; i < position_cells.size(); i++) {
+		if (remap[i]) {
+			position_cell_unused_checks[i] = 0;
+		} else if (++position_cell_unused_checks[i] >= POSITION_CELLS_PRUNE_CHECKS) {
+			has_removed = true;
+		}
+	}
+
+	if (!has_removed) {
+		return;
+	}
+
+	// The remaining cells are moved to the beginning and the objects get their new ids
+	uint32_t new_size = 0;
+	for (size_t i = 0; i < position_cells.size(); i++) {
+		if (position_cell_unused_checks[i] >= POSITION_CELLS_PRUNE_CHECKS) {
+			position_cell_ids.erase(position_cells[i]);
+			continue;
+		}
+
+		remap[i] = new_size;
+		position_cells[new_size] = position_cells[i];
+		position_cell_unused_checks[new_size] = position_cell_unused_checks[i];
+		position_cell_ids[position_cells[new_size]] = new_size;
+		new_size++;
+	}
+
+	DEV_PRINT_STD("Removed %" PRIu64 " position cells, %u left\n", (uint64_t)(position_cells.size() - new_size), new_size);
+	position_cells.resize(new_size);
+	position_cell_unused_checks.resize(new_size);
+	_for_each_used_position_cell([&remap](uint32_t &p_cell) { p_cell = remap[p_cell]; });
+
+	// the offsets are calculated again before the next fill
+	position_cell_offsets.clear();
+}
 #endif
 
-	inst->expiration_time = p_exp_time;
-	inst->is_used_one_time = false;
-	inst->is_visible = true;
+void GeometryPool::add_or_update_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb, const ProcessType &p_proc) {
+	if (p_line_count <= LINES_CHUNK_VERTICES || p_line_count % 2) {
+		_add_line(p_cfg, p_exp_time, p_lines, p_line_count, p_col, p_aabb, p_proc);
+		return;
+	}
+
+	// Large batches are split into chunks with their own bounds, so only the chunks near the cameras are culled in and copied to the mesh.
+	// The segments are sorted by the cells of their centers using the counting sort, so each chunk covers a compact part of the batch.
+	ZoneScopedN("Split lines into chunks");
+	ZoneValue(p_line_count);
+
+	temp_lines_chunk_vertices.resize(p_line_count);
+	MathUtils::sort_lines_by_z_order(p_lines, p_line_count, p_aabb, LINES_CHUNK_GRID_BITS, temp_lines_chunk_cells, temp_lines_chunk_offsets, temp_lines_chunk_vertices.data());
+
+	for (size_t first = 0; first < p_line_count; first += LINES_CHUNK_VERTICES) {
+		const size_t count = std::min(LINES_CHUNK_VERTICES, p_line_count - first);
+		const Vector3 *chunk = temp_lines_chunk_vertices.data() + first;
+		_add_line(p_cfg, p_exp_time, chunk, count, p_col, MathUtils::calculate_vertex_bounds(chunk, count), p_proc);
+	}
 }
 
-void GeometryPool::add_or_update_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb) {
+void GeometryPool::_add_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb, const ProcessType &p_proc) {
 	ZoneScoped;
-	auto &proc = pools[p_cfg->dcd.viewport][(int)(Engine::get_singleton()->is_in_physics_frame() ? ProcessType::PHYSICS_PROCESS : ProcessType::PROCESS)];
-	DelayedRendererLine *inst = proc.lines.get(p_exp_time > 0);
+	auto &proc = pools[p_cfg->dcd.viewport][(int)_get_process_type(p_proc)];
+	const bool is_delayed = p_exp_time > 0;
+	size_t idx = proc.lines.get(is_delayed);
+	DelayedRendererLine *inst = &(is_delayed ? proc.lines.delayed : proc.lines.instant)[idx];
+	is_lines_dirty = true;
 
 	if (viewport_ids.count(p_cfg->dcd.viewport) == 0) {
 		viewport_ids[p_cfg->dcd.viewport] = p_cfg->dcd.viewport_id;
 	}
 
-	inst->lines = std::unique_ptr<Vector3, malloc_free_delete>((Vector3 *)malloc(sizeof(Vector3) * p_line_count));
-	memcpy(inst->lines.get(), p_lines, p_line_count * sizeof(Vector3));
-
+	inst->lines = proc.lines.allocate_vertices(is_delayed, p_line_count);
 	inst->lines_count = p_line_count;
 	inst->color = p_col;
 	inst->expiration_time = p_exp_time;
-	inst->is_used_one_time = false;
+	inst->is_retired = false;
 	inst->is_visible = true;
+	inst->bounds = p_cfg->custom_xform ? p_cfg->transform.xform(p_aabb) : p_aabb;
 
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// The transformed vertices are converted to the offsets from the cell of the line
+	inst->cell = _get_position_cell(inst->bounds.center);
+	const Vector3 cell_origin = _get_position_cell_origin(inst->cell);
 	if (p_cfg->custom_xform) {
 		ZoneScopedN("Transform");
-		inst->bounds = p_cfg->transform.xform(p_aabb);
+		for (size_t i = 0; i < p_line_count; i++) {
+			inst->lines[i] = Vector3Float(p_cfg->transform.xform(p_lines[i]) - cell_origin);
+		}
+	} else {
+		for (size_t i = 0; i < p_line_count; i++) {
+			inst->lines[i] = Vector3Float(p_lines[i] - cell_origin);
+		}
+	}
+#else
+	memcpy(inst->lines, p_lines, p_line_count * sizeof(Vector3));
 
+	if (p_cfg->custom_xform) {
+		ZoneScopedN("Transform");
 		for (size_t i = 0; i < inst->lines_count; i++) {
-			auto &v = inst->lines.get()[i];
+			auto &v = inst->lines[i];
 			v = p_cfg->transform.xform(v);
 		}
+	}
+#endif
+}
+
+GeometryPool::RetainedPools &GeometryPool::_get_or_create_retained_pools(const DebugDraw3DScopeConfig::Data *p_cfg) {
+	// Serial numbers are unique across all pools, so an old id never points to a recreated storage
+	static uint64_t retained_pools_serial = 0;
+
+	Viewport *vp = p_cfg->dcd.viewport;
+	if (viewport_ids.count(vp) == 0) {
+		viewport_ids[vp] = p_cfg->dcd.viewport_id;
+	}
+
+	// retained objects are filled together with the other objects of the viewport
+	pools[vp];
+
+	RetainedPools &retained = retained_pools[vp];
+	if (!retained.serial) {
+		retained.serial = ++retained_pools_serial;
+	}
+	return retained;
+}
+
+GeometryPool::RetainedPools *GeometryPool::_get_retained_pools(const RetainedObjectId &p_id) {
+	auto it = retained_pools.find(p_id.viewport);
+	if (it == retained_pools.end() || it->second.serial != p_id.storage_serial) {
+		return nullptr;
+	}
+
+	RetainedPools &retained = it->second;
+	if (p_id.type == InstanceType::MAX) {
+		if (p_id.idx >= retained.lines.size() || retained.lines.is_expired(p_id.idx)) {
+			return nullptr;
+		}
 	} else {
-		inst->bounds = p_aabb;
+		const InstancesStorage &storage = retained.instances[(int)p_id.type];
+		if (p_id.idx >= storage.size() || storage.is_expired(p_id.idx)) {
+			return nullptr;
+		}
 	}
+	return &retained;
+}
+
+void GeometryPool::_update_retained_line_vertices(RetainedPools &p_pools, RetainedLine &p_line) {
+	ZoneScoped;
+	if (p_line.is_expired()) {
+		return;
+	}
+
+	p_line.bounds = p_line.transform.xform(p_line.local_aabb);
 
 #if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
-	for (size_t l = 0; l < p_line_count; l++) {
-		inst->lines.get()[l] -= owner_dgc->get_center_position();
+	p_line.cell = _get_position_cell(p_line.bounds.center);
+	const Vector3 cell_origin = _get_position_cell_origin(p_line.cell);
+	for (size_t i = 0; i < p_line.lines_count; i++) {
+		p_line.lines[i] = Vector3Float(p_line.transform.xform(p_line.local_lines[i]) - cell_origin);
+	}
+#else
+	for (size_t i = 0; i < p_line.lines_count; i++) {
+		p_line.lines[i] = p_line.transform.xform(p_line.local_lines[i]);
 	}
 #endif
+
+	p_line.is_dirty = false;
+}
+
+RetainedObjectId GeometryPool::add_retained_instance(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds) {
+	ZoneScoped;
+	RetainedPools &retained = _get_or_create_retained_pools(p_cfg);
+	InstanceType type = _scoped_config_type_convert(p_type, p_cfg);
+	InstancesStorage &storage = retained.instances[(int)type];
+	std::vector<size_t> &free_slots = retained.free_instances[(int)type];
+
+	size_t idx;
+	if (free_slots.size()) {
+		idx = free_slots.back();
+		free_slots.pop_back();
+	} else {
+		idx = storage.size();
+		storage.resize(idx + 1);
+	}
+
+	_set_instance_data(p_cfg, storage, idx, p_transform, p_col, _scoped_config_to_custom(p_cfg), p_bounds);
+
+	DelayedRendererState &state = storage.states[idx];
+	state.is_retired = false;
+	state.is_hidden = false;
+	state.is_visible = true;
+	retained.count++;
+	_mark_dirty(type);
+
+	RetainedObjectId id;
+	id.viewport = p_cfg->dcd.viewport;
+	id.storage_serial = retained.serial;
+	id.type = type;
+	id.idx = (uint32_t)idx;
+	id.bounds_padding = (float)(p_cfg->thickness * 0.5f);
+	return id;
+}
+
+RetainedObjectId GeometryPool::add_retained_line(const DebugDraw3DScopeConfig::Data *p_cfg, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col) {
+	ZoneScoped;
+	RetainedPools &retained = _get_or_create_retained_pools(p_cfg);
+
+	size_t idx;
+	if (retained.free_lines.size()) {
+		idx = retained.free_lines.back();
+		retained.free_lines.pop_back();
+	} else {
+		idx = retained.lines.size();
+		retained.lines.resize(idx + 1);
+	}
+
+	RetainedLine &line = retained.lines[idx];
+	line.local_lines = retained.vertices.allocate(p_line_count);
+	line.lines = retained.line_vertices.allocate(p_line_count);
+	line.lines_count = p_line_count;
+	memcpy(line.local_lines, p_lines, p_line_count * sizeof(Vector3));
+
+	line.local_aabb = MathUtils::calculate_vertex_bounds(p_lines, p_line_count);
+	line.transform = p_cfg->custom_xform ? p_cfg->transform : Transform3D();
+	line.color = p_col;
+	line.is_retired = false;
+	line.is_hidden = false;
+	line.is_visible = true;
+	_update_retained_line_vertices(retained, line);
+	retained.count++;
+	is_lines_dirty = true;
+
+	RetainedObjectId id;
+	id.viewport = p_cfg->dcd.viewport;
+	id.storage_serial = retained.serial;
+	id.type = InstanceType::MAX;
+	id.idx = (uint32_t)idx;
+	return id;
+}
+
+bool GeometryPool::update_retained_transform(const RetainedObjectId &p_id, const Transform3D &p_transform, const SphereBounds &p_bounds) {
+	ZoneScoped;
+	RetainedPools *retained = _get_retained_pools(p_id);
+	if (!retained) {
+		return false;
+	}
+	_mark_dirty(p_id.type);
+
+	if (p_id.type == InstanceType::MAX) {
+		// vertices will be transformed only once before the next fill
+		RetainedLine &line = retained->lines[p_id.idx];
+		line.transform = p_transform;
+		if (!line.is_dirty) {
+			line.is_dirty = true;
+			retained->dirty_lines.push_back(p_id.idx);
+		}
+		return true;
+	}
+
+	InstancesStorage &storage = retained->instances[(int)p_id.type];
+	GeometryPoolData3DInstance &data = storage.data[p_id.idx];
+	data = GeometryPoolData3DInstance(p_transform, data.color);
+	storage.bounds[p_id.idx] = SphereBounds(p_bounds.position, p_bounds.radius + p_id.bounds_padding);
+
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	_set_instance_origin(storage, p_id.idx, p_transform.origin);
+#endif
+	return true;
+}
+
+bool GeometryPool::set_retained_color(const RetainedObjectId &p_id, const Color &p_col) {
+	ZoneScoped;
+	RetainedPools *retained = _get_retained_pools(p_id);
+	if (!retained) {
+		return false;
+	}
+	_mark_dirty(p_id.type);
+
+	if (p_id.type == InstanceType::MAX) {
+		retained->lines[p_id.idx].color = p_col;
+	} else {
+		retained->instances[(int)p_id.type].data[p_id.idx].color = p_col;
+	}
+	return true;
+}
+
+bool GeometryPool::set_retained_visible(const RetainedObjectId &p_id, const bool &p_visible) {
+	ZoneScoped;
+	RetainedPools *retained = _get_retained_pools(p_id);
+	if (!retained) {
+		return false;
+	}
+	_mark_dirty(p_id.type);
+
+	if (p_id.type == InstanceType::MAX) {
+		retained->lines[p_id.idx].is_hidden = !p_visible;
+	} else {
+		retained->instances[(int)p_id.type].states[p_id.idx].is_hidden = !p_visible;
+	}
+	return true;
+}
+
+bool GeometryPool::remove_retained(const RetainedObjectId &p_id) {
+	ZoneScoped;
+	RetainedPools *retained = _get_retained_pools(p_id);
+	if (!retained) {
+		return false;
+	}
+	_mark_dirty(p_id.type);
+
+	if (p_id.type == InstanceType::MAX) {
+		RetainedLine &line = retained->lines[p_id.idx];
+		retained->vertices.free(line.local_lines, line.lines_count);
+		retained->line_vertices.free(line.lines, line.lines_count);
+		line.local_lines = nullptr;
+		line.lines = nullptr;
+		line.lines_count = 0;
+		line.is_dirty = false;
+		line.is_retired = true;
+		line.is_visible = false;
+		retained->free_lines.push_back(p_id.idx);
+	} else {
+		DelayedRendererState &state = retained->instances[(int)p_id.type].states[p_id.idx];
+		state.is_retired = true;
+		state.is_visible = false;
+		retained->free_instances[(int)p_id.type].push_back(p_id.idx);
+	}
+
+	retained->count--;
+	return true;
 }
 
 GeometryType GeometryPool::_scoped_config_get_geometry_type(const DebugDraw3DScopeConfig::Data *p_cfg) {
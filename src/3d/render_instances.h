@@ -2,37 +2,153 @@
 
 #ifndef DISABLE_DEBUG_RENDERING
 
+#include "common/expiration_queue.h"
+#include "common/pool_allocators.h"
 #include "config_scope_3d.h"
+#include "culling_bvh.h"
+#include "culling_kernels.h"
 #include "render_instances_enums.h"
 #include "utils/math_utils.h"
 #include "utils/utils.h"
 
+#include <algorithm>
 #include <array>
 #include <functional>
 #include <unordered_set>
 
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/classes/array_mesh.hpp>
+#include <godot_cpp/templates/hashfuncs.hpp>
 GODOT_WARNING_RESTORE()
 using namespace godot;
 
-namespace godot {
-class MultiMesh;
-}
 class DebugDraw3DStats;
 class GeometryPool;
 class DebugGeometryContainer;
+struct MultiMeshStorage;
+struct ImmediateMeshStorage;
+
+// A camera used to calculate the distance to instances and their size on the screen
+struct CullingCamera {
+	culling_real_t x, y, z;
+	// The size in pixels of an object with a size of 1 at a distance of 1, or at any distance for orthogonal cameras
+	float pixels_per_unit;
+	bool is_orthogonal;
+};
+
+// A camera of the World3D for the geometry that is not culled by the GeometryPool
+struct WorldCamera {
+	Vector3 position;
+	// Half of the visible height for orthogonal cameras, `0` for perspective cameras
+	real_t orthogonal_half_height;
+};
+
+struct GeometryPoolLODSettings {
+	float min_screen_size = 0;
+	float hd_sphere_distance = 0;
+	float volumetric_distance = 0;
+};
 
 class GeometryPoolCullingData {
 public:
 	std::vector<std::array<Plane, 6>> m_frustums;
 	std::vector<AABBMinMax> m_frustum_boxes;
-	GeometryPoolCullingData(const std::vector<std::array<Plane, 6>> &p_frustums, const std::vector<AABBMinMax> p_frustum_boxes) {
+
+	// Compact copies of the frustums for the culling of instances
+	std::vector<CullingFrustum> m_culling_frustums;
+	std::vector<CullingBox> m_culling_boxes;
+
+	std::vector<CullingCamera> m_cameras;
+	GeometryPoolLODSettings m_lod;
+	bool m_is_lod_used;
+
+	// Used to detect that the cameras have not moved since the previous frame
+	uint32_t m_hash;
+
+	GeometryPoolCullingData(const std::vector<std::array<Plane, 6>> &p_frustums, const std::vector<AABBMinMax> p_frustum_boxes, const std::vector<CullingCamera> &p_cameras = {}, const GeometryPoolLODSettings &p_lod = {}) {
 		m_frustums = p_frustums;
 		m_frustum_boxes = p_frustum_boxes;
+		m_cameras = p_cameras;
+		m_lod = p_lod;
+		m_is_lod_used = m_cameras.size() && (m_lod.min_screen_size > 0 || m_lod.hd_sphere_distance > 0 || m_lod.volumetric_distance > 0);
+
+		m_culling_frustums.reserve(m_frustums.size());
+		for (const auto &f : m_frustums) {
+			CullingFrustum cf;
+			for (size_t i = 0; i < f.size(); i++) {
+				cf[i] = f[i];
+			}
+			m_culling_frustums.push_back(cf);
+		}
+
+		m_culling_boxes.reserve(m_frustum_boxes.size());
+		for (const auto &b : m_frustum_boxes) {
+			m_culling_boxes.push_back(b);
+		}
+
+		m_hash = hash_murmur3_one_32((uint32_t)m_culling_boxes.size());
+		m_hash = hash_murmur3_one_32((uint32_t)m_culling_frustums.size(), m_hash);
+		for (const auto &b : m_culling_boxes) {
+			m_hash = hash_murmur3_buffer(&b, (int)sizeof(CullingBox), m_hash);
+		}
+		for (const auto &f : m_culling_frustums) {
+			m_hash = hash_murmur3_buffer(f.data(), (int)(sizeof(CullingPlane) * f.size()), m_hash);
+		}
+		if (m_is_lod_used) {
+			m_hash = hash_murmur3_buffer(&m_lod, (int)sizeof(GeometryPoolLODSettings), m_hash);
+			for (const auto &c : m_cameras) {
+				m_hash = hash_murmur3_buffer(&c.x, (int)(sizeof(culling_real_t) * 3), m_hash);
+				m_hash = hash_murmur3_one_float(c.pixels_per_unit, m_hash);
+				m_hash = hash_murmur3_one_32((uint32_t)c.is_orthogonal, m_hash);
+			}
+		}
+	}
+
+	_FORCE_INLINE_ bool is_visible(const CullingSphere &p_sphere) const {
+		return CullingKernels::is_sphere_visible(p_sphere, m_culling_boxes.data(), m_culling_boxes.size(), m_culling_frustums.data(), m_culling_frustums.size());
+	}
+
+	_FORCE_INLINE_ void cull(const CullingSphere *p_spheres, size_t p_count, uint64_t *r_mask) const {
+		CullingKernels::cull_spheres(p_spheres, p_count, m_culling_boxes.data(), m_culling_boxes.size(), m_culling_frustums.data(), m_culling_frustums.size(), r_mask);
+	}
+
+	// Returns the type to draw a visible instance with depending on the distance to the nearest camera,
+	// or `InstanceType::MAX` if the instance is too small on the screen of every camera.
+	_FORCE_INLINE_ InstanceType get_lod_type(const InstanceType &p_type, const CullingSphere &p_sphere) const {
+		if (!m_is_lod_used) {
+			return p_type;
+		}
+
+		float min_distance = FLT_MAX;
+		float max_screen_size = 0;
+		for (const auto &c : m_cameras) {
+			const culling_real_t dx = p_sphere.x - c.x;
+			const culling_real_t dy = p_sphere.y - c.y;
+			const culling_real_t dz = p_sphere.z - c.z;
+			const float distance = (float)std::sqrt(dx * dx + dy * dy + dz * dz);
+			min_distance = std::min(min_distance, distance);
+
+			const float screen_size = (float)p_sphere.radius * 2 * c.pixels_per_unit;
+			max_screen_size = std::max(max_screen_size, c.is_orthogonal ? screen_size : screen_size / std::max(distance, 0.0001f));
+		}
+
+		if (max_screen_size < m_lod.min_screen_size) {
+			return InstanceType::MAX;
+		}
+
+		InstanceType res = p_type;
+		if (m_lod.volumetric_distance > 0 && min_distance > m_lod.volumetric_distance) {
+			res = get_instance_wireframe_type(res);
+		}
+		if (m_lod.hd_sphere_distance > 0 && min_distance > m_lod.hd_sphere_distance) {
+			res = get_instance_low_detail_type(res);
+		}
+		return res;
 	}
 };
 
+// The layout must match the MultiMesh buffer with `TRANSFORM_3D` and colors.
+// The custom data is stored separately and only for the types that use it.
 struct GeometryPoolData3DInstance {
 	Vector3Float basis_x;
 	float origin_x;
@@ -41,7 +157,6 @@ struct GeometryPoolData3DInstance {
 	Vector3Float basis_z;
 	float origin_z;
 	Color color;
-	Color custom;
 
 	GeometryPoolData3DInstance() :
 			basis_x(),
@@ -50,49 +165,67 @@ struct GeometryPoolData3DInstance {
 			origin_y(0),
 			basis_z(),
 			origin_z(0),
-			color(Color()),
-			custom(Color()) {}
+			color(Color()) {}
 
-	GeometryPoolData3DInstance(const Transform3D &p_xf, const Color &p_color, const Color &p_custom) :
+	GeometryPoolData3DInstance(const Transform3D &p_xf, const Color &p_color) :
 			basis_x(p_xf.basis[0]),
 			origin_x((float)p_xf.origin.x),
 			basis_y(p_xf.basis[1]),
 			origin_y((float)p_xf.origin.y),
 			basis_z(p_xf.basis[2]),
 			origin_z((float)p_xf.origin.z),
-			color(p_color),
-			custom(p_custom) {}
+			color(p_color) {}
 };
+static_assert(sizeof(GeometryPoolData3DInstance) == sizeof(float) * 16, "GeometryPoolData3DInstance must be tightly packed.");
 
-struct DelayedRenderer {
+struct DelayedRendererState {
+	// The duration of a delayed object until its first fill, then the deadline on the clock of its process type
 	double expiration_time;
-	bool is_used_one_time;
+	bool is_retired;
 	bool is_visible;
-	AABBMinMax bounds;
+	// Hidden retained objects keep their slots, but are not drawn
+	bool is_hidden;
 
-	DelayedRenderer() :
-			expiration_time(-1),
-			is_used_one_time(true),
+	DelayedRendererState() :
+			expiration_time(0),
+			is_retired(true),
 			is_visible(false),
-			bounds() {}
+			is_hidden(false) {}
 
 	_FORCE_INLINE_ bool is_expired() const {
-		return expiration_time < 0 ? is_used_one_time : false;
+		return is_retired;
 	}
 
-	_FORCE_INLINE_ bool update_visibility(const std::shared_ptr<GeometryPoolCullingData> &p_culling_data);
+	_FORCE_INLINE_ bool is_drawable() const {
+		return !is_retired && !is_hidden;
+	}
 };
 
-struct DelayedRendererInstance : public DelayedRenderer {
-	GeometryPoolData3DInstance data;
+struct DelayedRenderer : public DelayedRendererState {
+	AABBMinMax bounds;
+
+	DelayedRenderer() :
+			DelayedRendererState(),
+			bounds() {}
 
-	DelayedRendererInstance();
+	_FORCE_INLINE_ bool update_visibility(const std::shared_ptr<GeometryPoolCullingData> &p_culling_data);
 };
 
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+// Offset from the origin of the position cell of the line
+using LineVertex = Vector3Float;
+#else
+using LineVertex = Vector3;
+#endif
+
 struct DelayedRendererLine : public DelayedRenderer {
-	std::unique_ptr<Vector3, malloc_free_delete> lines;
+	// Owned by the allocators of the lines pool
+	LineVertex *lines;
 	size_t lines_count;
 	Color color;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	uint32_t cell = 0;
+#endif
 
 	DelayedRendererLine();
 };
@@ -107,58 +240,303 @@ private:
 	bool is_no_depth_test = false;
 	DebugGeometryContainer *owner_dgc = nullptr;
 
+	// Instances are stored as parallel arrays, so the culling pass only reads the compact bounds and states,
+	// and the GPU payload is touched only for the visible instances.
+	struct InstancesStorage {
+		std::vector<DelayedRendererState> states = {};
+		std::vector<CullingSphere> bounds = {};
+		std::vector<GeometryPoolData3DInstance> data = {};
+		// Empty if the type does not use the custom data
+		std::vector<Color> custom = {};
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		// Position cells of the origins in `data`
+		std::vector<uint32_t> cells = {};
+#endif
+		bool use_custom_data = false;
+
+		_FORCE_INLINE_ size_t size() const {
+			return states.size();
+		}
+
+		_FORCE_INLINE_ bool is_expired(size_t p_idx) const {
+			return states[p_idx].is_expired();
+		}
+
+		_FORCE_INLINE_ DelayedRendererState &get_state(size_t p_idx) {
+			return states[p_idx];
+		}
+
+		_FORCE_INLINE_ CullingSphere get_culling_sphere(size_t p_idx) const {
+			return bounds[p_idx];
+		}
+
+		void resize(size_t p_size) {
+			states.resize(p_size);
+			bounds.resize(p_size);
+			data.resize(p_size);
+			if (use_custom_data) {
+				custom.resize(p_size);
+			}
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+			cells.resize(p_size);
+#endif
+		}
+
+		void clear() {
+			states.clear();
+			bounds.clear();
+			data.clear();
+			custom.clear();
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+			cells.clear();
+#endif
+		}
+
+		void remove_expired() {
+			size_t new_size = 0;
+			for (size_t i = 0; i < states.size(); i++) {
+				if (!states[i].is_expired()) {
+					if (i != new_size) {
+						states[new_size] = states[i];
+						bounds[new_size] = bounds[i];
+						data[new_size] = data[i];
+						if (use_custom_data) {
+							custom[new_size] = custom[i];
+						}
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+						cells[new_size] = cells[i];
+#endif
+					}
+					new_size++;
+				}
+			}
+			resize(new_size);
+		}
+	};
+
 	template <class TInst>
+	struct ObjectsStorage {
+		std::vector<TInst> objects = {};
+
+		_FORCE_INLINE_ TInst &operator[](size_t p_idx) {
+			return objects[p_idx];
+		}
+
+		_FORCE_INLINE_ size_t size() const {
+			return objects.size();
+		}
+
+		_FORCE_INLINE_ bool is_expired(size_t p_idx) const {
+			return objects[p_idx].is_expired();
+		}
+
+		_FORCE_INLINE_ DelayedRendererState &get_state(size_t p_idx) {
+			return objects[p_idx];
+		}
+
+		_FORCE_INLINE_ CullingSphere get_culling_sphere(size_t p_idx) const {
+			return SphereBounds(objects[p_idx].bounds.center, objects[p_idx].bounds.radius);
+		}
+
+		void resize(size_t p_size) {
+			objects.resize(p_size);
+		}
+
+		void clear() {
+			objects.clear();
+		}
+
+		// `p_on_remove` is called for each removed object
+		template <class TFunc>
+		void remove_expired(TFunc p_on_remove) {
+			size_t new_size = 0;
+			for (size_t i = 0; i < objects.size(); i++) {
+				if (objects[i].is_expired()) {
+					p_on_remove(objects[i]);
+					continue;
+				}
+
+				if (i != new_size) {
+					objects[new_size] = objects[i];
+				}
+				new_size++;
+			}
+			objects.resize(new_size);
+		}
+
+		void remove_expired() {
+			remove_expired([](TInst &) {});
+		}
+	};
+
+	template <class TStorage>
 	struct ObjectsPool {
-		std::vector<TInst> instant = {};
-		std::vector<TInst> delayed = {};
+		TStorage instant = {};
+		TStorage delayed = {};
+
+		// The deadlines of the delayed objects
+		ExpirationQueue expiration_queue = {};
+		// Delayed objects added since the last fill. Their deadlines are calculated during the next fill
+		std::vector<size_t> pending_delayed = {};
+		// Retired slots of `delayed` ready for reuse
+		std::vector<size_t> free_delayed = {};
+		// The tree is used for culling only if there are a lot of delayed objects
+		CullingBVH delayed_tree = {};
+		// Delayed objects marked as visible by the last `query_delayed`
+		std::vector<size_t> visible_delayed = {};
 
 		size_t used_instant = 0;
 		size_t used_delayed = 0;
 		size_t _prev_used_instant = 0;
-		size_t _prev_not_expired_delayed = 0;
 		double time_used_less_then_half_of_instant_pool = TIME_USED_TO_SHRINK_INSTANT;
 		double time_used_less_then_half_of_delayed_pool = TIME_USED_TO_SHRINK_DELAYED;
 
 	private:
-		_FORCE_INLINE_ TInst *get_internal(bool is_delayed, std::vector<TInst> &objs, size_t &used) {
+		void grow_delayed(size_t p_count) {
+			size_t old_size = delayed.size();
+			delayed.resize(old_size + p_count);
+			// the slots with lower indexes will be used first
+			for (size_t i = delayed.size(); i > old_size; i--) {
+				free_delayed.push_back(i - 1);
+			}
+		}
+
+		void rebuild_expiration_queue() {
+			expiration_queue.clear();
+			free_delayed.clear();
+			for (size_t i = 0; i < delayed.size(); i++) {
+				if (delayed.is_expired(i)) {
+					free_delayed.push_back(i);
+				} else {
+					expiration_queue.push(delayed.get_state(i).expiration_time, i);
+				}
+			}
+		}
+
+	public:
+		// Returns the index of a free object in `instant` or `delayed`
+		// Called for each element of the bulk calls, so it has no profiler zone
+		size_t get(bool is_delayed) {
 			if (is_delayed) {
-				while (objs.size() != used) {
-					if ((objs[used]).is_expired()) {
-						return &objs[used++];
-					}
-					used++;
+				if (free_delayed.empty()) {
+					grow_delayed(Math::clamp((int)delayed.size(), 2, 1024));
 				}
+
+				size_t idx = free_delayed.back();
+				free_delayed.pop_back();
+				pending_delayed.push_back(idx);
+				used_delayed++;
+				return idx;
 			} else {
-				if (objs.size() != used) {
-					return &objs[used++];
+				if (instant.size() == used_instant) {
+					instant.resize(instant.size() + Math::clamp((int)instant.size(), 2, 1024));
 				}
+				return used_instant++;
 			}
-
-			int to_create = Math::clamp((int)objs.size(), 2, 1024);
-			for (int i = 0; i < to_create; i++) {
-				objs.push_back(TInst());
-			}
-			return &objs[used++];
 		}
 
-	public:
-		TInst *get(bool is_delayed) {
+		// Grows the storage once so that the next `p_count` calls of `get` do not resize it
+		void reserve(bool is_delayed, size_t p_count) {
 			ZoneScoped;
 			if (is_delayed) {
-				return get_internal(is_delayed, delayed, _prev_not_expired_delayed);
+				if (free_delayed.size() < p_count) {
+					grow_delayed(p_count - free_delayed.size());
+				}
 			} else {
-				return get_internal(is_delayed, instant, used_instant);
+				if (instant.size() - used_instant < p_count) {
+					instant.resize(used_instant + p_count);
+				}
 			}
 		}
 
+		// Returns true if the next `update_expiration` with `p_time` will change the delayed objects
+		_FORCE_INLINE_ bool is_expiration_due(double p_time) const {
+			return pending_delayed.size() || expiration_queue.is_due(p_time);
+		}
+
+		// Calculates the deadlines of the new delayed objects relative to `p_anchor_time`
+		// and retires the objects whose deadlines are earlier than `p_time`.
+		// `p_on_retire` is called with the index of each retired object.
+		template <class TFunc>
+		void update_expiration(double p_anchor_time, double p_time, TFunc p_on_retire) {
+			ZoneScoped;
+			for (size_t idx : pending_delayed) {
+				DelayedRendererState &state = delayed.get_state(idx);
+				state.expiration_time += p_anchor_time;
+				expiration_queue.push(state.expiration_time, idx);
+				delayed_tree.update(idx, delayed.get_culling_sphere(idx));
+			}
+			pending_delayed.clear();
+
+			expiration_queue.pop_expired(p_time, [this, &p_on_retire](size_t p_idx) {
+				DelayedRendererState &state = delayed.get_state(p_idx);
+				state.is_retired = true;
+				state.is_visible = false;
+				p_on_retire(p_idx);
+
+				free_delayed.push_back(p_idx);
+				used_delayed--;
+			});
+		}
+
+		// Builds or drops the tree of the delayed objects depending on their number.
+		// Must be called after `update_expiration`. Returns true if `query_delayed` can be used.
+		bool update_culling_tree() {
+			if (delayed.size() < CullingBVH::MIN_SLOTS_COUNT) {
+				if (delayed_tree.is_built()) {
+					delayed_tree.clear();
+					visible_delayed.clear();
+				}
+				return false;
+			}
+
+			if (delayed_tree.is_rebuild_required(delayed.size())) {
+				ZoneScopedN("Rebuild culling tree");
+				std::vector<CullingSphere> spheres(delayed.size());
+				for (size_t i = 0; i < delayed.size(); i++) {
+					spheres[i] = delayed.get_culling_sphere(i);
+					// the linear culling could leave the objects visible
+					delayed.get_state(i).is_visible = false;
+				}
+				delayed_tree.build(spheres.data(), spheres.size());
+				visible_delayed.clear();
+			}
+			return true;
+		}
+
+		// Calls `p_func(size_t idx, bool is_inside) -> bool` for the delayed objects that can be visible.
+		// `p_func` must return true if the object is visible. The other objects become invisible.
+		template <class TFunc>
+		void query_delayed(const GeometryPoolCullingData *p_culling_data, TFunc p_func) {
+			ZoneScoped;
+			for (size_t idx : visible_delayed) {
+				delayed.get_state(idx).is_visible = false;
+			}
+			visible_delayed.clear();
+
+			delayed_tree.query(delayed.size(), p_culling_data->m_culling_boxes.data(), p_culling_data->m_culling_boxes.size(), p_culling_data->m_culling_frustums.data(), p_culling_data->m_culling_frustums.size(),
+					[this, &p_func](size_t p_idx, bool p_is_inside) {
+						if (p_func(p_idx, p_is_inside)) {
+							delayed.get_state(p_idx).is_visible = true;
+							visible_delayed.push_back(p_idx);
+						}
+					});
+		}
+
 		void reset_counter(double delta, int custom_type_of_buffer = 0) {
+			reset_counter(delta, custom_type_of_buffer, [this]() { delayed.remove_expired(); });
+		}
+
+		// `p_remove_expired` removes the expired objects from `delayed` when the pool is shrinking
+		template <class TFunc>
+		void reset_counter(double delta, int custom_type_of_buffer, TFunc p_remove_expired) {
 			ZoneScoped;
 			if (instant.size() && used_instant <= (instant.size() * 0.5)) {
 				time_used_less_then_half_of_instant_pool -= delta;
 				if (time_used_less_then_half_of_instant_pool <= 0) {
 					time_used_less_then_half_of_instant_pool = TIME_USED_TO_SHRINK_INSTANT;
 
-					DEV_PRINT_STD("Shrinking instant buffer for %s. From %" PRIu64 ", to %" PRIu64 ". Buffer type: %d\n", typeid(TInst).name(), instant.size(), used_instant, custom_type_of_buffer);
+					DEV_PRINT_STD("Shrinking instant buffer for %s. From %" PRIu64 ", to %" PRIu64 ". Buffer type: %d\n", typeid(TStorage).name(), instant.size(), used_instant, custom_type_of_buffer);
 
 					instant.resize(used_instant);
 				}
@@ -168,18 +546,21 @@ private:
 
 			_prev_used_instant = used_instant;
 			used_instant = 0;
-			_prev_not_expired_delayed = 0;
 
 			if (delayed.size() && used_delayed <= (delayed.size() * 0.5)) {
 				time_used_less_then_half_of_delayed_pool -= delta;
-				if (time_used_less_then_half_of_delayed_pool <= 0) {
+				// the indexes of the pending objects would be invalidated, so wait for the next fill
+				if (time_used_less_then_half_of_delayed_pool <= 0 && pending_delayed.empty()) {
 					time_used_less_then_half_of_delayed_pool = TIME_USED_TO_SHRINK_DELAYED;
 
 					size_t old_size = delayed.size();
-					delayed.erase(std::remove_if(delayed.begin(), delayed.end(), [this](auto &i) { return i.is_expired(); }),
-							delayed.end());
+					p_remove_expired();
+					rebuild_expiration_queue();
+					// the indexes have changed
+					delayed_tree.clear();
+					visible_delayed.clear();
 
-					DEV_PRINT_STD("Shrinking _delayed_ buffer for %s. From %" PRIu64 ", to %" PRIu64 ". Buffer type: %d\n", typeid(TInst).name(), old_size, delayed.size(), custom_type_of_buffer);
+					DEV_PRINT_STD("Shrinking _delayed_ buffer for %s. From %" PRIu64 ", to %" PRIu64 ". Buffer type: %d\n", typeid(TStorage).name(), old_size, delayed.size(), custom_type_of_buffer);
 				}
 			} else {
 				time_used_less_then_half_of_delayed_pool = TIME_USED_TO_SHRINK_DELAYED;
@@ -189,27 +570,161 @@ private:
 		void clear_pools() {
 			instant.clear();
 			delayed.clear();
+			expiration_queue.clear();
+			pending_delayed.clear();
+			free_delayed.clear();
+			delayed_tree.clear();
+			visible_delayed.clear();
 			used_instant = 0;
 			used_delayed = 0;
 			_prev_used_instant = 0;
-			_prev_not_expired_delayed = 0;
 			time_used_less_then_half_of_instant_pool = 0;
 			time_used_less_then_half_of_delayed_pool = 0;
 		}
 	};
 
+	struct LinesPool : public ObjectsPool<ObjectsStorage<DelayedRendererLine>> {
+		// Vertices of instant lines are needed only until the next reset of the counter.
+		LinearArena<LineVertex> instant_vertices = LinearArena<LineVertex>(16384);
+		// Vertices of delayed lines are reused by the next lines of the same size class.
+		SizeClassAllocator<LineVertex> delayed_vertices;
+
+		LineVertex *allocate_vertices(bool is_delayed, size_t p_count) {
+			return is_delayed ? delayed_vertices.allocate(p_count) : instant_vertices.allocate(p_count);
+		}
+
+		void free_vertices(DelayedRendererLine &p_line) {
+			delayed_vertices.free(p_line.lines, p_line.lines_count);
+			p_line.lines = nullptr;
+			p_line.lines_count = 0;
+		}
+
+		void reset_counter(double delta) {
+			size_t old_instant_size = instant.size();
+			size_t old_delayed_size = delayed.size();
+			// Expired lines release their vertices when they are retired, but the removed objects must not keep any blocks
+			ObjectsPool::reset_counter(delta, 0, [this]() {
+				delayed.remove_expired([this](DelayedRendererLine &p_line) { free_vertices(p_line); });
+			});
+
+			instant_vertices.reset();
+			if (instant.size() != old_instant_size) {
+				instant_vertices.trim();
+			}
+
+			// The classes that are no longer used return their memory after the pool has shrunk
+			if (delayed.size() == 0) {
+				delayed_vertices.clear();
+			} else if (delayed.size() != old_delayed_size) {
+				delayed_vertices.trim();
+			}
+		}
+
+		void clear_pools() {
+			ObjectsPool::clear_pools();
+			instant_vertices.clear();
+			delayed_vertices.clear();
+		}
+	};
+
 	struct processTypePools {
-		ObjectsPool<DelayedRendererInstance> instances[(int)InstanceType::MAX];
-		ObjectsPool<DelayedRendererLine> lines;
+		ObjectsPool<InstancesStorage> instances[(int)InstanceType::MAX];
+		LinesPool lines;
+
+		processTypePools() {
+			for (int i = 0; i < (int)InstanceType::MAX; i++) {
+				instances[i].instant.use_custom_data = is_instance_custom_data_used((InstanceType)i);
+				instances[i].delayed.use_custom_data = is_instance_custom_data_used((InstanceType)i);
+			}
+		}
+	};
+
+	struct RetainedLine : public DelayedRendererLine {
+		// Vertices and bounds before applying the `transform`
+		Vector3 *local_lines = nullptr;
+		AABB local_aabb;
+		Transform3D transform;
+		bool is_dirty = false;
+	};
+
+	// Objects that are kept until they are removed. Free slots are reused by the new objects.
+	struct RetainedPools {
+		uint64_t serial = 0;
+		size_t count = 0;
+		InstancesStorage instances[(int)InstanceType::MAX];
+		std::vector<size_t> free_instances[(int)InstanceType::MAX];
+		ObjectsStorage<RetainedLine> lines;
+		std::vector<size_t> free_lines;
+		// Lines whose vertices will be transformed before the next fill
+		std::vector<size_t> dirty_lines;
+		SizeClassAllocator<Vector3> vertices;
+		SizeClassAllocator<LineVertex> line_vertices;
+
+		RetainedPools() {
+			for (int i = 0; i < (int)InstanceType::MAX; i++) {
+				instances[i].use_custom_data = is_instance_custom_data_used((InstanceType)i);
+			}
+		}
 	};
 
 	std::unordered_map<Viewport *, processTypePools[(int)ProcessType::MAX]> pools;
+	std::unordered_map<Viewport *, RetainedPools> retained_pools;
 	std::unordered_map<Viewport *, uint64_t> viewport_ids;
 
-	double process_delta_sum = 0;
-	double physics_delta_sum = 0;
+	// Deadlines of delayed objects are compared with the clocks of their process types
+	double expiration_clocks[(int)ProcessType::MAX] = {};
+	double expiration_clocks_at_last_fill[(int)ProcessType::MAX] = {};
+
+	// The number of instances from which culling and filling is performed in WorkerThreadPool
+	static constexpr size_t INSTANCES_COUNT_FOR_PARALLEL_FILL = 4096;
+
+	struct InstanceTypeFillResult {
+		CullingBox custom_aabb;
+		size_t visible_count = 0;
+		int64_t time_spent_to_cull = 0;
+		int64_t time_spent_to_fill = 0;
+	};
+
+	// A range of instances in the pool and its visibility mask
+	struct InstancesFillSegment {
+		const GeometryPoolData3DInstance *data;
+		const Color *custom;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		const uint32_t *cells;
+#endif
+		size_t count;
+		size_t mask_offset;
+	};
+
+	// A distant instance drawn by a simpler type of its LOD group
+	struct InstancesLODEntry {
+		const GeometryPoolData3DInstance *data;
+		const Color *custom;
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+		uint32_t cell;
+#endif
+	};
 
 	PackedFloat32Array temp_instances_buffers[(int)InstanceType::MAX];
+	std::vector<uint64_t> temp_visibility_masks[(int)InstanceType::MAX];
+	std::vector<InstancesFillSegment> temp_fill_segments[(int)InstanceType::MAX];
+	InstanceTypeFillResult instances_fill_results[(int)InstanceType::MAX];
+	std::vector<InstancesLODEntry> temp_lod_instances[(int)InstanceType::MAX];
+	struct InstancesFillPools {
+		processTypePools *procs;
+		RetainedPools *retained;
+	};
+	std::vector<InstancesFillPools> instances_fill_pools;
+	// The same culling data is used for all viewports of the World3D
+	const GeometryPoolCullingData *fill_culling_data = nullptr;
+	std::vector<InstanceType> instances_fill_types;
+	// LOD groups are culled and filled together, because their instances can be moved between the types
+	std::vector<InstanceType> instances_fill_groups;
+
+	// Buffers of the types and lines are filled again only if their objects or the culling data have changed since the previous fill
+	bool is_instances_dirty[(int)InstanceType::MAX];
+	bool is_lines_dirty;
+	uint32_t prev_culling_hash = 0;
 	size_t prev_buffer_visible_instance_count[(int)InstanceType::MAX] = {};
 	size_t prev_buffer_visible_lines_count = 0;
 
@@ -220,18 +735,91 @@ private:
 	int64_t time_spent_to_cull_instances = 0;
 	int64_t time_spent_to_cull_lines = 0;
 
+#if defined(REAL_T_IS_DOUBLE) && defined(FIX_PRECISION_ENABLED)
+	// Positions are stored as float offsets from the origins of large cells, so the objects are not touched when the center is moved.
+	// Only the offsets of the used cells relative to the center are updated before the fill.
+	static constexpr real_t POSITION_CELL_SIZE = 8192;
+
+	struct Vector3iHasher {
+		size_t operator()(const Vector3i &p_cell) const {
+			uint32_t h = hash_murmur3_one_32((uint32_t)p_cell.x);
+			h = hash_murmur3_one_32((uint32_t)p_cell.y, h);
+			return hash_fmix32(hash_murmur3_one_32((uint32_t)p_cell.z, h));
+		}
+	};
+
+	// The cells are checked for objects every `POSITION_CELLS_CHECK_FRAMES` frames,
+	// and the cells without objects in `POSITION_CELLS_PRUNE_CHECKS` checks in a row are removed.
+	static constexpr uint32_t POSITION_CELLS_CHECK_FRAMES = 60;
+	static constexpr uint8_t POSITION_CELLS_PRUNE_CHECKS = 5;
+
+	std::unordered_map<Vector3i, uint32_t, Vector3iHasher> position_cell_ids;
+	std::vector<Vector3i> position_cells;
+	std::vector<Vector3Float> position_cell_offsets;
+	std::vector<uint8_t> position_cell_unused_checks;
+	Vector3 position_cells_center;
+	uint32_t position_cells_check_frames = 0;
+	std::vector<uint32_t> temp_position_cells_remap;
+
+	void _set_instance_origin(InstancesStorage &p_storage, const size_t &p_idx, const Vector3 &p_origin);
+	uint32_t _get_position_cell(const Vector3 &p_position);
+	_FORCE_INLINE_ Vector3 _get_position_cell_origin(uint32_t p_cell) const {
+		const Vector3i &cell = position_cells[p_cell];
+		return Vector3((real_t)cell.x, (real_t)cell.y, (real_t)cell.z) * POSITION_CELL_SIZE;
+	}
+	void _update_position_cell_offsets();
+	// Calls `p_func(uint32_t &cell)` for the cells of all stored objects
+	template <class TFunc>
+	void _for_each_used_position_cell(TFunc p_func);
+	void _prune_position_cells();
+#endif
+
+	// Batches of lines with more vertices are split into chunks of this size, so each chunk is culled separately
+	static constexpr size_t LINES_CHUNK_VERTICES = 2048;
+	// The number of bits per axis of the grid used to sort the segments of a batch
+	static constexpr uint32_t LINES_CHUNK_GRID_BITS = 4;
+	std::vector<uint32_t> temp_lines_chunk_cells;
+	std::vector<uint32_t> temp_lines_chunk_offsets;
+	std::vector<Vector3> temp_lines_chunk_vertices;
+
 	// Internal use of raw pointer to avoid ref/unref
 	Color _scoped_config_to_custom(const DebugDraw3DScopeConfig::Data *p_cfg);
 	InstanceType _scoped_config_type_convert(ConvertableInstanceType p_type, const DebugDraw3DScopeConfig::Data *p_cfg);
 	GeometryType _scoped_config_get_geometry_type(const DebugDraw3DScopeConfig::Data *p_cfg);
 
 	bool _is_viewport_empty(Viewport *vp);
-
-	void fill_instance_data(const std::vector<Ref<MultiMesh> *> &p_meshes, std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> &p_culling_data);
-	void fill_lines_data(Ref<ArrayMesh> p_ig, std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> &p_culling_data);
+	RetainedPools &_get_or_create_retained_pools(const DebugDraw3DScopeConfig::Data *p_cfg);
+	RetainedPools *_get_retained_pools(const RetainedObjectId &p_id);
+	void _set_instance_data(const DebugDraw3DScopeConfig::Data *p_cfg, InstancesStorage &p_storage, const size_t &p_idx, const Transform3D &p_transform, const Color &p_col, const Color &p_custom_col, const SphereBounds &p_bounds);
+	void _update_retained_line_vertices(RetainedPools &p_pools, RetainedLine &p_line);
+	void _add_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb, const ProcessType &p_proc);
+	double _get_expiration_anchor_time(int p_proc);
+	static ProcessType _get_process_type(const ProcessType &p_proc);
+	void _mark_dirty(const InstanceType &p_type);
+
+	static void _fill_instance_group_task(void *p_userdata, uint32_t p_idx);
+	void _fill_instance_group(InstanceType p_group);
+	void _cull_instance_type(InstanceType p_type);
+	void _fill_instance_type_buffer(InstanceType p_type);
+	template <bool t_use_custom_data>
+	void _fill_instances_buffer(InstanceType p_type, float *r_buffer);
+	void fill_instance_data(const std::vector<MultiMeshStorage *> &p_meshes, const std::shared_ptr<GeometryPoolCullingData> &p_culling_data);
+	void fill_lines_data(ImmediateMeshStorage *p_ig, const std::shared_ptr<GeometryPoolCullingData> &p_culling_data);
 
 public:
-	GeometryPool() {}
+	// The number of floats per instance in the MultiMesh buffer of the type
+	static constexpr size_t get_instance_data_float_count(const InstanceType &p_type) {
+		return (sizeof(GeometryPoolData3DInstance) + (is_instance_custom_data_used(p_type) ? sizeof(Color) : 0)) / sizeof(float);
+	}
+
+	// The buffer of a MultiMesh must contain all of its instances, so the unused capacity is uploaded too.
+	// The capacity is kept slightly above the required number of instances and changes only when it leaves the hysteresis range.
+	static constexpr int64_t MULTIMESH_CAPACITY_STEP = 64;
+	static int64_t get_multimesh_capacity(const int64_t &p_capacity, const int64_t &p_required);
+
+	GeometryPool() {
+		mark_all_dirty();
+	}
 
 	~GeometryPool() {
 	}
@@ -241,18 +829,31 @@ public:
 
 	std::vector<Viewport *> get_and_validate_viewports();
 
-	void fill_mesh_data(const std::vector<Ref<MultiMesh> *> &p_meshes, Ref<ArrayMesh> p_ig, std::unordered_map<Viewport *, std::shared_ptr<GeometryPoolCullingData>> &p_culling_data);
+	void fill_mesh_data(const std::vector<MultiMeshStorage *> &p_meshes, ImmediateMeshStorage *p_ig, const std::shared_ptr<GeometryPoolCullingData> &p_culling_data);
 	void reset_counter(const double &p_delta, const ProcessType &p_proc = ProcessType::MAX);
 	void reset_visible_objects();
+	void mark_all_dirty();
 	void set_stats(Ref<DebugDraw3DStats> &p_stats) const;
 	void clear_pool();
-	void for_each_instance(const std::function<void(DelayedRendererInstance *)> &p_func);
+	void for_each_instance(const std::function<void(const DelayedRendererState &, const CullingSphere &, GeometryPoolData3DInstance &)> &p_func);
 	void for_each_line(const std::function<void(DelayedRendererLine *)> &p_func);
 	void update_expiration_delta(const double &p_delta, const ProcessType &p_proc);
-	// TODO: add a variant with mass addition of instances
 	void add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col = nullptr);
 	void add_or_update_instance(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds, const Color *p_custom_col = nullptr);
-	void add_or_update_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb);
+	// Adds `p_count` instances of the same type. `p_colors` can contain only one color for all instances.
+	// `ProcessType::MAX` means the process type of the current frame.
+	void add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col = nullptr, const ProcessType &p_proc = ProcessType::MAX);
+	void add_or_update_instances(const DebugDraw3DScopeConfig::Data *p_cfg, InstanceType p_type, const real_t &p_exp_time, const size_t &p_count, const Transform3D *p_transforms, const SphereBounds *p_bounds, const Color *p_colors, const size_t &p_colors_count, const Color *p_custom_col = nullptr, const ProcessType &p_proc = ProcessType::MAX);
+	// Large batches of lines are stored as several objects with their own bounds
+	void add_or_update_line(const DebugDraw3DScopeConfig::Data *p_cfg, const real_t &p_exp_time, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col, const AABB &p_aabb, const ProcessType &p_proc = ProcessType::MAX);
+
+	// Retained objects. Functions return false if the object no longer exists.
+	RetainedObjectId add_retained_instance(const DebugDraw3DScopeConfig::Data *p_cfg, ConvertableInstanceType p_type, const Transform3D &p_transform, const Color &p_col, const SphereBounds &p_bounds);
+	RetainedObjectId add_retained_line(const DebugDraw3DScopeConfig::Data *p_cfg, const Vector3 *p_lines, const size_t p_line_count, const Color &p_col);
+	bool update_retained_transform(const RetainedObjectId &p_id, const Transform3D &p_transform, const SphereBounds &p_bounds);
+	bool set_retained_color(const RetainedObjectId &p_id, const Color &p_col);
+	bool set_retained_visible(const RetainedObjectId &p_id, const bool &p_visible);
+	bool remove_retained(const RetainedObjectId &p_id);
 };
 
 #endif
\ No newline at end of file
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <cstdint>
+
+namespace godot {
+class Viewport;
+}
+
 enum class GeometryType : char {
 	Wireframe,
 	Volumetric,
@@ -48,8 +54,46 @@ enum class InstanceType : char {
 	MAX,
 };
 
+// Only the shaders of the volumetric and plane geometry read `INSTANCE_CUSTOM`
+constexpr bool is_instance_custom_data_used(const InstanceType &p_type) {
+	return (p_type >= InstanceType::LINE_VOLUMETRIC && p_type <= InstanceType::CAPSULE_EDGES_VOLUMETRIC) || p_type == InstanceType::PLANE;
+}
+
+// A simpler type for the distant instances of the volumetric types
+constexpr InstanceType get_instance_wireframe_type(const InstanceType &p_type) {
+	return (p_type >= InstanceType::CUBE_VOLUMETRIC && p_type <= InstanceType::CAPSULE_EDGES_VOLUMETRIC) ? (InstanceType)((int)p_type - (int)InstanceType::CUBE_VOLUMETRIC) : p_type;
+}
+
+// A simpler type for the distant instances of the HD spheres
+constexpr InstanceType get_instance_low_detail_type(const InstanceType &p_type) {
+	switch (p_type) {
+		case InstanceType::SPHERE_HD:
+			return InstanceType::SPHERE;
+		case InstanceType::SPHERE_HD_VOLUMETRIC:
+			return InstanceType::SPHERE_VOLUMETRIC;
+		default:
+			return p_type;
+	}
+}
+
+// Types whose instances can be drawn by each other at a distance have the same group
+constexpr InstanceType get_instance_lod_group(const InstanceType &p_type) {
+	return get_instance_low_detail_type(get_instance_wireframe_type(p_type));
+}
+
 enum class ProcessType : char {
 	PROCESS,
 	PHYSICS_PROCESS,
 	MAX,
 };
+
+// Location of a retained object in the GeometryPool
+struct RetainedObjectId {
+	godot::Viewport *viewport = nullptr;
+	// Serial number of the storage, it changes when the storage is recreated
+	uint64_t storage_serial = 0;
+	// InstanceType::MAX is used for lines
+	InstanceType type = InstanceType::MAX;
+	uint32_t idx = 0;
+	float bounds_padding = 0;
+};
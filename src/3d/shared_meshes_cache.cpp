@@ -0,0 +1,166 @@
+#include "shared_meshes_cache.h"
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "render_instances_enums.h"
+#include "utils/utils.h"
+#include "version.h"
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/templates/hashfuncs.hpp>
+GODOT_WARNING_RESTORE()
+
+uint32_t SharedMeshesCache::get_key(uint32_t p_settings_flags) {
+	uint32_t h = hash_murmur3_one_32(DD3D_VERSION);
+	h = hash_murmur3_one_32(FORMAT, h);
+	h = hash_murmur3_one_32((uint32_t)InstanceType::MAX, h);
+	h = hash_murmur3_one_32(p_settings_flags, h);
+	return hash_fmix32(h);
+}
+
+bool SharedMeshesCache::is_surface_valid(const Variant &p_surface) {
+	if (p_surface.get_type() != Variant::ARRAY) {
+		return false;
+	}
+
+	const Array surface = p_surface;
+	if (surface.size() != 3 || surface[0].get_type() != Variant::INT || surface[1].get_type() != Variant::INT || surface[2].get_type() != Variant::ARRAY) {
+		return false;
+	}
+
+	const int64_t primitive = surface[0];
+	const int64_t custom_mask = (int64_t)Mesh::ARRAY_FORMAT_CUSTOM_MASK << Mesh::ARRAY_FORMAT_CUSTOM0_SHIFT;
+	if ((primitive != Mesh::PRIMITIVE_LINES && primitive != Mesh::PRIMITIVE_TRIANGLES) || ((int64_t)surface[1] & ~custom_mask)) {
+		return false;
+	}
+
+	const Array arrays = surface[2];
+	if (arrays.size() != Mesh::ARRAY_MAX || arrays[Mesh::ARRAY_VERTEX].get_type() != Variant::PACKED_VECTOR3_ARRAY) {
+		return false;
+	}
+
+	const int64_t vertex_count = ((PackedVector3Array)arrays[Mesh::ARRAY_VERTEX]).size();
+	if (vertex_count == 0) {
+		return false;
+	}
+
+	// Only the arrays used by the generated meshes are allowed, and they must have one element per vertex
+	for (int i = 0; i < Mesh::ARRAY_MAX; i++) {
+		const Variant &arr = arrays[i];
+		if (arr.get_type() == Variant::NIL) {
+			continue;
+		}
+
+		switch (i) {
+			case Mesh::ARRAY_VERTEX:
+				break;
+			case Mesh::ARRAY_NORMAL:
+				if (arr.get_type() != Variant::PACKED_VECTOR3_ARRAY || ((PackedVector3Array)arr).size() != vertex_count)
+					return false;
+				break;
+			case Mesh::ARRAY_COLOR:
+				if (arr.get_type() != Variant::PACKED_COLOR_ARRAY || ((PackedColorArray)arr).size() != vertex_count)
+					return false;
+				break;
+			case Mesh::ARRAY_TEX_UV:
+			case Mesh::ARRAY_TEX_UV2:
+				if (arr.get_type() != Variant::PACKED_VECTOR2_ARRAY || ((PackedVector2Array)arr).size() != vertex_count)
+					return false;
+				break;
+			case Mesh::ARRAY_CUSTOM0:
+			case Mesh::ARRAY_CUSTOM1:
+			case Mesh::ARRAY_CUSTOM2:
+			case Mesh::ARRAY_CUSTOM3:
+				if (arr.get_type() != Variant::PACKED_FLOAT32_ARRAY && arr.get_type() != Variant::PACKED_BYTE_ARRAY)
+					return false;
+				break;
+			case Mesh::ARRAY_INDEX: {
+				if (arr.get_type() != Variant::PACKED_INT32_ARRAY)
+					return false;
+
+				const PackedInt32Array indexes = arr;
+				if (indexes.size() % (primitive == Mesh::PRIMITIVE_LINES ? 2 : 3))
+					return false;
+
+				const int32_t *r = indexes.ptr();
+				for (int64_t j = 0; j < indexes.size(); j++) {
+					if (r[j] < 0 || r[j] >= vertex_count)
+						return false;
+				}
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+Array SharedMeshesCache::load(uint32_t p_key, const String &p_path) {
+	ZoneScoped;
+	Array surfaces;
+	surfaces.resize((int)InstanceType::MAX);
+
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null() || file->get_32() != p_key) {
+		return surfaces;
+	}
+
+	Variant data = file->get_var();
+	if (data.get_type() != Variant::ARRAY || ((Array)data).size() != (int)InstanceType::MAX) {
+		return surfaces;
+	}
+
+	Array cached = data;
+	for (int i = 0; i < cached.size(); i++) {
+		if (is_surface_valid(cached[i])) {
+			surfaces[i] = cached[i];
+		} else if (cached[i].get_type() != Variant::NIL) {
+			DEV_PRINT_STD("The cached mesh of the instance type %d is damaged and will be generated again\n", i);
+		}
+	}
+	return surfaces;
+}
+
+void SharedMeshesCache::save(uint32_t p_key, const Array &p_surfaces, const String &p_path) {
+	ZoneScoped;
+	// The cache is written to a temporary file first, so an interrupted write does not damage the previous cache
+	const String path = PS()->globalize_path(p_path);
+	const String tmp_path = path + ".tmp";
+
+	Ref<FileAccess> file = FileAccess::open(tmp_path, FileAccess::WRITE);
+	if (file.is_null()) {
+		DEV_PRINT_STD("Failed to save the cache of the generated meshes: %s\n", tmp_path.utf8().get_data());
+		return;
+	}
+
+	file->store_32(p_key);
+	file->store_var(p_surfaces);
+	const bool is_written = file->get_error() == OK;
+	// the file is closed when the last reference is released
+	file.unref();
+
+	if (!is_written || DirAccess::rename_absolute(tmp_path, path) != OK) {
+		DEV_PRINT_STD("Failed to save the cache of the generated meshes: %s\n", path.utf8().get_data());
+		DirAccess::remove_absolute(tmp_path);
+	}
+}
+
+Array SharedMeshesCache::get_surface(const Ref<ArrayMesh> &p_mesh) {
+	Array surface;
+	surface.push_back((int64_t)p_mesh->surface_get_primitive_type(0));
+	surface.push_back((int64_t)(p_mesh->surface_get_format(0) & ((int64_t)Mesh::ARRAY_FORMAT_CUSTOM_MASK << Mesh::ARRAY_FORMAT_CUSTOM0_SHIFT)));
+	surface.push_back(p_mesh->surface_get_arrays(0));
+	return surface;
+}
+
+Ref<ArrayMesh> SharedMeshesCache::create_mesh(const Array &p_surface) {
+	Ref<ArrayMesh> mesh;
+	mesh.instantiate();
+	mesh->add_surface_from_arrays((Mesh::PrimitiveType)(int64_t)p_surface[0], p_surface[2], Array(), Dictionary(), (int64_t)p_surface[1]);
+	return mesh;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#ifndef DISABLE_DEBUG_RENDERING
+
+#include "utils/compiler.h"
+
+#include <cstdint>
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/classes/array_mesh.hpp>
+GODOT_WARNING_RESTORE()
+using namespace godot;
+
+// Generated meshes are cached until the addon or the settings used to generate them are changed.
+// Each type is stored separately, so only the types that have been used are generated and saved.
+class SharedMeshesCache {
+public:
+	static constexpr const char *DEFAULT_PATH = "user://dd3d_generated_meshes.cache";
+	static constexpr uint32_t FORMAT = 2;
+
+	static uint32_t get_key(uint32_t p_settings_flags);
+	// Checks a surface stored by `get_surface`, so a damaged cache cannot create a broken mesh
+	static bool is_surface_valid(const Variant &p_surface);
+	// Returns the surfaces of all instance types. The types missing in the cache are `null`.
+	static Array load(uint32_t p_key, const String &p_path = DEFAULT_PATH);
+	static void save(uint32_t p_key, const Array &p_surfaces, const String &p_path = DEFAULT_PATH);
+
+	// [primitive type, custom format flags, arrays]
+	static Array get_surface(const Ref<ArrayMesh> &p_mesh);
+	static Ref<ArrayMesh> create_mesh(const Array &p_surface);
+};
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// A min-heap of the deadlines of objects, so only the expired objects are touched to retire them.
+class ExpirationQueue {
+	struct Entry {
+		double deadline;
+		size_t idx;
+
+		bool operator>(const Entry &p_other) const {
+			return deadline > p_other.deadline;
+		}
+	};
+
+	std::vector<Entry> entries;
+
+public:
+	void push(double p_deadline, size_t p_idx) {
+		entries.push_back({ p_deadline, p_idx });
+		std::push_heap(entries.begin(), entries.end(), std::greater<Entry>());
+	}
+
+	// Returns true if the next `pop_expired` with `p_time` will retire any objects
+	bool is_due(double p_time) const {
+		return entries.size() && entries.front().deadline < p_time;
+	}
+
+	// Removes the objects whose deadlines are earlier than `p_time` in the order of their deadlines.
+	// `p_on_retire` is called with the index of each removed object.
+	template <class TFunc>
+	void pop_expired(double p_time, TFunc p_on_retire) {
+		while (is_due(p_time)) {
+			const size_t idx = entries.front().idx;
+			std::pop_heap(entries.begin(), entries.end(), std::greater<Entry>());
+			entries.pop_back();
+			p_on_retire(idx);
+		}
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	void clear() {
+		entries.clear();
+	}
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A chunked linear allocator. All allocations are released at once by `reset`,
+// but the chunks are retained for the next allocations.
+// Pointers stay valid until `reset` or `clear`.
+template <typename TValue>
+class LinearArena {
+	struct Chunk {
+		std::unique_ptr<TValue[]> data;
+		size_t size;
+	};
+
+	std::vector<Chunk> chunks;
+	size_t min_chunk_size;
+	size_t max_chunk_size;
+	size_t current_chunk;
+	size_t used_in_chunk;
+
+public:
+	LinearArena(size_t p_min_chunk_size = 4096, size_t p_max_chunk_size = SIZE_MAX) :
+			min_chunk_size(p_min_chunk_size),
+			max_chunk_size(std::max(p_min_chunk_size, p_max_chunk_size)),
+			current_chunk(0),
+			used_in_chunk(0) {
+	}
+
+	TValue *allocate(size_t p_count) {
+		while (current_chunk < chunks.size()) {
+			Chunk &c = chunks[current_chunk];
+			if (c.size - used_in_chunk >= p_count) {
+				TValue *res = c.data.get() + used_in_chunk;
+				used_in_chunk += p_count;
+				return res;
+			}
+			current_chunk++;
+			used_in_chunk = 0;
+		}
+
+		// Each new chunk is twice as big as the previous one, up to `max_chunk_size`.
+		size_t new_size = std::max(std::max(min_chunk_size, p_count), std::min(chunks.size() ? chunks.back().size * 2 : 0, max_chunk_size));
+		chunks.push_back({ std::unique_ptr<TValue[]>(new TValue[new_size]), new_size });
+		current_chunk = chunks.size() - 1;
+		used_in_chunk = p_count;
+		return chunks.back().data.get();
+	}
+
+	void reset() {
+		current_chunk = 0;
+		used_in_chunk = 0;
+	}
+
+	// Frees the chunks that were not used since the last `reset`.
+	void trim() {
+		if (chunks.size() > current_chunk + 1) {
+			chunks.resize(current_chunk + 1);
+		}
+	}
+
+	void clear() {
+		chunks.clear();
+		reset();
+	}
+
+	size_t capacity() const {
+		size_t res = 0;
+		for (const auto &c : chunks) {
+			res += c.size;
+		}
+		return res;
+	}
+};
+
+// An allocator with power of two size classes.
+// Released blocks are kept in free lists of their class and reused by the next allocations of the same class.
+// The memory of a class is returned by `trim` once all of its blocks are released.
+template <typename TValue>
+class SizeClassAllocator {
+	static constexpr size_t SIZE_CLASSES_COUNT = sizeof(size_t) * 8;
+	static constexpr size_t MIN_CHUNK_SIZE = 4096;
+	// Bursts of allocations do not make the next chunks bigger than this
+	static constexpr size_t MAX_CHUNK_SIZE = 65536;
+
+	struct SizeClass {
+		LinearArena<TValue> arena;
+		std::vector<TValue *> free_blocks;
+		// The number of allocated blocks that are not released
+		size_t used_blocks = 0;
+	};
+
+	SizeClass classes[SIZE_CLASSES_COUNT];
+
+	static size_t get_size_class(size_t p_count) {
+		size_t c = 0;
+		while (((size_t)1 << c) < p_count) {
+			c++;
+		}
+		return c;
+	}
+
+public:
+	SizeClassAllocator() {
+		for (size_t i = 0; i < SIZE_CLASSES_COUNT; i++) {
+			// Small blocks are allocated in batches, big blocks one by one.
+			const size_t block_size = (size_t)1 << i;
+			classes[i].arena = LinearArena<TValue>(std::max(block_size, MIN_CHUNK_SIZE), std::max(block_size, MAX_CHUNK_SIZE));
+		}
+	}
+
+	TValue *allocate(size_t p_count) {
+		size_t c = get_size_class(p_count);
+		SizeClass &sc = classes[c];
+		sc.used_blocks++;
+		if (sc.free_blocks.size()) {
+			TValue *res = sc.free_blocks.back();
+			sc.free_blocks.pop_back();
+			return res;
+		}
+		return sc.arena.allocate((size_t)1 << c);
+	}
+
+	// `p_count` must be the same as in `allocate`.
+	void free(TValue *p_ptr, size_t p_count) {
+		if (!p_ptr) {
+			return;
+		}
+
+		SizeClass &sc = classes[get_size_class(p_count)];
+		sc.free_blocks.push_back(p_ptr);
+		sc.used_blocks--;
+	}
+
+	// Frees the chunks of the classes without allocated blocks.
+	void trim() {
+		for (auto &sc : classes) {
+			if (sc.used_blocks == 0 && sc.free_blocks.size()) {
+				sc.arena.clear();
+				sc.free_blocks = std::vector<TValue *>();
+			}
+		}
+	}
+
+	// Invalidates all allocated blocks.
+	void clear() {
+		for (auto &sc : classes) {
+			sc.arena.clear();
+			sc.free_blocks.clear();
+			sc.used_blocks = 0;
+		}
+	}
+
+	// The number of allocated blocks that are not released
+	size_t get_used_blocks() const {
+		size_t res = 0;
+		for (const auto &sc : classes) {
+			res += sc.used_blocks;
+		}
+		return res;
+	}
+
+	size_t capacity() const {
+		size_t res = 0;
+		for (const auto &sc : classes) {
+			res += sc.arena.capacity();
+		}
+		return res;
+	}
+};
@@ -38,3 +38,37 @@ AABBMinMax::AABBMinMax(const SphereBounds &p_from) :
 	min = p_from.position - half;
 	max = p_from.position + half;
 }
+
+void MathUtils::sort_lines_by_z_order(const Vector3 *p_lines, size_t p_count, const AABB &p_aabb, uint32_t p_grid_bits, std::vector<uint32_t> &r_cells, std::vector<uint32_t> &r_offsets, Vector3 *r_sorted) {
+	const uint32_t grid_size = 1 << p_grid_bits;
+	const size_t segments_count = p_count / 2;
+
+	real_t scale[3];
+	for (int a = 0; a < 3; a++) {
+		scale[a] = p_aabb.size[a] > (real_t)CMP_EPSILON ? grid_size / p_aabb.size[a] : 0;
+	}
+
+	r_cells.resize(segments_count);
+	r_offsets.assign((size_t)grid_size * grid_size * grid_size + 1, 0);
+	for (size_t i = 0; i < segments_count; i++) {
+		const Vector3 center = (p_lines[i * 2] + p_lines[i * 2 + 1]) * 0.5f;
+		uint32_t c[3];
+		for (int a = 0; a < 3; a++) {
+			c[a] = (uint32_t)CLAMP((int64_t)((center[a] - p_aabb.position[a]) * scale[a]), (int64_t)0, (int64_t)grid_size - 1);
+		}
+
+		const uint32_t cell = get_z_order_index(c[0], c[1], c[2], p_grid_bits);
+		r_cells[i] = cell;
+		r_offsets[cell + 1]++;
+	}
+
+	for (size_t i = 1; i < r_offsets.size(); i++) {
+		r_offsets[i] += r_offsets[i - 1];
+	}
+
+	for (size_t i = 0; i < segments_count; i++) {
+		const size_t dst = r_offsets[r_cells[i]]++;
+		r_sorted[dst * 2] = p_lines[i * 2];
+		r_sorted[dst * 2 + 1] = p_lines[i * 2 + 1];
+	}
+}
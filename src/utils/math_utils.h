@@ -4,6 +4,7 @@
 
 #include <array>
 #include <functional>
+#include <vector>
 
 GODOT_WARNING_DISABLE()
 #include <godot_cpp/variant/builtin_types.hpp>
@@ -30,6 +31,12 @@ public:
 	_FORCE_INLINE_ static std::array<Vector3, 8> get_frustum_cube(const std::array<Plane, 6> p_frustum);
 	_FORCE_INLINE_ static std::array<Vector3, 8> get_frustum_cube(const Plane *p_frustum_data, const uint64_t p_frustum_size);
 	_FORCE_INLINE_ static void scale_frustum_far_plane_distance(std::array<Plane, 6> &p_frustum, const Transform3D &p_camera_xf, const real_t &p_scale);
+
+	// Interleaves the bits of the cell coordinates, so the cells that are close in space are close in the order
+	_FORCE_INLINE_ static uint32_t get_z_order_index(uint32_t p_x, uint32_t p_y, uint32_t p_z, uint32_t p_bits);
+	// Copies the segments of `p_lines` to `r_sorted` in the Z-order of the cells of their centers using the counting sort.
+	// `p_aabb` is split into `2^p_grid_bits` cells on each axis. `r_cells` and `r_offsets` are temporary buffers.
+	static void sort_lines_by_z_order(const Vector3 *p_lines, size_t p_count, const AABB &p_aabb, uint32_t p_grid_bits, std::vector<uint32_t> &r_cells, std::vector<uint32_t> &r_offsets, Vector3 *r_sorted);
 };
 
 struct SphereBounds {
@@ -156,6 +163,14 @@ _FORCE_INLINE_ AABB MathUtils::calculate_vertex_bounds(const Vector3 *p_lines, s
 	}
 }
 
+_FORCE_INLINE_ uint32_t MathUtils::get_z_order_index(uint32_t p_x, uint32_t p_y, uint32_t p_z, uint32_t p_bits) {
+	uint32_t res = 0;
+	for (uint32_t b = 0; b < p_bits; b++) {
+		res |= ((p_x >> b) & 1) << (b * 3) | ((p_y >> b) & 1) << (b * 3 + 1) | ((p_z >> b) & 1) << (b * 3 + 2);
+	}
+	return res;
+}
+
 _FORCE_INLINE_ std::array<Vector3, 8> MathUtils::get_frustum_cube(const std::array<Plane, 6> p_frustum) {
 	return get_frustum_cube(p_frustum.data(), p_frustum.size());
 }
@@ -0,0 +1,9 @@
+extends SceneTree
+
+# Runs the internal tests of the C++ test library and exits with a non-zero code if any of them has failed.
+# Start it from a project with this addon: godot --headless --script res://<addon folder>/dd3d_internal_tests.gd
+
+func _initialize():
+	var is_passed: bool = DD3DInternalTests.run()
+	print("DD3D internal tests: ", "passed" if is_passed else "FAILED")
+	quit(0 if is_passed else 1)
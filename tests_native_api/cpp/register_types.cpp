@@ -1,6 +1,7 @@
 /* register_types.cpp */
 
 #include "test_api_node.h"
+#include "test_internals.h"
 
 #include "../src/utils/compiler.h"
 #include "../src/utils/profiler.h"
@@ -18,6 +19,7 @@ void initialize_dd3d_test_cpp_api_module(ModuleInitializationLevel p_level) {
 		tracy::GetProfiler().SetProgramName("tests_native_api");
 #endif
 		ClassDB::register_class<DD3DTestCppApiNode>();
+		ClassDB::register_class<DD3DInternalTests>();
 	}
 }
 
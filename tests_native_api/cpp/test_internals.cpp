@@ -0,0 +1,418 @@
+#include "test_internals.h"
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/core/error_macros.hpp>
+GODOT_WARNING_RESTORE()
+
+#ifndef DISABLE_DEBUG_RENDERING
+#include "3d/culling_bvh.h"
+#include "3d/culling_kernels.h"
+#include "3d/render_instances_enums.h"
+#include "3d/shared_meshes_cache.h"
+#include "common/expiration_queue.h"
+#include "common/pool_allocators.h"
+#include "utils/math_utils.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+GODOT_WARNING_RESTORE()
+
+// Unlike `DEV_ASSERT`, the checks work in all builds. A failed check prints an error and fails the test.
+#define TEST_CHECK(m_cond) ERR_FAIL_COND_V(!(m_cond), false)
+
+static std::vector<CullingSphere> generate_spheres(size_t p_count, real_t p_extent, real_t p_max_radius, uint32_t p_seed) {
+	std::mt19937 rng(p_seed);
+	std::uniform_real_distribution<real_t> pos(-p_extent, p_extent);
+	std::uniform_real_distribution<real_t> radius(0, p_max_radius);
+
+	std::vector<CullingSphere> res(p_count);
+	for (auto &s : res) {
+		s = CullingSphere(SphereBounds(Vector3(pos(rng), pos(rng), pos(rng)), radius(rng)));
+	}
+	return res;
+}
+
+// An axis aligned cube with the planes facing outwards
+static CullingFrustum get_cube_frustum(const Vector3 &p_center, real_t p_half_size) {
+	CullingFrustum res;
+	for (int i = 0; i < 6; i++) {
+		Vector3 normal;
+		normal[i % 3] = i < 3 ? 1 : -1;
+		res[i] = CullingPlane(Plane(normal, normal.dot(p_center) + p_half_size));
+	}
+	return res;
+}
+
+bool DD3DInternalTests::test_culling_kernels() {
+	const CullingBox boxes[] = {
+		CullingBox(AABBMinMax(AABB(Vector3(-20, -20, -20), Vector3(50, 50, 50)))),
+		CullingBox(AABBMinMax(AABB(Vector3(35, -50, -50), Vector3(5, 100, 100)))),
+	};
+	const CullingFrustum frustums[] = {
+		get_cube_frustum(Vector3(), 10),
+		get_cube_frustum(Vector3(35, 0, 0), 15),
+	};
+
+	// The SIMD kernels process the spheres in groups, so the counts around the sizes of the groups and of the mask words are checked
+	for (size_t count : { 1, 3, 4, 5, 63, 64, 65, 1003 }) {
+		const std::vector<CullingSphere> spheres = generate_spheres(count, 50, 5, (uint32_t)count);
+
+		for (size_t boxes_count = 0; boxes_count <= 2; boxes_count++) {
+			for (size_t frustums_count = 0; frustums_count <= 2; frustums_count++) {
+				// The bits after the last sphere must be cleared by the kernel
+				std::vector<uint64_t> mask(CullingKernels::get_mask_size(count), UINT64_MAX);
+				CullingKernels::cull_spheres(spheres.data(), count, boxes, boxes_count, frustums, frustums_count, mask.data());
+
+				for (size_t i = 0; i < count; i++) {
+					TEST_CHECK(CullingKernels::is_visible(mask.data(), i) == CullingKernels::is_sphere_visible(spheres[i], boxes, boxes_count, frustums, frustums_count));
+				}
+				for (size_t i = count; i < mask.size() * 64; i++) {
+					TEST_CHECK(!CullingKernels::is_visible(mask.data(), i));
+				}
+			}
+		}
+	}
+
+	// Spheres touching the planes are visible
+	{
+		const CullingFrustum frustum = get_cube_frustum(Vector3(), 10);
+		const CullingBox box(AABBMinMax(AABB(Vector3(-20, -20, -20), Vector3(40, 40, 40))));
+		const CullingSphere spheres[] = {
+			CullingSphere(SphereBounds(Vector3(11, 0, 0), 1)),
+			CullingSphere(SphereBounds(Vector3(0, -12, 0), 1)),
+		};
+
+		uint64_t mask = 0;
+		CullingKernels::cull_spheres(spheres, 2, &box, 1, &frustum, 1, &mask);
+		TEST_CHECK(CullingKernels::is_visible(&mask, 0));
+		TEST_CHECK(!CullingKernels::is_visible(&mask, 1));
+	}
+
+#ifdef REAL_T_IS_DOUBLE
+	// The distances far from the origin must not lose the precision of the positions
+	{
+		CullingFrustum frustum = get_cube_frustum(Vector3(), 1e9);
+		frustum[0] = CullingPlane(Plane(Vector3(1, 0, 0), 1e7));
+		const CullingBox box(AABBMinMax(AABB(Vector3(-1e9, -1e9, -1e9), Vector3(2e9, 2e9, 2e9))));
+		const CullingSphere spheres[] = {
+			CullingSphere(SphereBounds(Vector3(1e7 + 0.25, 0, 0), 0.2)),
+			CullingSphere(SphereBounds(Vector3(1e7 + 0.25, 0, 0), 0.3)),
+		};
+
+		uint64_t mask = 0;
+		CullingKernels::cull_spheres(spheres, 2, &box, 1, &frustum, 1, &mask);
+		TEST_CHECK(!CullingKernels::is_visible(&mask, 0));
+		TEST_CHECK(CullingKernels::is_visible(&mask, 1));
+	}
+#endif
+	return true;
+}
+
+bool DD3DInternalTests::test_culling_bvh() {
+	const size_t count = CullingBVH::MIN_SLOTS_COUNT * 2;
+	std::vector<CullingSphere> spheres = generate_spheres(count, 100, 2, 42);
+	const CullingBox box(AABBMinMax(AABB(Vector3(-30, -30, -30), Vector3(80, 80, 80))));
+	const CullingFrustum frustum = get_cube_frustum(Vector3(10, 0, 0), 25);
+
+	CullingBVH tree;
+	tree.build(spheres.data(), count);
+	TEST_CHECK(tree.is_built());
+	TEST_CHECK(tree.get_indexed_count() == count);
+
+	// Moved and added slots must be found as well
+	spheres[7] = CullingSphere(SphereBounds(Vector3(5, 5, 5), 1));
+	tree.update(7, spheres[7]);
+	spheres.push_back(CullingSphere(SphereBounds(Vector3(-5, 0, 0), 1)));
+
+	auto check = [&](const CullingBox *p_boxes, size_t p_boxes_count, const CullingFrustum *p_frustums, size_t p_frustums_count) {
+		std::vector<char> found(spheres.size(), 0);
+		bool is_valid = true;
+		tree.query(spheres.size(), p_boxes, p_boxes_count, p_frustums, p_frustums_count, [&](size_t p_idx, bool p_is_inside) {
+			// Each slot is passed once, and the slots inside the volumes must be visible
+			if (p_idx >= spheres.size() || found[p_idx] || (p_is_inside && !CullingKernels::is_sphere_visible(spheres[p_idx], p_boxes, p_boxes_count, p_frustums, p_frustums_count))) {
+				is_valid = false;
+				return;
+			}
+			found[p_idx] = 1;
+		});
+		TEST_CHECK(is_valid);
+
+		// The tree can pass invisible slots, but must not skip the visible ones
+		for (size_t i = 0; i < spheres.size(); i++) {
+			if (CullingKernels::is_sphere_visible(spheres[i], p_boxes, p_boxes_count, p_frustums, p_frustums_count)) {
+				TEST_CHECK(found[i]);
+			}
+		}
+		return true;
+	};
+
+	TEST_CHECK(check(&box, 1, nullptr, 0));
+	TEST_CHECK(check(&box, 1, &frustum, 1));
+	TEST_CHECK(check(nullptr, 0, nullptr, 0));
+
+	tree.clear();
+	TEST_CHECK(!tree.is_built());
+	return true;
+}
+
+bool DD3DInternalTests::test_size_class_allocator() {
+	SizeClassAllocator<uint32_t> alloc;
+
+	// Blocks of the same class are reused
+	uint32_t *a = alloc.allocate(3);
+	alloc.free(a, 3);
+	uint32_t *b = alloc.allocate(4);
+	TEST_CHECK(a == b);
+	TEST_CHECK(alloc.get_used_blocks() == 1);
+
+	// Live blocks of any size do not overlap
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<size_t> size_dist(1, 5000);
+	std::vector<std::pair<uint32_t *, size_t>> blocks;
+	for (uint32_t i = 0; i < 300; i++) {
+		const size_t size = size_dist(rng);
+		uint32_t *p = alloc.allocate(size);
+		std::fill(p, p + size, i);
+		blocks.push_back({ p, size });
+
+		// Free some of the blocks, so the next ones reuse them
+		if (i % 3 == 0) {
+			const size_t idx = rng() % blocks.size();
+			alloc.free(blocks[idx].first, blocks[idx].second);
+			blocks.erase(blocks.begin() + idx);
+		}
+	}
+
+	for (const auto &blk : blocks) {
+		const uint32_t value = blk.first[0];
+		for (size_t j = 0; j < blk.second; j++) {
+			TEST_CHECK(blk.first[j] == value);
+		}
+	}
+	TEST_CHECK(alloc.get_used_blocks() == blocks.size() + 1);
+
+	// The memory of the classes without used blocks is returned
+	for (const auto &blk : blocks) {
+		alloc.free(blk.first, blk.second);
+	}
+	alloc.free(b, 4);
+	TEST_CHECK(alloc.get_used_blocks() == 0);
+	alloc.trim();
+	TEST_CHECK(alloc.capacity() == 0);
+
+	// Freeing `nullptr` does nothing
+	alloc.free(nullptr, 10);
+	TEST_CHECK(alloc.get_used_blocks() == 0);
+	return true;
+}
+
+bool DD3DInternalTests::test_expiration_queue() {
+	ExpirationQueue queue;
+	TEST_CHECK(!queue.is_due(1000));
+
+	const double deadlines[] = { 5, 1, 3, 2, 4 };
+	for (size_t i = 0; i < 5; i++) {
+		queue.push(deadlines[i], i);
+	}
+	TEST_CHECK(queue.size() == 5);
+	TEST_CHECK(!queue.is_due(1));
+	TEST_CHECK(queue.is_due(1.5));
+
+	// The objects are retired in the order of their deadlines, and only the deadlines earlier than the time are retired
+	std::vector<size_t> retired;
+	queue.pop_expired(3, [&retired](size_t p_idx) { retired.push_back(p_idx); });
+	TEST_CHECK(retired.size() == 2);
+	TEST_CHECK(retired[0] == 1 && retired[1] == 3);
+	TEST_CHECK(queue.size() == 3);
+
+	// Deadlines added later are ordered with the rest
+	queue.push(0.5, 10);
+	retired.clear();
+	queue.pop_expired(4.5, [&retired](size_t p_idx) { retired.push_back(p_idx); });
+	TEST_CHECK(retired.size() == 3);
+	TEST_CHECK(retired[0] == 10 && retired[1] == 2 && retired[2] == 4);
+
+	queue.clear();
+	TEST_CHECK(queue.size() == 0);
+	TEST_CHECK(!queue.is_due(1000));
+	return true;
+}
+
+bool DD3DInternalTests::test_z_order() {
+	TEST_CHECK(MathUtils::get_z_order_index(0, 0, 0, 4) == 0);
+	TEST_CHECK(MathUtils::get_z_order_index(1, 0, 0, 4) == 1);
+	TEST_CHECK(MathUtils::get_z_order_index(0, 1, 0, 4) == 2);
+	TEST_CHECK(MathUtils::get_z_order_index(0, 0, 1, 4) == 4);
+	TEST_CHECK(MathUtils::get_z_order_index(2, 0, 0, 4) == 8);
+	TEST_CHECK(MathUtils::get_z_order_index(15, 15, 15, 4) == 4095);
+
+	// Each cell of the grid has its own index
+	{
+		std::vector<char> used(64, 0);
+		for (uint32_t x = 0; x < 4; x++) {
+			for (uint32_t y = 0; y < 4; y++) {
+				for (uint32_t z = 0; z < 4; z++) {
+					const uint32_t idx = MathUtils::get_z_order_index(x, y, z, 2);
+					TEST_CHECK(idx < 64 && !used[idx]);
+					used[idx] = 1;
+				}
+			}
+		}
+	}
+
+	// The sorted segments are the same segments in the order of the cells of their centers
+	const uint32_t bits = 3;
+	const AABB aabb(Vector3(-10, -20, -30), Vector3(20, 40, 60));
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<real_t> t(0, 1);
+
+	std::vector<Vector3> lines(2000);
+	for (auto &v : lines) {
+		v = aabb.position + aabb.size * Vector3(t(rng), t(rng), t(rng));
+	}
+
+	std::vector<uint32_t> cells, offsets;
+	std::vector<Vector3> sorted(lines.size());
+	MathUtils::sort_lines_by_z_order(lines.data(), lines.size(), aabb, bits, cells, offsets, sorted.data());
+
+	// The same cells as in `sort_lines_by_z_order`
+	auto get_cell = [&](const Vector3 &p_a, const Vector3 &p_b) {
+		const Vector3 center = (p_a + p_b) * 0.5f;
+		uint32_t c[3];
+		for (int a = 0; a < 3; a++) {
+			c[a] = (uint32_t)CLAMP((int64_t)((center[a] - aabb.position[a]) * ((1 << bits) / aabb.size[a])), (int64_t)0, (int64_t)(1 << bits) - 1);
+		}
+		return MathUtils::get_z_order_index(c[0], c[1], c[2], bits);
+	};
+
+	// The segments are moved as a whole and keep their original order inside the cells
+	std::vector<size_t> order(lines.size() / 2);
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+		TEST_CHECK(cells[i] == get_cell(lines[i * 2], lines[i * 2 + 1]));
+	}
+	std::stable_sort(order.begin(), order.end(), [&cells](size_t a, size_t b) { return cells[a] < cells[b]; });
+
+	for (size_t i = 0; i < order.size(); i++) {
+		TEST_CHECK(sorted[i * 2] == lines[order[i] * 2]);
+		TEST_CHECK(sorted[i * 2 + 1] == lines[order[i] * 2 + 1]);
+	}
+	return true;
+}
+
+bool DD3DInternalTests::test_shared_meshes_cache() {
+	// The key changes with the settings
+	TEST_CHECK(SharedMeshesCache::get_key(0) == SharedMeshesCache::get_key(0));
+	TEST_CHECK(SharedMeshesCache::get_key(0) != SharedMeshesCache::get_key(1));
+	TEST_CHECK(SharedMeshesCache::get_key(1) != SharedMeshesCache::get_key(2));
+
+	auto make_surface = [](Mesh::PrimitiveType p_primitive, int64_t p_format, const std::vector<Vector3> &p_vertices, const std::vector<int32_t> &p_indexes) {
+		PackedVector3Array vertices;
+		for (const Vector3 &v : p_vertices) {
+			vertices.push_back(v);
+		}
+
+		Array arrays;
+		arrays.resize(Mesh::ARRAY_MAX);
+		arrays[Mesh::ARRAY_VERTEX] = vertices;
+		if (p_indexes.size()) {
+			PackedInt32Array indexes;
+			for (int32_t i : p_indexes) {
+				indexes.push_back(i);
+			}
+			arrays[Mesh::ARRAY_INDEX] = indexes;
+		}
+
+		Array surface;
+		surface.push_back((int64_t)p_primitive);
+		surface.push_back(p_format);
+		surface.push_back(arrays);
+		return surface;
+	};
+
+	const std::vector<Vector3> vertices = { Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(0, 1, 0) };
+	const Array valid = make_surface(Mesh::PRIMITIVE_TRIANGLES, 0, vertices, { 0, 1, 2 });
+	TEST_CHECK(SharedMeshesCache::is_surface_valid(valid));
+	TEST_CHECK(SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_LINES, 0, vertices, { 0, 1, 1, 2 })));
+
+	// Damaged surfaces
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(Variant()));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(Array()));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_TRIANGLES, 0, vertices, { 0, 1, 3 })));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_TRIANGLES, 0, vertices, { 0, 1 })));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_TRIANGLES, 0, vertices, { 0, -1, 2 })));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_POINTS, 0, vertices, {})));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_TRIANGLES, Mesh::ARRAY_FLAG_USE_2D_VERTICES, vertices, { 0, 1, 2 })));
+	TEST_CHECK(!SharedMeshesCache::is_surface_valid(make_surface(Mesh::PRIMITIVE_TRIANGLES, 0, {}, {})));
+	{
+		Array surface = valid.duplicate(true);
+		Array arrays = surface[2];
+		PackedVector3Array normals;
+		normals.push_back(Vector3(0, 0, 1));
+		arrays[Mesh::ARRAY_NORMAL] = normals;
+		TEST_CHECK(!SharedMeshesCache::is_surface_valid(surface));
+
+		PackedColorArray colors;
+		colors.resize(3);
+		arrays[Mesh::ARRAY_NORMAL] = colors;
+		TEST_CHECK(!SharedMeshesCache::is_surface_valid(surface));
+
+		arrays.resize(Mesh::ARRAY_MAX - 1);
+		TEST_CHECK(!SharedMeshesCache::is_surface_valid(surface));
+	}
+
+	// The meshes are created from the surfaces and back
+	Ref<ArrayMesh> mesh = SharedMeshesCache::create_mesh(valid);
+	TEST_CHECK(mesh.is_valid() && mesh->get_surface_count() == 1);
+	TEST_CHECK(SharedMeshesCache::is_surface_valid(SharedMeshesCache::get_surface(mesh)));
+
+	// Only the valid surfaces with the same key are loaded
+	const String path = "user://dd3d_test_meshes.cache";
+	const uint32_t key = SharedMeshesCache::get_key(0);
+
+	Array surfaces;
+	surfaces.resize((int)InstanceType::MAX);
+	surfaces[0] = valid;
+	surfaces[1] = make_surface(Mesh::PRIMITIVE_TRIANGLES, 0, vertices, { 0, 1, 5 });
+	SharedMeshesCache::save(key, surfaces, path);
+
+	const Array loaded = SharedMeshesCache::load(key, path);
+	TEST_CHECK(loaded.size() == (int)InstanceType::MAX);
+	TEST_CHECK(loaded[0].get_type() == Variant::ARRAY);
+	TEST_CHECK(loaded[1].get_type() == Variant::NIL);
+	TEST_CHECK(loaded[2].get_type() == Variant::NIL);
+
+	const Array other_key = SharedMeshesCache::load(key + 1, path);
+	TEST_CHECK(other_key.size() == (int)InstanceType::MAX);
+	TEST_CHECK(other_key[0].get_type() == Variant::NIL);
+
+	// The temporary file is replaced
+	TEST_CHECK(!FileAccess::file_exists(path + ".tmp"));
+	DirAccess::remove_absolute(ProjectSettings::get_singleton()->globalize_path(path));
+	return true;
+}
+#endif
+
+void DD3DInternalTests::_bind_methods() {
+	ClassDB::bind_static_method(get_class_static(), D_METHOD(NAMEOF(run)), &DD3DInternalTests::run);
+}
+
+bool DD3DInternalTests::run() {
+	bool is_passed = true;
+#ifndef DISABLE_DEBUG_RENDERING
+	// All the tests are run even after a failure
+	is_passed = test_culling_kernels() && is_passed;
+	is_passed = test_culling_bvh() && is_passed;
+	is_passed = test_size_class_allocator() && is_passed;
+	is_passed = test_expiration_queue() && is_passed;
+	is_passed = test_z_order() && is_passed;
+	is_passed = test_shared_meshes_cache() && is_passed;
+#endif
+	return is_passed;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "utils/compiler.h"
+
+GODOT_WARNING_DISABLE()
+#include <godot_cpp/classes/object.hpp>
+GODOT_WARNING_RESTORE()
+using namespace godot;
+
+// Behaviour tests of the internal parts of the addon that do not need a running DebugDraw3D.
+// The sources of these parts are compiled into the test library.
+// The tests are started by `dd3d_internal_tests.gd`.
+class DD3DInternalTests : public Object {
+	GDCLASS(DD3DInternalTests, Object)
+
+	static bool test_culling_kernels();
+	static bool test_culling_bvh();
+	static bool test_size_class_allocator();
+	static bool test_expiration_queue();
+	static bool test_z_order();
+	static bool test_shared_meshes_cache();
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Returns false if any of the tests has failed. Each failed check is printed as an error.
+	static bool run();
+};